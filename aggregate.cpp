@@ -0,0 +1,475 @@
+//
+// aggregate.cpp
+//
+#include <algorithm>        // std::sort, std::partial_sort, std::push_heap, std::pop_heap
+#include <strings.h>        // strncasecmp
+#include <string.h>         // strlen
+#include "aggregate.h"
+#include "ingest.h"
+
+//
+// AggregateSpec
+//
+bool AggregateSpec::Parse(std::string_view groupByStr, std::string_view columnsStr, std::string_view orderByStr, Schema& schema)
+{
+    err.clear();
+
+    // Calls func(item) for every item of the comma separated list
+    auto forEachItem = [](std::string_view list, auto func)
+    {
+        while(!list.empty())
+        {
+            size_t end = std::min(list.find(','), list.size());
+            std::string_view item = LineParser::Trim(list.substr(0, end));
+            if(!item.empty() && !func(item))
+                return false;
+            list.remove_prefix(std::min(end + 1, list.size()));
+        }
+        return true;
+    };
+
+    auto equals = [](std::string_view str, const char* word)
+        { return str.size() == strlen(word) && strncasecmp(str.data(), word, str.size()) == 0; };
+
+    // "func(field)" into a column, with the name normalized
+    auto parseColumn = [&](std::string_view item, Column& column)
+    {
+        size_t open = item.find('(');
+        std::string_view funcName = LineParser::Trim(item.substr(0, open));
+        std::string_view fieldName;
+        if(open != std::string_view::npos)
+        {
+            if(item.back() != ')')
+            {
+                err = "Missing closing ')' in '" + std::string(item) + "'";
+                return false;
+            }
+            fieldName = LineParser::Trim(item.substr(open + 1, item.size() - open - 2));
+        }
+
+        if(equals(funcName, "count") && (fieldName.empty() || fieldName == "*"))
+        {
+            column.func = COUNT;
+            column.name = "count";
+            return true;
+        }
+
+        column.func = (equals(funcName, "sum") ? SUM : equals(funcName, "min") ? MIN :
+                       equals(funcName, "max") ? MAX : equals(funcName, "avg") ? AVG : COUNT);
+        if(column.func == COUNT)
+        {
+            err = "Unknown aggregate '" + std::string(item) + "' (expected count, sum, min, max or avg)";
+            return false;
+        }
+        if(fieldName.empty())
+        {
+            err = "Expected a field name in '" + std::string(item) + "'";
+            return false;
+        }
+
+        static const char* funcNames[] = { "count", "sum", "min", "max", "avg" };
+        column.field = schema.Bind(fieldName);
+        column.name = std::string(funcNames[column.func]) + "(" + std::string(fieldName) + ")";
+        return true;
+    };
+
+    bool parsed = forEachItem(groupByStr, [&](std::string_view name)
+    {
+        if(groupBy.size() == 64)
+        {
+            err = "Too many GROUP BY fields";
+            return false;
+        }
+        groupBy.push_back({schema.Bind(name), std::string(name)});
+        return true;
+    });
+
+    parsed = parsed && forEachItem(columnsStr, [&](std::string_view item)
+    {
+        Column column;
+        if(!parseColumn(item, column))
+            return false;
+        columns.push_back(std::move(column));
+        return true;
+    });
+    if(!parsed)
+        return false;
+
+    if(!groupBy.empty() && columns.empty())
+        columns.push_back({COUNT, INVALID_FIELD_ID, "count"});
+
+    // "name [ASC|DESC]"
+    std::string_view orderBy = LineParser::Trim(orderByStr);
+    if(orderBy.empty())
+        return true;
+
+    size_t space = orderBy.find_last_of(" \t");
+    if(space != std::string_view::npos)
+    {
+        std::string_view direction = orderBy.substr(space + 1);
+        if(equals(direction, "DESC") || equals(direction, "ASC"))
+        {
+            descending = equals(direction, "DESC");
+            orderBy = LineParser::Trim(orderBy.substr(0, space));
+        }
+    }
+
+    if(!IsGrouping())
+    {
+        orderField = schema.Bind(orderBy);
+        return true;
+    }
+
+    // Groups are ordered by an aggregate or a GROUP BY field
+    if(orderBy.find('(') != std::string_view::npos || equals(orderBy, "count"))
+    {
+        Column column;
+        if(!parseColumn(orderBy, column))
+            return false;
+        for(size_t i = 0; i < columns.size(); i++)
+        {
+            if(columns[i].name == column.name)
+                orderColumn = (int)i;
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < groupBy.size(); i++)
+        {
+            if(groupBy[i].name == orderBy)
+                orderGroupBy = (int)i;
+        }
+    }
+
+    if(orderColumn < 0 && orderGroupBy < 0)
+    {
+        err = "ORDER BY '" + std::string(orderBy) + "' is neither a GROUP BY field nor an aggregate of the query";
+        return false;
+    }
+    return true;
+}
+
+//
+// Aggregator
+//
+size_t Aggregator::GroupKeyHash::operator()(const GroupKey& key) const
+{
+    size_t hash = std::hash<uint64_t>()(key.nulls);
+    for(const Value& value : key.values)
+        hash ^= ValueHash()(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+Value Aggregator::Detach(const Value& value)
+{
+    if(!value.IsInterned())
+        return value;
+
+    Value copy;
+    copy.Assign(value.GetString());
+    return copy;
+}
+
+void Aggregator::OnMatch(const Record& rec)
+{
+    rowCount++;
+    if(!spec.IsGrouping())
+    {
+        AddRow(rec);
+        return;
+    }
+
+    // Look up the group with the recycled key, that is copied for a new
+    // group only, so a row of an existing group doesn't allocate
+    key.values.resize(spec.groupBy.size());
+    key.nulls = 0;
+    for(size_t i = 0; i < spec.groupBy.size(); i++)
+    {
+        const Value* value = rec.GetValue(spec.groupBy[i].field);
+        if(value)
+        {
+            key.values[i] = *value;
+        }
+        else
+        {
+            key.values[i] = Value();
+            key.nulls |= (uint64_t(1) << i);
+        }
+    }
+
+    auto it = groups.find(key);
+    if(it == groups.end())
+    {
+        GroupKey newKey;
+        newKey.nulls = key.nulls;
+        for(const Value& value : key.values)
+            newKey.values.push_back(Detach(value));
+
+        it = groups.emplace(std::move(newKey), Group()).first;
+        it->second.states.resize(spec.columns.size());
+    }
+
+    Group& group = it->second;
+    group.rowCount++;
+    for(size_t i = 0; i < spec.columns.size(); i++)
+    {
+        const AggregateSpec::Column& column = spec.columns[i];
+        if(column.func == AggregateSpec::COUNT)
+            continue;
+
+        const Value* value = rec.GetValue(column.field);
+        if(value)
+            AddValue(group.states[i], column.func, *value);
+    }
+}
+
+void Aggregator::OnError(const std::string& errIn)
+{
+    if(errorCount++ == 0)
+        err = errIn;
+}
+
+void Aggregator::AddValue(State& state, AggregateSpec::Function func, const Value& value)
+{
+    if(func == AggregateSpec::SUM || func == AggregateSpec::AVG)
+    {
+        if(value.IsInt())
+        {
+            state.sum += value.GetInt();
+            state.count++;
+        }
+        else if(value.IsDouble())
+        {
+            state.doubleSum += value.GetDouble();
+            state.isDouble = true;
+            state.count++;
+        }
+    }
+    else if(func == AggregateSpec::MIN)
+    {
+        if(state.count++ == 0 || value < state.min)
+            state.min = Detach(value);
+    }
+    else if(func == AggregateSpec::MAX)
+    {
+        if(state.count++ == 0 || value > state.max)
+            state.max = Detach(value);
+    }
+}
+
+void Aggregator::AddRow(const Record& rec)
+{
+    const Value* value = rec.GetValue(spec.orderField);
+    if(!value || spec.limit == 0)
+        return;
+
+    // Rows ranked after the last kept one are skipped without formatting
+    if(rows.size() == spec.limit)
+    {
+        const Value& last = rows.front().key;
+        if(spec.descending ? *value < last : *value > last)
+            return;
+    }
+
+    Row row{Detach(*value), std::string()};
+    rec.Format(row.line, &spec.fields);
+    AddRow(std::move(row));
+}
+
+// Bounded heap of the limit top rows, with the last ranked one on top
+void Aggregator::AddRow(Row&& row)
+{
+    auto isBetter = [this](const Row& a, const Row& b) { return IsBetter(a, b); };
+
+    if(rows.size() < spec.limit)
+    {
+        rows.push_back(std::move(row));
+        std::push_heap(rows.begin(), rows.end(), isBetter);
+        return;
+    }
+
+    if(!IsBetter(row, rows.front()))
+        return;
+
+    std::pop_heap(rows.begin(), rows.end(), isBetter);
+    rows.back() = std::move(row);
+    std::push_heap(rows.begin(), rows.end(), isBetter);
+}
+
+// Note: Rows of the same ORDER BY value are ranked by their text, so the
+// result doesn't depend on the order the rows were added in (by threads)
+bool Aggregator::IsBetter(const Row& a, const Row& b) const
+{
+    if(a.key != b.key)
+        return (spec.descending ? a.key > b.key : a.key < b.key);
+    return a.line < b.line;
+}
+
+bool Aggregator::IsBetter(const GroupKey& keyA, const Group& a, const GroupKey& keyB, const Group& b) const
+{
+    // Compares the values of a column (-1, 0 or 1), NULL first
+    auto compare = [](bool nullA, bool nullB, const auto& valueA, const auto& valueB)
+    {
+        if(nullA || nullB)
+            return (nullA == nullB ? 0 : nullA ? -1 : 1);
+        return (valueA < valueB ? -1 : valueB < valueA ? 1 : 0);
+    };
+
+    auto compareGroupBy = [&](size_t i)
+    {
+        uint64_t bit = uint64_t(1) << i;
+        return compare((keyA.nulls & bit) != 0, (keyB.nulls & bit) != 0, keyA.values[i], keyB.values[i]);
+    };
+
+    int cmp = 0;
+    if(spec.orderGroupBy >= 0)
+    {
+        cmp = compareGroupBy(spec.orderGroupBy);
+    }
+    else if(spec.orderColumn >= 0)
+    {
+        const State& stateA = a.states[spec.orderColumn];
+        const State& stateB = b.states[spec.orderColumn];
+        switch(spec.columns[spec.orderColumn].func)
+        {
+            case AggregateSpec::COUNT: cmp = compare(false, false, a.rowCount, b.rowCount); break;
+            case AggregateSpec::SUM:   cmp = compare(stateA.count == 0, stateB.count == 0, stateA.GetSum(), stateB.GetSum()); break;
+            case AggregateSpec::MIN:   cmp = compare(stateA.count == 0, stateB.count == 0, stateA.min, stateB.min); break;
+            case AggregateSpec::MAX:   cmp = compare(stateA.count == 0, stateB.count == 0, stateA.max, stateB.max); break;
+            case AggregateSpec::AVG:
+                cmp = compare(stateA.count == 0, stateB.count == 0, stateA.GetAverage(), stateB.GetAverage());
+                break;
+        }
+    }
+
+    if(cmp != 0)
+        return (spec.descending ? cmp > 0 : cmp < 0);
+
+    // Then by the GROUP BY values
+    for(size_t i = 0; i < keyA.values.size(); i++)
+    {
+        if((cmp = compareGroupBy(i)) != 0)
+            return cmp < 0;
+    }
+    return false;
+}
+
+void Aggregator::Merge(const Aggregator& other)
+{
+    rowCount += other.rowCount;
+    if(errorCount == 0)
+        err = other.err;
+    errorCount += other.errorCount;
+
+    for(const Row& row : other.rows)
+        AddRow(Row(row));
+
+    for(const auto& [otherKey, otherGroup] : other.groups)
+    {
+        auto it = groups.find(otherKey);
+        if(it == groups.end())
+        {
+            groups.emplace(otherKey, otherGroup);
+            continue;
+        }
+
+        Group& group = it->second;
+        group.rowCount += otherGroup.rowCount;
+        for(size_t i = 0; i < spec.columns.size(); i++)
+        {
+            State& state = group.states[i];
+            const State& otherState = otherGroup.states[i];
+            AggregateSpec::Function func = spec.columns[i].func;
+
+            if(func == AggregateSpec::SUM || func == AggregateSpec::AVG)
+            {
+                state.sum += otherState.sum;
+                state.doubleSum += otherState.doubleSum;
+                state.isDouble |= otherState.isDouble;
+                state.count += otherState.count;
+            }
+            else if((func == AggregateSpec::MIN || func == AggregateSpec::MAX) && otherState.count > 0)
+            {
+                AddValue(state, func, (func == AggregateSpec::MIN ? otherState.min : otherState.max));
+                state.count += otherState.count - 1;
+            }
+        }
+    }
+}
+
+size_t Aggregator::Dump(std::ostream& os) const
+{
+    // Top rows
+    if(!spec.IsGrouping())
+    {
+        std::vector<Row> sorted(rows);
+        std::sort(sorted.begin(), sorted.end(), [this](const Row& a, const Row& b) { return IsBetter(a, b); });
+
+        for(size_t i = 0; i < sorted.size(); i++)
+            os << i + 1 << ": " << sorted[i].line;
+        if(sorted.empty())
+            os << "No matches found" << std::endl;
+        return sorted.size();
+    }
+
+    // Aggregates without GROUP BY are a single group, even with no rows
+    GroupKey emptyKey;
+    Group emptyGroup;
+    emptyGroup.states.resize(spec.columns.size());
+
+    using Entry = std::pair<const GroupKey*, const Group*>;
+    std::vector<Entry> sorted;
+    sorted.reserve(groups.size());
+    for(const auto& [groupKey, group] : groups)
+        sorted.emplace_back(&groupKey, &group);
+    if(sorted.empty() && spec.groupBy.empty())
+        sorted.emplace_back(&emptyKey, &emptyGroup);
+
+    // Note: partial_sort is a heap sort, much slower than sort for all groups
+    auto isBetter = [this](const Entry& a, const Entry& b) { return IsBetter(*a.first, *a.second, *b.first, *b.second); };
+    size_t count = (spec.limit > 0 ? std::min(spec.limit, sorted.size()) : sorted.size());
+    if(count < sorted.size())
+        std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(), isBetter);
+    else
+        std::sort(sorted.begin(), sorted.end(), isBetter);
+
+    for(size_t n = 0; n < count; n++)
+    {
+        const GroupKey& groupKey = *sorted[n].first;
+        const Group& group = *sorted[n].second;
+        os << n + 1 << ": ";
+
+        for(size_t i = 0; i < spec.groupBy.size(); i++)
+        {
+            os << "'" << spec.groupBy[i].name << "'=";
+            if(groupKey.nulls & (uint64_t(1) << i))
+                os << "NULL";
+            else
+                os << groupKey.values[i];
+            os << ", ";
+        }
+
+        for(size_t i = 0; i < spec.columns.size(); i++)
+        {
+            const State& state = group.states[i];
+            AggregateSpec::Function func = spec.columns[i].func;
+            os << (i > 0 ? ", " : "") << spec.columns[i].name << "=";
+
+            if(func == AggregateSpec::COUNT)
+                os << group.rowCount;
+            else if(state.count == 0)
+                os << "NULL";
+            else if(func == AggregateSpec::SUM)
+                os << state.GetSum();
+            else if(func == AggregateSpec::AVG)
+                os << state.GetAverage();
+            else
+                os << (func == AggregateSpec::MIN ? state.min : state.max);
+        }
+        os << '\n';
+    }
+
+    if(count == 0)
+        os << "No matches found" << std::endl;
+    return count;
+}
@@ -0,0 +1,170 @@
+//
+// aggregate.h
+//
+#ifndef __AGGREGATE_H__
+#define __AGGREGATE_H__
+
+#include <iostream>         // std::cout
+#include <algorithm>        // std::max
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>         // int64_t, uint64_t
+#include "record.h"
+
+//
+// Aggregation of the matching rows (set from the app command line):
+//   GROUP BY fields with count/sum/min/max/avg aggregates, optionally
+//   ORDER BY a group field or an aggregate, LIMIT K groups
+// or, without grouping,
+//   ORDER BY field LIMIT K rows (top K)
+//
+struct AggregateSpec
+{
+    enum Function : char
+    {
+        COUNT=0, SUM, MIN, MAX, AVG
+    };
+
+    struct GroupField
+    {
+        FieldId field{INVALID_FIELD_ID};
+        std::string name;
+    };
+
+    struct Column
+    {
+        Function func{COUNT};
+        FieldId field{INVALID_FIELD_ID};    // Not used by COUNT
+        std::string name;                   // "count", "sum(BookNumber)", ...
+    };
+
+    std::vector<GroupField> groupBy;        // Up to 64 fields
+    std::vector<Column> columns;            // Just count, if none is given with groupBy
+
+    // ORDER BY a field of the rows, or a group field or a column of
+    // the groups (whichever is set)
+    FieldId orderField{INVALID_FIELD_ID};
+    int orderGroupBy{-1};                   // Index in groupBy
+    int orderColumn{-1};                    // Index in columns
+    bool descending{false};
+
+    size_t limit{0};                        // Rows or groups to print (0 for all)
+    std::vector<FieldId> fields;            // Printed fields of the rows (all if empty)
+
+    // Parses the comma separated GROUP BY fields, aggregates (such as
+    // "count, sum(BookNumber)") and the "name [ASC|DESC]" ORDER BY, and
+    // binds the field names to the schema. Any of them may be empty.
+    bool Parse(std::string_view groupByStr, std::string_view columnsStr, std::string_view orderByStr, Schema& schema);
+    const std::string& GetError() const { return err; }
+
+    bool IsGrouping() const { return !groupBy.empty() || !columns.empty(); }
+    bool IsOrdering() const { return orderField != INVALID_FIELD_ID || orderGroupBy >= 0 || orderColumn >= 0; }
+
+    std::string err;
+};
+
+//
+// Class Aggregator.
+// Streaming aggregation: matching rows are folded into hash-grouped
+// aggregates (or a bounded heap of the top K rows) as they are scanned,
+// so memory depends on the number of groups (or K), not on the number
+// of rows. Aggregator is a Scanner SINK (see scanner.h). Every scanning
+// thread aggregates into its own partial Aggregator, and the partials
+// are merged at the end.
+// Note: Sums and averages are of the number values only (an integer sum
+// unless there are double values). Rows that have no value for the ORDER
+// BY field are not ordered (skipped).
+//
+class Aggregator
+{
+public:
+    Aggregator(const AggregateSpec& specIn) : spec(specIn) {}
+    ~Aggregator() = default;
+
+    // Scanner SINK
+    void OnMatch(const Record& rec);
+    void OnError(const std::string& errIn);
+    bool IsDone() const { return false; }
+
+    // Adds the results of another (partial) aggregator
+    void Merge(const Aggregator& other);
+    const AggregateSpec& GetSpec() const { return spec; }
+
+    // Prints the groups (or the top rows) numbered as the matches are,
+    // then "No matches found" if there are none. Returns the number of
+    // printed lines.
+    size_t Dump(std::ostream& os) const;
+
+    uint64_t GetRowCount() const { return rowCount; }
+    size_t GetGroupCount() const { return groups.size(); }
+    uint64_t GetErrorCount() const { return errorCount; }
+    const std::string& GetError() const { return err; }     // First error
+
+private:
+    // GROUP BY values of a group (missing values are NULL)
+    struct GroupKey
+    {
+        std::vector<Value> values;
+        uint64_t nulls{0};                  // Bit i is set if value i is NULL
+
+        bool operator==(const GroupKey& key) const { return nulls == key.nulls && values == key.values; }
+    };
+
+    struct GroupKeyHash
+    {
+        size_t operator()(const GroupKey& key) const;
+    };
+
+    // State of an aggregate column
+    struct State
+    {
+        int64_t sum{0};
+        double doubleSum{0};                // Of the double values
+        bool isDouble{false};               // Has double values
+        uint64_t count{0};                  // Number values (SUM, AVG), any values (MIN, MAX)
+        Value min;
+        Value max;
+
+        Value GetSum() const { return (isDouble ? Value((double)sum + doubleSum) : Value(sum)); }
+        double GetAverage() const { return GetSum().GetNumber() / std::max<uint64_t>(count, 1); }
+    };
+
+    struct Group
+    {
+        uint64_t rowCount{0};
+        std::vector<State> states;          // By column
+    };
+
+    // Top K row: the ORDER BY value and the formatted row
+    struct Row
+    {
+        Value key;
+        std::string line;
+    };
+
+    void AddRow(const Record& rec);
+    void AddRow(Row&& row);
+    bool IsBetter(const Row& a, const Row& b) const;
+    bool IsBetter(const GroupKey& keyA, const Group& a, const GroupKey& keyB, const Group& b) const;
+    void AddValue(State& state, AggregateSpec::Function func, const Value& value);
+
+    // Copy of the value that doesn't refer to a scanner Dictionary
+    // (that may be released before the aggregator)
+    static Value Detach(const Value& value);
+
+    const AggregateSpec& spec;
+    std::unordered_map<GroupKey, Group, GroupKeyHash> groups;
+    GroupKey key;                           // Look up key (recycled)
+    std::vector<Row> rows;                  // Heap of the top rows, the last ranked first
+    uint64_t rowCount{0};
+    uint64_t errorCount{0};
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    Aggregator(const Aggregator&) = delete;
+    Aggregator& operator=(const Aggregator&) = delete;
+};
+
+#endif // __AGGREGATE_H__
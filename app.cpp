@@ -3,64 +3,583 @@
 //
 #include <iostream>         // std::cout
 #include <fstream>          // std::ifstream
-#include <sstream>          // std::stringstream
-#include <map>
+#include <vector>
+#include <chrono>
+#include <thread>           // std::thread::hardware_concurrency()
 #include <unistd.h>         // access()
-#include <string.h>         // strerror()
-#include "constraints.h"
+#include <string.h>         // strerror(), strcmp()
+#include "scanner.h"
+#include "constraintset.h"
+#include "index.h"
+#include "querycache.h"
+#include "output.h"
+#include "aggregate.h"
+#include "server.h"
 #include "logger.h"
 
-//
-// Test Object class to evaluate
-//
-class Object : public std::map<std::string, Value>
+// Prints numbered matches (buffered), or only counts them with
+// options.countOnly, until options.limit matches are found
+struct OutputSink
 {
-public:
-    const Value* GetValue(const std::string& name) const
+    OutputSink(OutputBuffer& outIn, const ScanOptions& optsIn) : out(outIn), opts(optsIn) {}
+
+    OutputBuffer& out;
+    const ScanOptions& opts;
+    int matchCount{0};
+    bool skipped{false};    // A match came after IsDone()
+
+    void OnMatch(const Record& rec)
+    {
+        if(IsDone())
+        {
+            skipped = true;
+            return;
+        }
+
+        matchCount++;
+        if(opts.countOnly)
+            return;
+
+        out.WriteInt(matchCount);
+        out.Write(": ");
+        out.Write(rec, &opts.fields);
+    }
+
+    // Note: Errors are printed unbuffered, after the matches before them
+    void OnError(const std::string& err)
     {
-        auto it = find(name);
-        return (it == end() ? nullptr : &it->second);
+        out.Flush();
+        ERRORMSG(err);
     }
 
-    void SetValue(const std::string& name, const std::string& valueStr)
+    bool IsDone() const { return opts.limit > 0 && (size_t)matchCount >= opts.limit; }
+};
+
+// Prints the match count (countOnly), or a note if there are no matches,
+// and if the limit stopped the scan before the end of the input
+void PrintSummary(int matchCount, const ScanOptions& opts, bool stopped)
+{
+    if(opts.countOnly)
+        std::cout << "Count: " << matchCount << std::endl;
+    else if(matchCount == 0)
+        std::cout << "No matches found" << std::endl;
+
+    if(stopped)
+        std::cout << "Stopped at the limit of " << opts.limit << " matches" << std::endl;
+}
+
+void Usage(const char* app)
+{
+    std::cout << "Usage: " << app << " [options] [inputFile] [constraints]" << std::endl
+              << "Options:" << std::endl
+              << "  --tree    Evaluate by walking the constraints tree instead of the compiled program" << std::endl
+              << "  --batch   Evaluate blocks of rows in columnar form with SIMD kernels" << std::endl
+              << "  --mmap    Memory map the input file and tokenize it in place" << std::endl
+              << "  --threads N  Scan the input file with N threads (implies --mmap)" << std::endl
+              << "  --adaptive N  Reorder AND/OR predicates by their observed pass rates every N rows" << std::endl
+              << "  --no-optimize  Evaluate the constraints as written, without simplifying them" << std::endl
+              << "  --explain  Profile the evaluation and print the constraints annotated with per node statistics" << std::endl
+              << "  --explain-json  Same as --explain, but print the annotated constraints as JSON" << std::endl
+              << "  --dict FIELDS  Dictionary-encode string values of comma separated FIELDS ('*' for all)" << std::endl
+              << "  --convert FILE  Convert the input file into the binary columnar FILE" << std::endl
+              << "                  (columnar input files are detected and queried without parsing)" << std::endl
+              << "  --count   Print only the number of matches" << std::endl
+              << "  --limit N  Stop reading the input after N matches" << std::endl
+              << "  --fields FIELDS  Print only the comma separated FIELDS of the matches" << std::endl
+              << "  --group-by FIELDS  Aggregate the matches by the comma separated FIELDS" << std::endl
+              << "  --agg LIST  Print the comma separated aggregates: count, sum(F), min(F), max(F), avg(F)" << std::endl
+              << "  --order-by \"NAME [ASC|DESC]\"  Order the groups by a GROUP BY field or an aggregate," << std::endl
+              << "                  or the matches by a field (top --limit N matches)" << std::endl
+              << "  --index   Build bitmap indexes of the low cardinality fields and query them" << std::endl
+              << "  --subscribe FILE  Match every input line against all constraints of FILE (one per line)" << std::endl
+              << "  --follow  Scan the input file, then the lines appended to it as they arrive" << std::endl
+              << "                  (until the file is deleted or moved, or --limit N matches)" << std::endl
+              << "  --serve SOCKET  Load the input file into memory and answer the queries of the clients" << std::endl
+              << "                  of the Unix SOCKET with --threads N workers (one per core by default), until SIGINT or SIGTERM" << std::endl
+              << "  --connect SOCKET  Send the constraints arguments to the server at once and print the responses" << std::endl
+              << "                  (\"COUNT\" and \"LIMIT N\" prefixes of the constraints apply to a query)" << std::endl;
+}
+
+// Builds bitmap indexes of the input file and evaluates all the queries
+// with them. Results are cached by the canonical form of the constraints,
+// so repeated queries don't evaluate the index again. Returns false (after
+// printing the reason) if a single query can't be evaluated with the index,
+// so the caller can scan the file instead.
+bool QueryIndex(const char* inputFileName, const std::vector<const char*>& queries, Schema& schema,
+                const ScanOptions& opts, int& ret)
+{
+    using Clock = std::chrono::steady_clock;
+    auto msec = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+    ret = 1;
+    MappedFile mappedFile;
+    if(!mappedFile.Open(inputFileName))
     {
-        Value& value = operator[](name); // Add a new value
-        value = valueStr;
+        ERRORMSG(mappedFile.GetError());
+        return true;
     }
 
-    std::ostream& Dump(std::ostream& os = std::cout) const
+    Clock::time_point start = Clock::now();
+    Index index(schema);
+    index.Build(mappedFile);
+    std::cout << "Index: " << index.GetRowCount() << " rows, " << index.GetBitmapCount() << " bitmaps, "
+              << index.GetMemorySize() / 1024 << " KB, built in " << msec(start) << " ms" << std::endl;
+
+    QueryCache cache;
+    LineParser parser(schema);
+    Record obj(schema);
+
+    for(const char* constraintsStr : queries)
     {
-        for(auto itr = begin(); itr != end(); ++itr)
+        Constraints constraints;
+        if(!constraints.Parse(constraintsStr, &schema))
+        {
+            ERRORMSG(constraints.GetError());
+            return true;
+        }
+        constraints.Dump(std::cout);
+
+        std::string key = constraints.GetCanonical();
+        std::cout << "Canonical: " << key << std::endl << std::endl;
+
+        start = Clock::now();
+        QueryCache::Rows rows = cache.Find(key, index.GetVersion());
+        bool cached = (rows != nullptr);
+        if(!cached)
         {
-            if(itr != begin())
-                os << ", ";
-            os << "'" << itr->first << "'=" << itr->second;
+            RowBitmap result;
+            if(!constraints.EvaluateIndex(index, result))
+            {
+                if(queries.size() == 1)
+                {
+                    ERRORMSG(constraints.GetError() << ", scanning instead");
+                    return false;
+                }
+                ERRORMSG(constraints.GetError());
+                continue;
+            }
+            rows = cache.Insert(key, index.GetVersion(), std::move(result));
         }
-        return (empty() ? os : os << std::endl);
+        double queryTime = msec(start);
+
+        // Materialize the matching rows only (the count is in the bitmap)
+        int matchCount = (int)rows->Count();
+        bool stopped = (opts.limit > 0 && (size_t)matchCount > opts.limit);
+        if(stopped)
+            matchCount = (int)opts.limit;
+
+        if(!opts.countOnly)
+        {
+            OutputBuffer out(std::cout);
+            OutputSink sink(out, opts);
+            rows->ForEach([&](uint32_t row)
+            {
+                if(sink.IsDone())
+                    return;
+                parser.Parse(index.GetRow(row), obj);
+                sink.OnMatch(obj);
+            });
+        }
+
+        PrintSummary(matchCount, opts, stopped);
+        std::cout << "Index query: " << matchCount << " rows in " << queryTime << " ms"
+                  << (cached ? " (cached)" : "") << std::endl << std::endl;
     }
-};
 
-std::string& TrimString(std::string& str)
+    ret = 0;
+    return true;
+}
+
+// Converts the text input file into the binary columnar format
+int Convert(const char* inputFileName, const char* outputFileName, Schema& schema)
+{
+    MappedFile mappedFile;
+    if(!mappedFile.Open(inputFileName))
+    {
+        ERRORMSG(mappedFile.GetError());
+        return 1;
+    }
+
+    LineParser parser(schema);
+    Record obj(schema);
+    ColumnFileWriter writer;
+
+    mappedFile.ForEachLine([&](std::string_view line)
+    {
+        parser.Parse(line, obj);
+        writer.Append(obj);
+    });
+
+    if(!writer.Write(outputFileName))
+    {
+        ERRORMSG(writer.GetError());
+        return 1;
+    }
+
+    std::cout << "Converted " << writer.GetRowCount() << " rows (" << writer.GetRowGroupCount()
+              << " row groups) into '" << outputFileName << "'" << std::endl;
+    return 0;
+}
+
+// Matches every line of the input file against all constraints of the
+// subscriptions file (ids are the line numbers) and prints the matching ids
+int Subscribe(const char* inputFileName, const char* subscriptionsFileName, Schema& schema, const ScanOptions& opts)
+{
+    ConstraintSet constraintSet(schema);
+
+    std::ifstream subs(subscriptionsFileName);
+    if(!subs)
+    {
+        ERRORMSG("Cannot open subscriptions file '" << subscriptionsFileName << "'");
+        return 1;
+    }
+
+    std::string line;
+    for(ConstraintSet::Id id = 1; std::getline(subs, line); id++)
+    {
+        if(LineParser::Trim(line).empty())
+            continue;
+        if(!constraintSet.Add(id, line))
+        {
+            ERRORMSG("Subscription " << id << ": " << constraintSet.GetError());
+            return 1;
+        }
+    }
+
+    std::cout << constraintSet.GetSize() << " subscriptions, "
+              << constraintSet.GetPredicateCount() << " distinct predicates" << std::endl << std::endl;
+
+    std::ifstream in(inputFileName);
+    if(!in)
+    {
+        ERRORMSG("Cannot open input file '" << inputFileName << "'");
+        return 1;
+    }
+
+    Record obj(schema);
+    std::vector<ConstraintSet::Id> ids;
+    int matchCount = 0;
+    OutputBuffer out(std::cout);
+
+    while((opts.limit == 0 || (size_t)matchCount < opts.limit) && std::getline(in, line))
+    {
+        ParseLine(line, schema, obj);
+        constraintSet.Match(obj, ids);
+        if(ids.empty())
+            continue;
+
+        ++matchCount;
+        if(opts.countOnly)
+            continue;
+
+        out.WriteInt(matchCount);
+        out.Write(": [");
+        for(size_t i = 0; i < ids.size(); i++)
+        {
+            if(i > 0)
+                out.Write(", ");
+            out.WriteInt(ids[i]);
+        }
+        out.Write("] ");
+        out.Write(obj, &opts.fields);
+    }
+    out.Flush();
+
+    // Lines are left once the limit stops the loop
+    PrintSummary(matchCount, opts, in && in.peek() != std::ifstream::traits_type::eof());
+    return 0;
+}
+
+// Scans the lines of the input file, then waits for the lines appended to
+// it and scans just them (with the constraints already parsed), until the
+// file is deleted or moved, or the sink has enough matches. The matches
+// are printed as soon as every appended block is scanned.
+bool Follow(const char* inputFileName, Scanner& scanner, OutputSink& sink)
 {
-    const char* whiteSpace = " \t\v\r\n";
-    size_t start = str.find_first_not_of(whiteSpace);
-    size_t end = str.find_last_not_of(whiteSpace);
-    if(start == end)
-        str.clear();
+    FollowedFile file;
+    if(!file.Open(inputFileName))
+    {
+        ERRORMSG(file.GetError());
+        return false;
+    }
+
+    auto processLine = [&](std::string_view line) { scanner.ProcessLine(line, sink); return !sink.IsDone(); };
+    for(bool following = true; ; )
+    {
+        // Note: After the file is deleted, the last appended lines are
+        // still read
+        bool ok = file.ReadLines(processLine);
+        scanner.Flush(sink);
+        sink.out.Flush();
+        std::cout.flush();
+
+        if(!ok)
+        {
+            ERRORMSG(file.GetError());
+            return false;
+        }
+        if(!following || sink.IsDone())
+            break;
+        following = file.Wait();
+    }
+
+    if(!sink.IsDone())
+        std::cout << "Stopped following: " << file.GetError() << std::endl;
+    return true;
+}
+
+// Loads the input file into memory (in the columnar form) once, and
+// answers the queries of the socket clients (see server.h) with
+// threadCount workers (0: one per core)
+int Serve(const char* inputFileName, const char* socketPath, Schema& schema, const ScanOptions& opts, size_t threadCount)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    ColumnFile data;
+    if(ColumnFile::IsColumnFile(inputFileName))
+    {
+        if(!data.Open(inputFileName, schema))
+        {
+            ERRORMSG(data.GetError());
+            return 1;
+        }
+    }
     else
-        str = str.substr(start, end - start + 1);
-    return str;
+    {
+        MappedFile mappedFile;
+        if(!mappedFile.Open(inputFileName))
+        {
+            ERRORMSG(mappedFile.GetError());
+            return 1;
+        }
+
+        // The writer columns are released before the image is loaded
+        ColumnFileImage image;
+        {
+            LineParser parser(schema);
+            Record obj(schema);
+            ColumnFileWriter writer;
+            mappedFile.ForEachLine([&](std::string_view line)
+            {
+                parser.Parse(line, obj);
+                writer.Append(obj);
+            });
+
+            if(!writer.Write(image))
+            {
+                ERRORMSG(writer.GetError());
+                return 1;
+            }
+        }
+        if(!data.Load(std::move(image), schema))
+        {
+            ERRORMSG(data.GetError());
+            return 1;
+        }
+    }
+
+    std::cout << "Loaded " << data.GetRowCount() << " rows (" << data.GetRowGroupCount() << " row groups) in "
+              << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
+
+    Server server(opts, schema, data);
+    size_t threads = (threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency()));
+    if(!server.Listen(socketPath))
+    {
+        ERRORMSG(server.GetError());
+        return 1;
+    }
+    std::cout << "Listening on '" << socketPath << "' with " << threads << " threads" << std::endl;
+
+    bool ok = server.Run(threads);
+    std::cout << "Served " << server.GetQueryCount() << " queries" << std::endl;
+    if(!ok)
+    {
+        ERRORMSG(server.GetError());
+        return 1;
+    }
+    return 0;
+}
+
+// Sends all queries to the server before reading the responses (pipelined),
+// and prints the responses
+int Connect(const char* socketPath, const std::vector<const char*>& queries)
+{
+    QueryClient client;
+    if(!client.Connect(socketPath))
+    {
+        ERRORMSG(client.GetError());
+        return 1;
+    }
+
+    for(const char* query : queries)
+    {
+        if(!client.Send(query))
+        {
+            ERRORMSG(client.GetError());
+            return 1;
+        }
+    }
+
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+        if(!client.Receive(std::cout))
+        {
+            ERRORMSG(client.GetError());
+            return 1;
+        }
+    }
+    return 0;
 }
 
 int main(int argc, const char** argv)
 {
     const char* inputFileName = "";
     const char* constraintsStr = "";
+    const char* dictFields = "";
+    const char* projectFields = "";
+    const char* groupByStr = "";
+    const char* aggStr = "";
+    const char* orderByStr = "";
+    const char* subscriptionsFileName = nullptr;
+    const char* convertFileName = nullptr;
+    const char* serveSocket = nullptr;
+    const char* connectSocket = nullptr;
+    bool indexMode = false;
+    bool followMode = false;
+    bool explainJson = false;
+    bool threadsGiven = false;
+    ScanOptions opts;
 
-    if(argc > 1)
+    // Parse options. Anything that is not an option is a positional argument.
+    std::vector<const char*> args;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--tree") == 0)
+        {
+            opts.evalMode = Constraints::EVAL_TREE;
+        }
+        else if(strcmp(argv[i], "--batch") == 0)
+        {
+            opts.batchMode = true;
+        }
+        else if(strcmp(argv[i], "--mmap") == 0)
+        {
+            opts.mmapMode = true;
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            opts.threads = atoi(argv[++i]);
+            if(opts.threads < 1)
+            {
+                ERRORMSG("Invalid number of threads '" << argv[i] << "'");
+                return 1;
+            }
+            opts.mmapMode = true;
+            threadsGiven = true;
+        }
+        else if(strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc)
+        {
+            int interval = atoi(argv[++i]);
+            if(interval < 1)
+            {
+                ERRORMSG("Invalid adaptive interval '" << argv[i] << "'");
+                return 1;
+            }
+            opts.adaptiveInterval = interval;
+        }
+        else if(strcmp(argv[i], "--no-optimize") == 0)
+        {
+            opts.optimize = false;
+        }
+        else if(strcmp(argv[i], "--explain") == 0 || strcmp(argv[i], "--explain-json") == 0)
+        {
+            opts.profile = true;
+            explainJson = (strcmp(argv[i], "--explain-json") == 0);
+        }
+        else if(strcmp(argv[i], "--dict") == 0 && i + 1 < argc)
+        {
+            dictFields = argv[++i];
+        }
+        else if(strcmp(argv[i], "--convert") == 0 && i + 1 < argc)
+        {
+            convertFileName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--count") == 0)
+        {
+            opts.countOnly = true;
+        }
+        else if(strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
+        {
+            int limit = atoi(argv[++i]);
+            if(limit < 1)
+            {
+                ERRORMSG("Invalid limit '" << argv[i] << "'");
+                return 1;
+            }
+            opts.limit = limit;
+        }
+        else if(strcmp(argv[i], "--fields") == 0 && i + 1 < argc)
+        {
+            projectFields = argv[++i];
+        }
+        else if(strcmp(argv[i], "--group-by") == 0 && i + 1 < argc)
+        {
+            groupByStr = argv[++i];
+        }
+        else if(strcmp(argv[i], "--agg") == 0 && i + 1 < argc)
+        {
+            aggStr = argv[++i];
+        }
+        else if(strcmp(argv[i], "--order-by") == 0 && i + 1 < argc)
+        {
+            orderByStr = argv[++i];
+        }
+        else if(strcmp(argv[i], "--index") == 0)
+        {
+            indexMode = true;
+        }
+        else if(strcmp(argv[i], "--subscribe") == 0 && i + 1 < argc)
+        {
+            subscriptionsFileName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--follow") == 0)
+        {
+            followMode = true;
+        }
+        else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            serveSocket = argv[++i];
+        }
+        else if(strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+        {
+            connectSocket = argv[++i];
+        }
+        else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+        {
+            Usage(argv[0]);
+            return 0;
+        }
+        else if(strncmp(argv[i], "--", 2) == 0)
+        {
+            ERRORMSG("Unknown option '" << argv[i] << "'");
+            Usage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+
+    // Client: all arguments are queries
+    if(connectSocket)
+        return Connect(connectSocket, args);
+
+    if(args.size() > 0)
     {
         // Read imput file
-        inputFileName = argv[1];
+        inputFileName = args[0];
         if(access(inputFileName, F_OK) != 0)
         {
             ERRORMSG("Failed to access '" << inputFileName << "': " <<  strerror(errno));
@@ -73,9 +592,12 @@ int main(int argc, const char** argv)
         inputFileName = "books.txt";
     }
 
-    if(argc > 2)
+    // Note: Only the index mode runs more than one query
+    std::vector<const char*> queries;
+    if(args.size() > 1)
     {
-        constraintsStr  = argv[2];
+        constraintsStr  = args[1];
+        queries.assign(args.begin() + 1, args.end());
     }
     else
     {
@@ -86,66 +608,226 @@ int main(int argc, const char** argv)
 //        constraintsStr = "Nationality IN (French, American, Russian)";
     }
 
-    // Build constraints from a string
-    Constraints constraints;
-    if(!constraints.Parse(constraintsStr))
+    // Calls func(name) for every name of the comma separated list
+    auto forEachName = [](std::string_view names, auto func)
+    {
+        while(!names.empty())
+        {
+            size_t end = std::min(names.find(','), names.size());
+            std::string_view name = LineParser::Trim(names.substr(0, end));
+            if(!name.empty())
+                func(name);
+            names.remove_prefix(std::min(end + 1, names.size()));
+        }
+    };
+
+    // Build constraints from a string and bind them to the schema
+    Schema schema;
+    if(strcmp(dictFields, "*") == 0)
+        schema.SetEncodeAll(true);
+    else
+        forEachName(dictFields, [&](std::string_view name) { schema.SetEncoded(schema.Bind(name)); });
+
+    // Projected fields are bound before the scanner copies the schema
+    forEachName(projectFields, [&](std::string_view name) { opts.fields.push_back(schema.Bind(name)); });
+
+    // Aggregation: the limit and the projection apply to the groups (or
+    // the top rows), not to the scan
+    AggregateSpec spec;
+    bool aggregateMode = (*groupByStr || *aggStr || *orderByStr);
+    if(aggregateMode)
+    {
+        if(!spec.Parse(groupByStr, aggStr, orderByStr, schema))
+        {
+            ERRORMSG(spec.GetError());
+            return 1;
+        }
+        if(!spec.IsGrouping() && opts.limit == 0)
+        {
+            ERRORMSG("--order-by of the matches requires --limit");
+            return 1;
+        }
+        if(indexMode || subscriptionsFileName || opts.countOnly)
+        {
+            ERRORMSG("Aggregation can't be combined with --index, --subscribe or --count");
+            return 1;
+        }
+        spec.limit = opts.limit;
+        spec.fields = opts.fields;
+        opts.limit = 0;
+    }
+
+    if(followMode && (aggregateMode || indexMode || subscriptionsFileName || convertFileName || opts.threads > 1))
+    {
+        ERRORMSG("--follow can't be combined with aggregation, --index, --subscribe, --convert or --threads");
+        return 1;
+    }
+
+    if(serveSocket && (aggregateMode || indexMode || subscriptionsFileName || convertFileName || followMode))
     {
-        ERRORMSG(constraints.GetError());
+        ERRORMSG("--serve can't be combined with aggregation, --index, --subscribe, --convert or --follow");
         return 1;
     }
-    constraints.Dump(std::cout);
+
+    if(serveSocket)
+        return Serve(inputFileName, serveSocket, schema, opts, (threadsGiven ? opts.threads : 0));
+
+    if(subscriptionsFileName)
+        return Subscribe(inputFileName, subscriptionsFileName, schema, opts);
+
+    if(convertFileName)
+        return Convert(inputFileName, convertFileName, schema);
+
+    // Columnar input: fields are bound before the scanner copies the schema
+    ColumnFile columnFile;
+    bool columnMode = ColumnFile::IsColumnFile(inputFileName);
+    if(columnMode && followMode)
+    {
+        ERRORMSG("--follow requires a text input file");
+        return 1;
+    }
+    if(columnMode && !columnFile.Open(inputFileName, schema))
+    {
+        ERRORMSG(columnFile.GetError());
+        return 1;
+    }
+
+    int ret = 0;
+    if(indexMode && QueryIndex(inputFileName, queries, schema, opts, ret))
+        return ret;
+
+    Scanner scanner(opts, schema);
+    if(!scanner.Init(constraintsStr))
+    {
+        ERRORMSG(scanner.GetError());
+        return 1;
+    }
+    scanner.GetConstraints().Dump(std::cout);
+    scanner.GetConstraints().DumpProgram(std::cout);
     std::cout << std::endl;
 
+    // Nothing to scan for
+    if(scanner.GetConstraints().IsAlwaysFalse())
+    {
+        std::cout << "Constraints are always false, skipping the scan" << std::endl;
+        if(aggregateMode)
+            Aggregator(spec).Dump(std::cout);
+        else
+            PrintSummary(0, opts, false);
+        return 0;
+    }
+
     // Open input file
-    std::ifstream in(inputFileName);
-    if(!in)
+    std::ifstream in;
+    MappedFile mappedFile;
+
+    if(columnMode || followMode)
     {
-        ERRORMSG("Cannot open input file '" << inputFileName << "'");
+        // Already mapped, or opened by Follow()
+    }
+    else if(opts.mmapMode ? !mappedFile.Open(inputFileName) : (in.open(inputFileName), !in))
+    {
+        if(opts.mmapMode)
+            ERRORMSG(mappedFile.GetError());
+        else
+            ERRORMSG("Cannot open input file '" << inputFileName << "'");
         return 1;
     }
 
-    // Go through input file and select lines that matches constraints
-    std::string line;
-    int matchCount = 0;
-
-    while(std::getline(in, line))
+    // Go through input file (in a single thread) and pass the lines that
+    // match constraints to the sink. Returns false if the sink was done
+    // before the end of the input.
+    auto scanInput = [&](auto& sink)
     {
-        std::stringstream ss(line) ;
-        std::string token;
-        Object obj;
+        if(columnMode)
+            return scanner.ProcessColumnFile(columnFile, sink);
 
-        // Construct object from a line
-        while(getline(ss, token, ','))
-        {
-            // Trim leading/trailing while spaces
-            TrimString(token);
+        // Stop reading once the sink has enough matches
+        auto processLine = [&](std::string_view line) { scanner.ProcessLine(line, sink); return !sink.IsDone(); };
 
-            // Spit token into name and value
-            size_t pos = token.find('=');
-            if(pos != std::string::npos)
+        bool scanned = true;
+        if(opts.mmapMode)
+        {
+            scanned = mappedFile.ForEachLine(processLine);
+        }
+        else
+        {
+            std::string line;
+            while(std::getline(in, line))
             {
-                std::string name = token.substr(0, pos);
-                std::string value = token.substr(pos + 1);
-                obj.SetValue(TrimString(name), TrimString(value));
+                if(!processLine(line))
+                {
+                    scanned = (in.peek() == std::ifstream::traits_type::eof());
+                    break;
+                }
             }
         }
+        scanner.Flush(sink);
+        return scanned;
+    };
+    bool parallel = (opts.threads > 1 && !columnMode);
 
-        // Evaluate object for constraints matching
-        bool result = false;
-        if(!constraints.Evaluate(obj, result))
+    if(followMode)
+    {
+        OutputBuffer out(std::cout);
+        OutputSink sink(out, opts);
+        if(!Follow(inputFileName, scanner, sink))
+            return 1;
+        PrintSummary(sink.matchCount, opts, sink.IsDone());
+    }
+    else if(aggregateMode)
+    {
+        Aggregator aggregator(spec);
+        if(!parallel)
         {
-            ERRORMSG(constraints.GetError());
+            scanInput(aggregator);
         }
-        else if(result)
+        else if(!AggregateParallel(mappedFile, scanner, constraintsStr, aggregator))
         {
-            matchCount++;
-            std::cout << matchCount << ": ";
-            obj.Dump(std::cout);
+            ERRORMSG("Parallel scan failed");
+            return 1;
         }
+
+        aggregator.Dump(std::cout);
+        if(aggregator.GetErrorCount() > 0)
+            ERRORMSG(aggregator.GetErrorCount() << " rows failed to evaluate, the first: " << aggregator.GetError());
     }
+    else
+    {
+        int matchCount = 0;
+        bool stopped = false;
+        OutputBuffer out(std::cout);
+        OutputSink sink(out, opts);
 
-    if(matchCount == 0)
-        std::cout << "No matches found" << std::endl;
+        if(!parallel)
+        {
+            stopped = !scanInput(sink) || sink.skipped;
+            matchCount = sink.matchCount;
+        }
+        else if(!ScanParallel(mappedFile, scanner, constraintsStr, std::cout, matchCount, stopped))
+        {
+            ERRORMSG("Parallel scan failed");
+            return 1;
+        }
+        out.Flush();
+        PrintSummary(matchCount, opts, stopped);
+    }
+
+    if(opts.adaptiveInterval > 0 && !parallel && !columnMode)
+    {
+        std::cout << std::endl << "Adapted program:" << std::endl;
+        scanner.GetConstraints().DumpProgram(std::cout);
+    }
+
+    // EXPLAIN ANALYZE
+    if(opts.profile)
+    {
+        std::cout << std::endl << "Profile:" << std::endl;
+        if(explainJson)
+            scanner.GetConstraints().DumpJson(std::cout);
+        else
+            scanner.GetConstraints().Dump(std::cout);
+    }
 
     return 0;
 }
@@ -0,0 +1,131 @@
+//
+// arena.h
+//
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <algorithm>        // std::max
+#include <memory>           // std::unique_ptr
+#include <new>              // placement new
+#include <string_view>
+#include <type_traits>      // std::is_trivially_destructible
+#include <utility>          // std::forward
+#include <vector>
+#include <string.h>         // memcpy
+#include <stddef.h>         // size_t, max_align_t
+
+//
+// Class Arena (bump allocator).
+// Objects and strings are allocated sequentially from a few contiguous
+// blocks and are all released at once by Reset() or by the destructor.
+// Destructors of non-trivially destructible objects are called on release
+// in the reverse order of construction.
+//
+class Arena
+{
+public:
+    Arena(size_t blockSizeIn = 4096) : blockSize(blockSizeIn) {}
+    ~Arena() { Reset(); }
+
+    void* Allocate(size_t size, size_t align = alignof(max_align_t))
+    {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if(!blocks.empty() && offset + size <= blocks.back().size)
+        {
+            used = offset + size;
+            return blocks.back().data.get() + offset;
+        }
+
+        AddBlock(size + align);
+        offset = (used + align - 1) & ~(align - 1);
+        used = offset + size;
+        return blocks.back().data.get() + offset;
+    }
+
+    // Constructs object in the arena
+    template<class T, class... ARGS>
+    T* New(ARGS&&... args)
+    {
+        void* ptr = Allocate(sizeof(T), alignof(T));
+        T* obj = new(ptr) T(std::forward<ARGS>(args)...);
+
+        if constexpr(!std::is_trivially_destructible<T>::value)
+        {
+            Destructor* dtor = (Destructor*)Allocate(sizeof(Destructor), alignof(Destructor));
+            dtor->obj = obj;
+            dtor->destroy = [](void* p) { ((T*)p)->~T(); };
+            dtor->next = destructors;
+            destructors = dtor;
+        }
+
+        return obj;
+    }
+
+    // Copies string into the arena
+    std::string_view CopyString(std::string_view str)
+    {
+        if(str.empty())
+            return std::string_view();
+        char* ptr = (char*)Allocate(str.size(), 1);
+        memcpy(ptr, str.data(), str.size());
+        return std::string_view(ptr, str.size());
+    }
+
+    // Destroys all objects and releases all memory except for the
+    // last (largest) block, which is kept for the next use
+    void Reset()
+    {
+        for(Destructor* dtor = destructors; dtor; dtor = dtor->next)
+            dtor->destroy(dtor->obj);
+        destructors = nullptr;
+
+        if(blocks.size() > 1)
+            blocks.erase(blocks.begin(), blocks.end() - 1);
+        used = 0;
+    }
+
+    // Diagnostic
+    size_t GetBlockCount() const { return blocks.size(); }
+    size_t GetCapacity() const
+    {
+        size_t capacity = 0;
+        for(const Block& block : blocks)
+            capacity += block.size;
+        return capacity;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    struct Destructor
+    {
+        void* obj;
+        void (*destroy)(void*);
+        Destructor* next;
+    };
+
+    void AddBlock(size_t minSize)
+    {
+        // Grow block size geometrically, so there are only a few blocks
+        if(!blocks.empty())
+            blockSize = blocks.back().size * 2;
+        size_t size = std::max(blockSize, minSize);
+        blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+        used = 0;
+    }
+
+    std::vector<Block> blocks;
+    size_t blockSize{0};
+    size_t used{0};     // Used bytes of the last block
+    Destructor* destructors{nullptr};
+
+    // Omit implementation of the copy constructor and assignment operator
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
+
+#endif // __ARENA_H__
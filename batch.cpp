@@ -0,0 +1,423 @@
+//
+// batch.cpp
+//
+#include <string.h>         // memset
+#include <cmath>            // std::ceil, std::floor
+#include "batch.h"
+#include "constraints.h"
+
+//
+// ColumnBatchBuilder
+//
+void ColumnBatchBuilder::Clear()
+{
+    // Keep the allocated buffers for the next block
+    for(ColumnData& col : columns)
+    {
+        col.type = ColumnData::UNKNOWN;
+        col.data.clear();
+        col.dict.Clear();
+        col.schemaCodes.clear();
+    }
+    rowCount = 0;
+}
+
+void ColumnBatchBuilder::Append(const Record& rec)
+{
+    if(columns.size() < schema->GetSize())
+        columns.resize(schema->GetSize());
+
+    for(FieldId id = 0; id < columns.size(); id++)
+    {
+        ColumnData& col = columns[id];
+        if(col.type == ColumnData::INVALID)
+            continue;
+
+        // Every row must have a value of the same type. Numbers are only
+        // batched as int32 (other ones are evaluated row by row).
+        const Value* value = rec.GetValue(id);
+        ColumnData::Type type = (!value ? ColumnData::INVALID :
+                                 value->IsString() ? ColumnData::STRING :
+                                 value->IsInt() && value->GetInt() == (int32_t)value->GetInt() ? ColumnData::INT :
+                                 ColumnData::INVALID);
+
+        if(col.data.size() != rowCount || type == ColumnData::INVALID ||
+           (col.type != ColumnData::UNKNOWN && col.type != type))
+        {
+            col.type = ColumnData::INVALID;
+            continue;
+        }
+
+        col.type = type;
+
+        if(type == ColumnData::INT)
+        {
+            col.data.push_back((int32_t)value->GetInt());
+        }
+        else if(value->IsInterned())
+        {
+            // Map the schema dictionary code without hashing the string
+            Dictionary::Code code = value->GetInterned().code;
+            if(code >= col.schemaCodes.size())
+                col.schemaCodes.resize(code + 1, -1);
+            if(col.schemaCodes[code] < 0)
+                col.schemaCodes[code] = (int32_t)col.dict.Intern(value->GetString());
+            col.data.push_back(col.schemaCodes[code]);
+        }
+        else
+        {
+            col.data.push_back((int32_t)col.dict.Intern(value->GetString()));
+        }
+    }
+
+    rowCount++;
+}
+
+void ColumnBatchBuilder::Build(ColumnBatch& batch)
+{
+    batch.Clear();
+    batch.SetRowCount(rowCount);
+
+    for(FieldId id = 0; id < columns.size(); id++)
+    {
+        ColumnData& col = columns[id];
+        if(col.data.size() != rowCount)
+            continue; // Invalid or incomplete column
+
+        if(col.type == ColumnData::INT)
+        {
+            batch.SetIntColumn(id, col.data.data());
+        }
+        else if(col.type == ColumnData::STRING)
+        {
+            // Make the codes order-preserving. The dictionary of a low
+            // cardinality column is small, so this is cheap per block.
+            if(!col.dict.IsSorted())
+            {
+                col.dict.Sort(&col.remap);
+                for(int32_t& code : col.data)
+                    code = (int32_t)col.remap[code];
+            }
+            batch.SetStringColumn(id, col.data.data(), &col.dict);
+        }
+    }
+}
+
+//
+// Constraints batch evaluation
+//
+namespace
+{
+
+// Gets the int32 operand that compares with the int32 values of a column
+// as the number operand does: an integral one, or a fraction rounded to
+// the side that keeps the result (x < 2.5 is x < 3, x <= 2.5 is x <= 2).
+// Returns false if the compare has the same result for all int32 values
+// (a string, a number out of the range, or == and != with a fraction).
+bool GetInt32Operand(simd::CompareOp cmp, const Value& operand, int32_t& num)
+{
+    if(!operand.IsNumber())
+        return false;
+
+    double rounded = operand.GetNumber();
+    if(operand.IsDouble())
+    {
+        if(cmp == simd::CMP_LT || cmp == simd::CMP_GE)
+            rounded = std::ceil(rounded);
+        else if(cmp == simd::CMP_LE || cmp == simd::CMP_GT)
+            rounded = std::floor(rounded);
+        else if(rounded != std::floor(rounded))
+            return false;
+    }
+
+    if(!(rounded >= INT32_MIN && rounded <= INT32_MAX))
+        return false;
+    num = (int32_t)rounded;
+    return true;
+}
+
+} // namespace
+
+bool Constraints::EvaluateBatch(const ColumnBatch& batch, Selection& selection, Context& ctx) const
+{
+    if(!constraintsTree)
+    {
+        ctx.err = "Invalid (null) root logical node";
+        return false;
+    }
+    if(!schema)
+    {
+        ctx.err = "Constraints are not bound to a schema";
+        return false;
+    }
+
+    if(profile && ctx.profile.size() < nodeCount)
+        ctx.profile.resize(nodeCount);
+    selection.Resize(batch.GetRowCount());
+    return EvaluateBatchImpl(*constraintsTree, batch, selection.GetMask(), 0, ctx);
+}
+
+bool Constraints::EvaluateBatch(const ColumnBatch& batch, Selection& selection)
+{
+    if(!EvaluateBatch(batch, selection, context))
+    {
+        err = context.err;
+        return false;
+    }
+
+    // Adaptive mode: reorder between batches only
+    adaptiveRows += batch.GetRowCount();
+    if(adaptive && adaptiveRows >= adaptiveInterval)
+        Reorder();
+    return true;
+}
+
+bool Constraints::EvaluateBatchImpl(const Node& node, const ColumnBatch& batch, uint64_t* mask, size_t level, Context& ctx) const
+{
+    // Note: The profiling overhead is once per node and batch
+    uint64_t start = (profile ? GetCycles() : 0);
+    Node::Type type = node.GetType();
+
+    if(type == Node::GROUP)
+    {
+        const Group& group = (const Group&)node;
+        Node::Operator logicalOperator = group.GetOperator();
+        size_t rowCount = batch.GetRowCount();
+        size_t words = simd::MaskWords(rowCount);
+
+        NodeList children = group.GetChildren();
+        if(children.empty())
+        {
+            ctx.err = "Badly formed logical expression";
+            return false;
+        }
+
+        if(logicalOperator != Node::AND && logicalOperator != Node::OR)
+        {
+            ctx.err = "Invalid group operand " +  GetOperatorStr(logicalOperator) + " in batch evaluation.";
+            return false;
+        }
+
+        for(size_t i = 0; i < children.size(); i++)
+        {
+            if(!children[i])
+            {
+                ctx.err = "Badly formed logical expression";
+                return false;
+            }
+
+            // The first child goes straight into the result mask
+            if(i == 0)
+            {
+                if(!EvaluateBatchImpl(*children[i], batch, mask, level + 1, ctx))
+                    return false;
+                continue;
+            }
+
+            // Short circuit AND if no row passed,
+            // short circuit OR if every row passed.
+            if((logicalOperator == Node::AND && simd::IsEmpty(mask, words)) ||
+               (logicalOperator == Node::OR && simd::Count(mask, words) == rowCount))
+            {
+                if(profile)
+                    ProfileBatch(node, mask, rowCount, start, true, ctx);
+                return true;
+            }
+
+            // Other children go into the scratch mask of this level.
+            // Note: Deeper levels may grow batchMasks, which moves the level
+            // vectors but not their buffers, so keep the buffer pointer only.
+            if(ctx.batchMasks.size() <= level)
+                ctx.batchMasks.resize(level + 1);
+            ctx.batchMasks[level].resize(words);
+            uint64_t* rMask = ctx.batchMasks[level].data();
+
+            if(!EvaluateBatchImpl(*children[i], batch, rMask, level + 1, ctx))
+                return false;
+
+            if(logicalOperator == Node::AND)
+                simd::And(mask, rMask, words);
+            else
+                simd::Or(mask, rMask, words);
+        }
+    }
+    else if(type == Node::ELEMENT || type == Node::ELEMENT_IN || type == Node::ELEMENT_RANGE)
+    {
+        bool res = (type == Node::ELEMENT    ? EvaluateBatchElement((const Element&)node, batch, mask, ctx) :
+                    type == Node::ELEMENT_IN ? EvaluateBatchElementIN((const ElementIN&)node, batch, mask, ctx) :
+                                               EvaluateBatchElementRange((const ElementRange&)node, batch, mask, ctx));
+        if(!res)
+            return false;
+        if(adaptive)
+        {
+            size_t rowCount = batch.GetRowCount();
+            node.AddStats(rowCount, simd::Count(mask, simd::MaskWords(rowCount)));
+        }
+    }
+    else if(type == Node::CONSTANT)
+    {
+        simd::Fill(mask, batch.GetRowCount(), ((const Constant&)node).GetValue());
+    }
+    else
+    {
+        ctx.err = "Invalid logical node type " + std::to_string(type) + " in batch evaluation.";
+        return false;
+    }
+
+    if(profile)
+        ProfileBatch(node, mask, batch.GetRowCount(), start, false, ctx);
+    return true;
+}
+
+// Records the batch rows evaluated and passed by the node
+void Constraints::ProfileBatch(const Node& node, const uint64_t* mask, size_t rowCount, uint64_t start, bool shortCircuit, Context& ctx) const
+{
+    ctx.profile[node.GetId()].Add(rowCount, simd::Count(mask, simd::MaskWords(rowCount)), shortCircuit, GetCycles() - start);
+}
+
+bool Constraints::EvaluateBatchElement(const Element& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const
+{
+    Node::Operator logicalOperator = element.GetOperator();
+
+    const Column* col = batch.GetColumn(element.GetFieldId());
+    if(!col)
+    {
+        ctx.err = "Evaluated batch doesn't have a column for a name '" + std::string(element.GetName()) + "'";
+        return false;
+    }
+
+    if(logicalOperator < Node::EQ || logicalOperator > Node::GE)
+    {
+        ctx.err = "Invalid element operand " + GetOperatorStr(logicalOperator) + " in batch evaluation.";
+        return false;
+    }
+
+    EvaluateBatchCompare(*col, logicalOperator, element.GetValue(), batch.GetRowCount(), mask);
+    return true;
+}
+
+bool Constraints::EvaluateBatchElementRange(const ElementRange& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const
+{
+    size_t rowCount = batch.GetRowCount();
+
+    const Column* col = batch.GetColumn(element.GetFieldId());
+    if(!col)
+    {
+        ctx.err = "Evaluated batch doesn't have a column for a name '" + std::string(element.GetName()) + "'";
+        return false;
+    }
+
+    // Lower bound into the result mask, and upper bound into the scratch one
+    const ValueRange& range = element.GetRange();
+    size_t words = simd::MaskWords(rowCount);
+    ctx.batchRange.resize(words);
+
+    EvaluateBatchCompare(*col, range.loInclusive ? Node::GE : Node::GT, range.lo, rowCount, mask);
+    EvaluateBatchCompare(*col, range.hiInclusive ? Node::LE : Node::LT, range.hi, rowCount, ctx.batchRange.data());
+    simd::And(mask, ctx.batchRange.data(), words);
+    return true;
+}
+
+void Constraints::EvaluateBatchCompare(const Column& col, Node::Operator logicalOperator,
+        const Value& operand, size_t rowCount, uint64_t* mask)
+{
+    simd::CompareOp cmp = (logicalOperator == Node::EQ ? simd::CMP_EQ :
+                           logicalOperator == Node::NE ? simd::CMP_NE :
+                           logicalOperator == Node::LT ? simd::CMP_LT :
+                           logicalOperator == Node::LE ? simd::CMP_LE :
+                           logicalOperator == Node::GT ? simd::CMP_GT : simd::CMP_GE);
+
+    // Same semantics as the row evaluation (Value comparison)
+    auto compare = [cmp](const Value& a, const Value& b)
+    {
+        switch(cmp)
+        {
+            case simd::CMP_EQ: return a == b;
+            case simd::CMP_NE: return a != b;
+            case simd::CMP_LT: return a <  b;
+            case simd::CMP_LE: return a <= b;
+            case simd::CMP_GT: return a >  b;
+            default:           return a >= b;
+        }
+    };
+
+    if(!col.IsString())
+    {
+        int32_t num = 0;
+        if(GetInt32Operand(cmp, operand, num))
+        {
+            // Vectorized int compare
+            simd::CompareInt32(cmp, col.data, rowCount, num, mask);
+        }
+        else
+        {
+            // Compare with a string, or with a number out of the int32
+            // range, has the same result for every row
+            simd::Fill(mask, rowCount, compare(Value(0), operand));
+        }
+        return;
+    }
+
+    if(operand.IsNumber())
+    {
+        // String vs. int compare has the same result for every row
+        simd::Fill(mask, rowCount, compare(Value(std::string()), operand));
+        return;
+    }
+
+    const Dictionary& dict = *col.dict;
+    const std::string& str = operand.GetString();
+
+    if(cmp == simd::CMP_EQ || cmp == simd::CMP_NE)
+    {
+        // Equality on a string column is an equality on the string code
+        Dictionary::Code code = dict.Find(str);
+        if(code == Dictionary::INVALID_CODE)
+            simd::Fill(mask, rowCount, cmp == simd::CMP_NE);
+        else
+            simd::CompareInt32(cmp, col.data, rowCount, (int32_t)code, mask);
+        return;
+    }
+
+    // The column codes are order-preserving, so a range of strings
+    // is a range of codes: a < str is code < LowerBound(str), etc.
+    switch(cmp)
+    {
+        case simd::CMP_LT: simd::CompareInt32(simd::CMP_LT, col.data, rowCount, (int32_t)dict.LowerBound(str), mask); break;
+        case simd::CMP_LE: simd::CompareInt32(simd::CMP_LT, col.data, rowCount, (int32_t)dict.UpperBound(str), mask); break;
+        case simd::CMP_GT: simd::CompareInt32(simd::CMP_GE, col.data, rowCount, (int32_t)dict.UpperBound(str), mask); break;
+        default:           simd::CompareInt32(simd::CMP_GE, col.data, rowCount, (int32_t)dict.LowerBound(str), mask); break;
+    }
+}
+
+bool Constraints::EvaluateBatchElementIN(const ElementIN& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const
+{
+    size_t rowCount = batch.GetRowCount();
+
+    const Column* col = batch.GetColumn(element.GetFieldId());
+    if(!col)
+    {
+        ctx.err = "Evaluated batch doesn't have a column for a name '" + std::string(element.GetName()) + "'";
+        return false;
+    }
+
+    const ValueSet& values = element.GetValues();
+    bool negated = element.IsNegated();
+
+    if(!col->IsString())
+    {
+        memset(mask, 0, simd::MaskWords(rowCount) * sizeof(uint64_t));
+        for(size_t i = 0; i < rowCount; i++)
+            mask[i / 64] |= (uint64_t)(values.ContainsInt(col->data[i]) != negated) << (i % 64);
+        return true;
+    }
+
+    // Test membership once per dictionary entry, then gather per row
+    const Dictionary& dict = *col->dict;
+    ctx.batchLookup.resize(dict.GetSize());
+    for(Dictionary::Code i = 0; i < dict.GetSize(); i++)
+        ctx.batchLookup[i] = (values.ContainsString(dict.GetString(i)) != negated);
+
+    simd::Gather(col->data, rowCount, ctx.batchLookup.data(), mask);
+    return true;
+}
@@ -0,0 +1,155 @@
+//
+// batch.h
+//
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>         // int32_t, uint64_t
+#include "record.h"
+#include "simd.h"
+
+//
+// Column of a block of rows: one contiguous int32 value per row.
+// For a string column the values are codes of the column dictionary.
+// The column dictionary is sorted, so the codes are order-preserving
+// and a string range predicate is a range of codes.
+//
+struct Column
+{
+    const int32_t* data{nullptr};
+    const Dictionary* dict{nullptr}; // nullptr for int column
+
+    bool IsString() const { return dict != nullptr; }
+};
+
+//
+// Class ColumnBatch.
+// Block of rows in columnar form, one Column per FieldId of the Schema.
+// ColumnBatch doesn't own the column data.
+//
+class ColumnBatch
+{
+public:
+    ColumnBatch() = default;
+    ~ColumnBatch() = default;
+
+    void SetRowCount(size_t count) { rowCount = count; }
+    size_t GetRowCount() const { return rowCount; }
+
+    void SetIntColumn(FieldId id, const int32_t* data)
+    {
+        Column& col = GetOrAddColumn(id);
+        col.data = data;
+        col.dict = nullptr;
+    }
+
+    void SetStringColumn(FieldId id, const int32_t* codes, const Dictionary* dict)
+    {
+        Column& col = GetOrAddColumn(id);
+        col.data = codes;
+        col.dict = dict;
+    }
+
+    // Returns nullptr if the batch has no column for the field
+    const Column* GetColumn(FieldId id) const
+    {
+        return (id < columns.size() && columns[id].data ? &columns[id] : nullptr);
+    }
+
+    void Clear() { columns.clear(); rowCount = 0; }
+
+private:
+    Column& GetOrAddColumn(FieldId id)
+    {
+        if(id >= columns.size())
+            columns.resize(id + 1);
+        return columns[id];
+    }
+
+    std::vector<Column> columns;
+    size_t rowCount{0};
+};
+
+//
+// Class Selection.
+// Result of a batch evaluation: bitmask with one bit per row.
+//
+class Selection
+{
+public:
+    Selection() = default;
+    ~Selection() = default;
+
+    void Resize(size_t count) { rowCount = count; mask.resize(simd::MaskWords(count)); }
+    size_t GetRowCount() const { return rowCount; }
+
+    uint64_t* GetMask() { return mask.data(); }
+    const uint64_t* GetMask() const { return mask.data(); }
+    size_t GetWords() const { return mask.size(); }
+
+    bool IsSelected(size_t row) const { return (mask[row / 64] >> (row % 64)) & 1; }
+    size_t Count() const { return simd::Count(mask.data(), mask.size()); }
+
+    // Calls func(row) for every selected row in ascending order
+    template<class FUNC>
+    void ForEach(FUNC func) const
+    {
+        for(size_t w = 0; w < mask.size(); w++)
+        {
+            for(uint64_t word = mask[w]; word; word &= word - 1)
+                func(w * 64 + __builtin_ctzll(word));
+        }
+    }
+
+    // Converts the bitmask into a selection vector of row indexes
+    void GetRows(std::vector<uint32_t>& rows) const
+    {
+        rows.clear();
+        ForEach([&](size_t row) { rows.push_back((uint32_t)row); });
+    }
+
+private:
+    std::vector<uint64_t> mask;
+    size_t rowCount{0};
+};
+
+//
+// Class ColumnBatchBuilder.
+// Converts a block of Records into columns. A field can only be given
+// a column if every row of the block has a value of the same type for it;
+// fields with missing or mixed type values are left out of the batch.
+//
+class ColumnBatchBuilder
+{
+public:
+    ColumnBatchBuilder(const Schema& schemaIn) : schema(&schemaIn) {}
+    ~ColumnBatchBuilder() = default;
+
+    void Clear();
+    void Append(const Record& rec);
+    size_t GetRowCount() const { return rowCount; }
+
+    // Sets batch columns to point to the builder data.
+    // Note: Sorts the column dictionaries (and remaps the codes).
+    void Build(ColumnBatch& batch);
+
+private:
+    struct ColumnData
+    {
+        enum Type : char { UNKNOWN=0, INT, STRING, INVALID };
+
+        Type type{UNKNOWN};
+        std::vector<int32_t> data;
+        Dictionary dict;
+        std::vector<int32_t> schemaCodes;       // Schema dictionary code -> column code
+        std::vector<Dictionary::Code> remap;    // Sort() scratch
+    };
+
+    const Schema* schema{nullptr};
+    std::vector<ColumnData> columns;
+    size_t rowCount{0};
+};
+
+#endif // __BATCH_H__
@@ -0,0 +1,480 @@
+//
+// bench.cpp
+//
+// Benchmarks constraints parsing, evaluation, ingest and end-to-end scans
+// over generated books.txt shaped data (see DataGenerator). Results are
+// printed as a table and, with --output, written as JSON lines (one object
+// per measurement) to compare runs and catch regressions.
+//
+#include <iostream>         // std::cout
+#include <iomanip>          // std::setw
+#include <fstream>          // std::ifstream, std::ofstream
+#include <algorithm>        // std::max, std::min
+#include <chrono>
+#include <memory>           // std::unique_ptr
+#include <string>
+#include <vector>
+#include <stdio.h>          // remove()
+#include <stdlib.h>         // atoi(), atof()
+#include <string.h>         // strcmp()
+#include <unistd.h>         // getpid()
+#include "datagen.h"
+#include "scanner.h"
+#include "staticconstraints.h"
+#include "logger.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+    // Evaluates the rows with static constraints, returns the match count
+    using StaticCount = size_t (*)(Schema& schema, const std::vector<Record>& records, size_t& errors);
+
+    struct BenchQuery
+    {
+        std::string name;
+        std::string constraints;
+        StaticCount countStatic{nullptr};   // Same constraints compiled at build time
+    };
+
+    template<class STATIC>
+    size_t CountStatic(STATIC constraints, Schema& schema, const std::vector<Record>& records, size_t& errors)
+    {
+        constraints.Bind(schema);
+
+        size_t matches = 0;
+        std::string err;
+        for(const Record& rec : records)
+        {
+            bool result = false;
+            if(!constraints.Evaluate(rec, result, err))
+                errors++;
+            else if(result)
+                matches++;
+        }
+        return matches;
+    }
+
+// Note: The literal must be the same as the generated constraints
+#define STATIC_COUNT(constraintsStr)                                            \
+    [](Schema& schema, const std::vector<Record>& records, size_t& errors)      \
+        { return CountStatic(STATIC_CONSTRAINTS(constraintsStr), schema, records, errors); }
+
+    // Counts the matches
+    struct CountSink
+    {
+        size_t matchCount{0};
+        size_t errorCount{0};
+
+        void OnMatch(const Record&) { matchCount++; }
+        void OnError(const std::string&) { errorCount++; }
+        bool IsDone() const { return false; }
+    };
+
+    // Returns the best (lowest) time in seconds of repeat runs of func
+    template<class FUNC>
+    double Measure(int repeat, FUNC func)
+    {
+        double best = 0;
+        for(int i = 0; i < repeat; i++)
+        {
+            Clock::time_point start = Clock::now();
+            func();
+            double time = std::chrono::duration<double>(Clock::now() - start).count();
+            if(i == 0 || time < best)
+                best = time;
+        }
+        return best;
+    }
+
+    // "Field IN (value first, ..., value first + count - 1)"
+    std::string GetInList(std::string_view fieldName, size_t first, size_t count, bool isInt)
+    {
+        std::string str = std::string(fieldName) + " IN (";
+        for(size_t k = first; k < first + count; k++)
+        {
+            if(k > first)
+                str += ", ";
+            str += (isInt ? std::to_string(k * 7) : DataGenerator::GetString(fieldName, k));
+        }
+        return str + ")";
+    }
+
+    // Representative constraints: AND/OR of growing width and depth,
+    // IN lists of growing size and range predicates
+    std::vector<BenchQuery> GetQueries()
+    {
+        auto str = [](const char* fieldName, size_t k) { return DataGenerator::GetString(fieldName, k); };
+        std::string lang0 = "Language == " + str("Language", 1);
+        std::string lang1 = "Language == " + str("Language", 2);
+
+        return {
+            {"eq",        lang0, STATIC_COUNT("Language == French")},
+            {"and2",      lang0 + " AND BookNumber > 500"},
+            {"and4",      lang0 + " AND Genre != " + str("Genre", 1) + " AND BookNumber > 100 AND Nationality != " + str("Nationality", 0),
+                          STATIC_COUNT("Language == French AND Genre != Poetry AND BookNumber > 100 AND Nationality != British")},
+            {"or4",       lang0 + " OR " + lang1 + " OR Genre == " + str("Genre", 0) + " OR Nationality == " + str("Nationality", 3)},
+            {"and_or",    "(" + lang0 + " OR " + lang1 + ") AND (Genre == " + str("Genre", 0) + " OR Genre == " + str("Genre", 6) + ") AND BookNumber < 800",
+                          STATIC_COUNT("(Language == French OR Language == Spanish) AND (Genre == Novel OR Genre == Drama) AND BookNumber < 800")},
+            {"or_and",    "(" + lang0 + " AND BookNumber < 100) OR (Genre == " + str("Genre", 0) + " AND BookNumber > 900)"},
+            {"nested",    "((" + lang0 + " OR " + lang1 + ") AND (Genre == " + str("Genre", 0) + " OR BookNumber < 100)) OR (NOT (" +
+                          lang0 + " OR Genre == " + str("Genre", 1) + ") AND BookNumber > 900)"},
+            {"not_in",    "Nationality NOT IN (" + str("Nationality", 0) + ", " + str("Nationality", 1) + ") AND BookNumber > 500"},
+            {"in4",       GetInList("Language", 0, 4, false), STATIC_COUNT("Language IN (English, French, Spanish, Russian)")},
+            {"in16",      GetInList("Nationality", 8, 16, false)},
+            {"in64",      GetInList("BookNumber", 0, 64, true)},
+            {"range_int", "BookNumber >= 250 AND BookNumber < 750", STATIC_COUNT("BookNumber >= 250 AND BookNumber < 750")},
+            {"range_str", "Genre >= " + str("Genre", 3) + " AND Genre < " + str("Genre", 1)},
+        };
+    }
+
+    //
+    // Prints the results as a table and writes them as JSON lines
+    //
+    class Reporter
+    {
+    public:
+        Reporter(std::ostream* jsonIn) : json(jsonIn) {}
+
+        void Add(const char* bench, const std::string& query, const char* mode,
+                 double value, const char* unit, size_t matches)
+        {
+            std::cout << std::left << std::setw(8) << bench << std::setw(12) << query << std::setw(10) << mode
+                      << std::right << std::setw(14) << std::fixed << std::setprecision(2) << value
+                      << " " << std::left << std::setw(10) << unit;
+            if(matches != NO_MATCHES)
+                std::cout << " matches=" << matches;
+            std::cout << std::endl;
+
+            if(json)
+            {
+                *json << "{\"bench\":\"" << bench << "\",\"query\":\"" << query << "\",\"mode\":\"" << mode
+                      << "\",\"value\":" << std::fixed << std::setprecision(3) << value << ",\"unit\":\"" << unit << "\"";
+                if(matches != NO_MATCHES)
+                    *json << ",\"matches\":" << matches;
+                *json << "}" << std::endl;
+            }
+        }
+
+        static constexpr size_t NO_MATCHES = (size_t)-1;
+
+    private:
+        std::ostream* json{nullptr};
+    };
+}
+
+void Usage(const char* app)
+{
+    std::cout << "Usage: " << app << " [options]" << std::endl
+              << "Options:" << std::endl
+              << "  --rows N         Number of generated rows (default 200000)" << std::endl
+              << "  --fields N       Number of fields of a row, at least 5 (default 5)" << std::endl
+              << "  --cardinality N  Distinct values of the low cardinality string fields (default 16)" << std::endl
+              << "  --skew S         Zipf exponent of the value distribution, 0 for uniform (default 0)" << std::endl
+              << "  --seed N         Random generator seed (default 1)" << std::endl
+              << "  --repeat N       Report the best of N runs of every measurement (default 3)" << std::endl
+              << "  --threads N      Number of threads of the parallel scan (default 4)" << std::endl
+              << "  --query NAME     Run only the queries whose name contains NAME" << std::endl
+              << "  --output FILE    Write the results to FILE as JSON lines" << std::endl
+              << "  --generate FILE  Write the generated data to FILE and exit" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    DataGenOptions genOpts;
+    int repeat = 3;
+    int threads = 4;
+    const char* queryFilter = "";
+    const char* outputFileName = nullptr;
+    const char* generateFileName = nullptr;
+
+    for(int i = 1; i < argc; i++)
+    {
+        bool hasArg = (i + 1 < argc);
+        if(strcmp(argv[i], "--rows") == 0 && hasArg)
+            genOpts.rows = std::max(atoi(argv[++i]), 0);
+        else if(strcmp(argv[i], "--fields") == 0 && hasArg)
+            genOpts.fields = std::max(atoi(argv[++i]), 0);
+        else if(strcmp(argv[i], "--cardinality") == 0 && hasArg)
+            genOpts.cardinality = std::max(atoi(argv[++i]), 0);
+        else if(strcmp(argv[i], "--skew") == 0 && hasArg)
+            genOpts.skew = atof(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0 && hasArg)
+            genOpts.seed = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--repeat") == 0 && hasArg)
+            repeat = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--threads") == 0 && hasArg)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--query") == 0 && hasArg)
+            queryFilter = argv[++i];
+        else if(strcmp(argv[i], "--output") == 0 && hasArg)
+            outputFileName = argv[++i];
+        else if(strcmp(argv[i], "--generate") == 0 && hasArg)
+            generateFileName = argv[++i];
+        else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+        {
+            Usage(argv[0]);
+            return 0;
+        }
+        else
+        {
+            ERRORMSG("Unknown option '" << argv[i] << "'");
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Note: The benchmark constraints use all the books.txt fields
+    if(genOpts.rows < 1 || genOpts.fields < 5 || genOpts.cardinality < 1 || genOpts.skew < 0 || repeat < 1 || threads < 1)
+    {
+        ERRORMSG("Invalid options");
+        Usage(argv[0]);
+        return 1;
+    }
+
+    DataGenerator generator(genOpts);
+    if(generateFileName)
+    {
+        if(!generator.Write(generateFileName))
+        {
+            ERRORMSG(generator.GetError());
+            return 1;
+        }
+        return 0;
+    }
+
+    std::ofstream json;
+    if(outputFileName)
+    {
+        json.open(outputFileName, std::ios::trunc);
+        if(!json)
+        {
+            ERRORMSG("Cannot create file '" << outputFileName << "'");
+            return 1;
+        }
+    }
+    Reporter reporter(outputFileName ? &json : nullptr);
+
+    // Data file for the ingest and end-to-end scans
+    std::string dataFileName = "/tmp/bench_data_" + std::to_string(getpid()) + ".txt";
+    if(!generator.Write(dataFileName.c_str()))
+    {
+        ERRORMSG(generator.GetError());
+        return 1;
+    }
+
+    MappedFile mappedFile;
+    if(!mappedFile.Open(dataFileName.c_str()))
+    {
+        ERRORMSG(mappedFile.GetError());
+        remove(dataFileName.c_str());
+        return 1;
+    }
+
+    const double rows = (double)genOpts.rows;
+    const double megabytes = (double)mappedFile.GetSize() / (1024 * 1024);
+    std::cout << "Data: " << genOpts.rows << " rows, " << genOpts.fields << " fields, "
+              << mappedFile.GetSize() / 1024 << " KB, cardinality " << genOpts.cardinality
+              << ", skew " << genOpts.skew << ", seed " << genOpts.seed << std::endl << std::endl;
+
+    // Parameters of the run, so results of different data aren't compared
+    if(outputFileName)
+    {
+        json << "{\"bench\":\"data\",\"rows\":" << genOpts.rows << ",\"fields\":" << genOpts.fields
+             << ",\"cardinality\":" << genOpts.cardinality << ",\"skew\":" << genOpts.skew
+             << ",\"seed\":" << genOpts.seed << ",\"bytes\":" << mappedFile.GetSize() << "}" << std::endl;
+    }
+
+    //
+    // Ingest: text lines into Records
+    //
+    Schema schema;
+    {
+        Record obj(schema);
+        double time = Measure(repeat, [&]()
+        {
+            std::ifstream in(dataFileName);
+            std::string line;
+            while(std::getline(in, line))
+                ParseLine(line, schema, obj);
+        });
+        reporter.Add("ingest", "-", "stream", megabytes / time, "MB/s", Reporter::NO_MATCHES);
+
+        LineParser parser(schema);
+        time = Measure(repeat, [&]()
+        {
+            mappedFile.ForEachLine([&](std::string_view line) { parser.Parse(line, obj); });
+        });
+        reporter.Add("ingest", "-", "mmap", megabytes / time, "MB/s", Reporter::NO_MATCHES);
+    }
+
+    // All rows in memory for the evaluation benchmarks, row by row
+    // and in columnar blocks
+    const size_t BLOCK_SIZE = 4096;
+    std::vector<Record> records(genOpts.rows, Record(schema));
+    std::vector<std::unique_ptr<ColumnBatchBuilder>> builders;
+    std::vector<ColumnBatch> batches;
+    {
+        LineParser parser(schema);
+        size_t row = 0;
+        mappedFile.ForEachLine([&](std::string_view line) { parser.Parse(line, records[row++]); });
+
+        for(size_t begin = 0; begin < records.size(); begin += BLOCK_SIZE)
+        {
+            builders.push_back(std::make_unique<ColumnBatchBuilder>(schema));
+            for(size_t i = begin; i < std::min(begin + BLOCK_SIZE, records.size()); i++)
+                builders.back()->Append(records[i]);
+            builders.back()->Build(batches.emplace_back());
+        }
+    }
+
+    std::cout << std::endl;
+    for(const BenchQuery& query : GetQueries())
+    {
+        if(query.name.find(queryFilter) == std::string::npos)
+            continue;
+
+        std::cout << query.name << ": " << query.constraints << std::endl;
+
+        //
+        // Parse: constraints string into the compiled constraints
+        //
+        const int PARSE_COUNT = 1000;
+        bool parsed = true;
+        double time = Measure(repeat, [&]()
+        {
+            for(int i = 0; i < PARSE_COUNT; i++)
+            {
+                Constraints constraints;
+                parsed = constraints.Parse(query.constraints, &schema) && parsed;
+            }
+        });
+        if(!parsed)
+        {
+            ERRORMSG("Failed to parse '" << query.constraints << "'");
+            continue;
+        }
+        reporter.Add("parse", query.name, "-", time * 1e9 / PARSE_COUNT, "ns", Reporter::NO_MATCHES);
+
+        //
+        // Evaluation of the in memory rows
+        //
+        size_t programMatches = 0;
+        Constraints constraints;
+        constraints.Parse(query.constraints, &schema);
+
+        for(Constraints::EvalMode mode : {Constraints::EVAL_PROGRAM, Constraints::EVAL_TREE})
+        {
+            constraints.SetEvalMode(mode);
+            size_t matches = 0, errors = 0;
+            time = Measure(repeat, [&]()
+            {
+                matches = errors = 0;
+                for(const Record& rec : records)
+                {
+                    bool result = false;
+                    if(!constraints.Evaluate(rec, result))
+                        errors++;
+                    else if(result)
+                        matches++;
+                }
+            });
+            if(errors > 0)
+                ERRORMSG(errors << " evaluation errors: " << constraints.GetError());
+            if(mode == Constraints::EVAL_PROGRAM)
+                programMatches = matches;
+            reporter.Add("eval", query.name, (mode == Constraints::EVAL_TREE ? "tree" : "program"),
+                         time * 1e9 / rows, "ns/row", matches);
+        }
+
+        if(query.countStatic)
+        {
+            size_t matches = 0, errors = 0;
+            time = Measure(repeat, [&]()
+            {
+                errors = 0;
+                matches = query.countStatic(schema, records, errors);
+            });
+            if(errors > 0)
+                ERRORMSG(errors << " static evaluation errors");
+            if(matches != programMatches)
+                ERRORMSG("Static constraints don't match '" << query.constraints << "'");
+            reporter.Add("eval", query.name, "static", time * 1e9 / rows, "ns/row", matches);
+        }
+
+        size_t matches = 0;
+        bool evaluated = true;
+        Selection selection;
+        time = Measure(repeat, [&]()
+        {
+            matches = 0;
+            for(const ColumnBatch& batch : batches)
+            {
+                evaluated = constraints.EvaluateBatch(batch, selection) && evaluated;
+                matches += selection.Count();
+            }
+        });
+        if(!evaluated)
+            ERRORMSG("Batch evaluation failed: " << constraints.GetError());
+        else
+            reporter.Add("eval", query.name, "batch", time * 1e9 / rows, "ns/row", matches);
+
+        //
+        // End-to-end: scan of the data file
+        //
+        ScanOptions opts;
+        for(const char* mode : {"stream", "mmap", "batch"})
+        {
+            opts.mmapMode = (strcmp(mode, "stream") != 0);
+            opts.batchMode = (strcmp(mode, "batch") == 0);
+
+            CountSink sink;
+            time = Measure(repeat, [&]()
+            {
+                Scanner scanner(opts, schema);
+                scanner.Init(query.constraints.c_str());
+                sink = CountSink();
+
+                if(opts.mmapMode)
+                {
+                    mappedFile.ForEachLine([&](std::string_view line) { scanner.ProcessLine(line, sink); });
+                }
+                else
+                {
+                    std::ifstream in(dataFileName);
+                    std::string line;
+                    while(std::getline(in, line))
+                        scanner.ProcessLine(line, sink);
+                }
+                scanner.Flush(sink);
+            });
+            if(sink.errorCount > 0)
+                ERRORMSG(sink.errorCount << " evaluation errors");
+            reporter.Add("e2e", query.name, mode, rows / time, "rows/s", sink.matchCount);
+        }
+
+        // Matches are formatted, but not written (the stream is bad)
+        std::ostream nullStream(nullptr);
+        opts.mmapMode = true;
+        opts.batchMode = false;
+        opts.threads = threads;
+        int matchCount = 0;
+        time = Measure(repeat, [&]()
+        {
+            Scanner main(opts, schema);
+            main.Init(query.constraints.c_str());
+            matchCount = 0;
+            bool stopped = false;
+            ScanParallel(mappedFile, main, query.constraints.c_str(), nullStream, matchCount, stopped);
+        });
+        reporter.Add("e2e", query.name, "threads", rows / time, "rows/s", matchCount);
+        std::cout << std::endl;
+    }
+
+    mappedFile.Close();
+    remove(dataFileName.c_str());
+
+    if(outputFileName)
+        std::cout << "Results written to " << outputFileName << std::endl;
+    return 0;
+}
@@ -0,0 +1,340 @@
+//
+// bitmap.cpp
+//
+#include <algorithm>        // std::lower_bound, std::set_intersection, ...
+#include <iterator>         // std::back_inserter
+#include "bitmap.h"
+
+//
+// RowBitmap::Container
+//
+void RowBitmap::Container::ToBitset()
+{
+    if(IsBitset())
+        return;
+
+    bits.assign(BITSET_WORDS, 0);
+    for(uint16_t low : array)
+        bits[low / 64] |= uint64_t(1) << (low % 64);
+    array.clear();
+    array.shrink_to_fit();
+}
+
+void RowBitmap::Container::ToArray()
+{
+    if(!IsBitset())
+        return;
+
+    array.clear();
+    array.reserve(card);
+    for(uint32_t w = 0; w < BITSET_WORDS; w++)
+    {
+        for(uint64_t word = bits[w]; word; word &= word - 1)
+            array.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+    }
+    bits.clear();
+    bits.shrink_to_fit();
+}
+
+void RowBitmap::Container::Normalize()
+{
+    if(IsBitset() && card <= MAX_ARRAY)
+        ToArray();
+    else if(!IsBitset() && card > MAX_ARRAY)
+        ToBitset();
+}
+
+//
+// RowBitmap
+//
+void RowBitmap::Add(uint32_t row)
+{
+    uint16_t key = (uint16_t)(row >> 16);
+    uint16_t low = (uint16_t)row;
+
+    // Find the container (the last one when adding in ascending order)
+    auto it = containers.end();
+    if(containers.empty() || containers.back().key < key)
+    {
+        containers.emplace_back().key = key;
+        it = containers.end() - 1;
+    }
+    else if(containers.back().key == key)
+    {
+        it = containers.end() - 1;
+    }
+    else
+    {
+        it = std::lower_bound(containers.begin(), containers.end(), key,
+                [](const Container& c, uint16_t k) { return c.key < k; });
+        if(it == containers.end() || it->key != key)
+        {
+            it = containers.emplace(it);
+            it->key = key;
+        }
+    }
+
+    Container& c = *it;
+    if(c.IsBitset())
+    {
+        uint64_t& word = c.bits[low / 64];
+        uint64_t bit = uint64_t(1) << (low % 64);
+        c.card += !(word & bit);
+        word |= bit;
+        return;
+    }
+
+    if(c.array.empty() || c.array.back() < low)
+    {
+        c.array.push_back(low);
+    }
+    else
+    {
+        auto pos = std::lower_bound(c.array.begin(), c.array.end(), low);
+        if(*pos == low)
+            return;
+        c.array.insert(pos, low);
+    }
+
+    c.card++;
+    if(c.card > Container::MAX_ARRAY)
+        c.ToBitset();
+}
+
+bool RowBitmap::Contains(uint32_t row) const
+{
+    uint16_t key = (uint16_t)(row >> 16);
+    uint16_t low = (uint16_t)row;
+
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+            [](const Container& c, uint16_t k) { return c.key < k; });
+    if(it == containers.end() || it->key != key)
+        return false;
+
+    if(it->IsBitset())
+        return (it->bits[low / 64] >> (low % 64)) & 1;
+    return std::binary_search(it->array.begin(), it->array.end(), low);
+}
+
+size_t RowBitmap::Count() const
+{
+    size_t count = 0;
+    for(const Container& c : containers)
+        count += c.card;
+    return count;
+}
+
+void RowBitmap::SetRange(uint32_t rowCount)
+{
+    containers.clear();
+    for(uint32_t start = 0; start < rowCount; start += 65536)
+    {
+        Container& c = containers.emplace_back();
+        c.key = (uint16_t)(start >> 16);
+        c.card = std::min(rowCount - start, (uint32_t)65536);
+        c.bits.assign(Container::BITSET_WORDS, 0);
+        for(uint32_t i = 0; i < c.card / 64; i++)
+            c.bits[i] = ~uint64_t(0);
+        if(c.card % 64)
+            c.bits[c.card / 64] = (uint64_t(1) << (c.card % 64)) - 1;
+        c.Normalize();
+    }
+}
+
+size_t RowBitmap::GetMemorySize() const
+{
+    size_t size = containers.capacity() * sizeof(Container);
+    for(const Container& c : containers)
+        size += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+    return size;
+}
+
+//
+// Container operations
+//
+void RowBitmap::And(const Container& a, const Container& b, Container& out)
+{
+    out.key = a.key;
+    out.array.clear();
+    out.bits.clear();
+
+    if(a.IsBitset() && b.IsBitset())
+    {
+        out.bits.resize(Container::BITSET_WORDS);
+        out.card = 0;
+        for(uint32_t w = 0; w < Container::BITSET_WORDS; w++)
+        {
+            out.bits[w] = a.bits[w] & b.bits[w];
+            out.card += __builtin_popcountll(out.bits[w]);
+        }
+        out.Normalize();
+    }
+    else if(a.IsBitset() || b.IsBitset())
+    {
+        // Filter the array by the bitset
+        const Container& arr = (a.IsBitset() ? b : a);
+        const Container& set = (a.IsBitset() ? a : b);
+        for(uint16_t low : arr.array)
+        {
+            if((set.bits[low / 64] >> (low % 64)) & 1)
+                out.array.push_back(low);
+        }
+        out.card = (uint32_t)out.array.size();
+    }
+    else
+    {
+        std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                              std::back_inserter(out.array));
+        out.card = (uint32_t)out.array.size();
+    }
+}
+
+void RowBitmap::Or(const Container& a, const Container& b, Container& out)
+{
+    out.key = a.key;
+    out.array.clear();
+    out.bits.clear();
+
+    if(!a.IsBitset() && !b.IsBitset() && a.card + b.card <= Container::MAX_ARRAY)
+    {
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                       std::back_inserter(out.array));
+        out.card = (uint32_t)out.array.size();
+        return;
+    }
+
+    // Union into a bitset
+    if(a.IsBitset())
+        out.bits = a.bits;
+    else
+        out.bits.assign(Container::BITSET_WORDS, 0);
+
+    for(uint16_t low : a.array)
+        out.bits[low / 64] |= uint64_t(1) << (low % 64);
+    if(b.IsBitset())
+    {
+        for(uint32_t w = 0; w < Container::BITSET_WORDS; w++)
+            out.bits[w] |= b.bits[w];
+    }
+    for(uint16_t low : b.array)
+        out.bits[low / 64] |= uint64_t(1) << (low % 64);
+
+    out.card = 0;
+    for(uint64_t word : out.bits)
+        out.card += __builtin_popcountll(word);
+    out.Normalize();
+}
+
+void RowBitmap::AndNot(const Container& a, const Container& b, Container& out)
+{
+    out.key = a.key;
+    out.array.clear();
+    out.bits.clear();
+
+    if(a.IsBitset())
+    {
+        out.bits = a.bits;
+        if(b.IsBitset())
+        {
+            for(uint32_t w = 0; w < Container::BITSET_WORDS; w++)
+                out.bits[w] &= ~b.bits[w];
+        }
+        for(uint16_t low : b.array)
+            out.bits[low / 64] &= ~(uint64_t(1) << (low % 64));
+
+        out.card = 0;
+        for(uint64_t word : out.bits)
+            out.card += __builtin_popcountll(word);
+        out.Normalize();
+    }
+    else if(b.IsBitset())
+    {
+        for(uint16_t low : a.array)
+        {
+            if(!((b.bits[low / 64] >> (low % 64)) & 1))
+                out.array.push_back(low);
+        }
+        out.card = (uint32_t)out.array.size();
+    }
+    else
+    {
+        std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                            std::back_inserter(out.array));
+        out.card = (uint32_t)out.array.size();
+    }
+}
+
+//
+// Bitmap operations (merge of the containers sorted by key)
+//
+void RowBitmap::And(const RowBitmap& a, const RowBitmap& b, RowBitmap& out)
+{
+    out.containers.clear();
+    auto ia = a.containers.begin();
+    auto ib = b.containers.begin();
+
+    while(ia != a.containers.end() && ib != b.containers.end())
+    {
+        if(ia->key < ib->key)
+        {
+            ++ia;
+        }
+        else if(ib->key < ia->key)
+        {
+            ++ib;
+        }
+        else
+        {
+            Container c;
+            And(*ia++, *ib++, c);
+            if(c.card > 0)
+                out.containers.push_back(std::move(c));
+        }
+    }
+}
+
+void RowBitmap::Or(const RowBitmap& a, const RowBitmap& b, RowBitmap& out)
+{
+    out.containers.clear();
+    auto ia = a.containers.begin();
+    auto ib = b.containers.begin();
+
+    while(ia != a.containers.end() || ib != b.containers.end())
+    {
+        if(ib == b.containers.end() || (ia != a.containers.end() && ia->key < ib->key))
+        {
+            out.containers.push_back(*ia++);
+        }
+        else if(ia == a.containers.end() || ib->key < ia->key)
+        {
+            out.containers.push_back(*ib++);
+        }
+        else
+        {
+            Or(*ia++, *ib++, out.containers.emplace_back());
+        }
+    }
+}
+
+void RowBitmap::AndNot(const RowBitmap& a, const RowBitmap& b, RowBitmap& out)
+{
+    out.containers.clear();
+    auto ib = b.containers.begin();
+
+    for(const Container& ca : a.containers)
+    {
+        while(ib != b.containers.end() && ib->key < ca.key)
+            ++ib;
+
+        if(ib == b.containers.end() || ib->key != ca.key)
+        {
+            out.containers.push_back(ca);
+            continue;
+        }
+
+        Container c;
+        AndNot(ca, *ib, c);
+        if(c.card > 0)
+            out.containers.push_back(std::move(c));
+    }
+}
@@ -0,0 +1,95 @@
+//
+// bitmap.h
+//
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include <vector>
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint16_t, uint32_t, uint64_t
+
+//
+// Class RowBitmap (Roaring-style compressed bitmap of row numbers).
+// Rows are split into containers of 65536 rows by the high 16 bits.
+// A container keeps the low 16 bits either in a sorted array (up to
+// 4096 rows) or in a 65536 bit bitset (dense containers), so both
+// sparse and dense bitmaps stay compact, and AND/OR/AND NOT work
+// container by container.
+//
+class RowBitmap
+{
+public:
+    RowBitmap() = default;
+    ~RowBitmap() = default;
+
+    // Note: Adding rows in ascending order is the fast path
+    void Add(uint32_t row);
+    bool Contains(uint32_t row) const;
+
+    size_t Count() const;
+    bool IsEmpty() const { return containers.empty(); }
+    void Clear() { containers.clear(); }
+
+    // Bitmap of all rows [0, rowCount)
+    void SetRange(uint32_t rowCount);
+
+    // out = a AND b, a OR b, a AND NOT b
+    // Note: out can't be the same object as a or b
+    static void And(const RowBitmap& a, const RowBitmap& b, RowBitmap& out);
+    static void Or(const RowBitmap& a, const RowBitmap& b, RowBitmap& out);
+    static void AndNot(const RowBitmap& a, const RowBitmap& b, RowBitmap& out);
+
+    // Calls func(uint32_t row) for every row in ascending order
+    template<class FUNC>
+    void ForEach(FUNC func) const;
+
+    // Diagnostic
+    size_t GetMemorySize() const;
+
+private:
+    struct Container
+    {
+        static constexpr uint32_t MAX_ARRAY = 4096;     // Larger containers are bitsets
+        static constexpr uint32_t BITSET_WORDS = 65536 / 64;
+
+        uint16_t key{0};                // High 16 bits of the rows
+        uint32_t card{0};               // Number of rows
+        std::vector<uint16_t> array;    // Sorted low 16 bits (sparse)
+        std::vector<uint64_t> bits;     // Bitset (dense)
+
+        bool IsBitset() const { return !bits.empty(); }
+        void ToBitset();
+        void ToArray();
+        void Normalize();   // Picks the representation by the cardinality
+    };
+
+    static void And(const Container& a, const Container& b, Container& out);
+    static void Or(const Container& a, const Container& b, Container& out);
+    static void AndNot(const Container& a, const Container& b, Container& out);
+
+    std::vector<Container> containers;  // Sorted by key
+};
+
+template<class FUNC>
+void RowBitmap::ForEach(FUNC func) const
+{
+    for(const Container& c : containers)
+    {
+        uint32_t high = (uint32_t)c.key << 16;
+        if(c.IsBitset())
+        {
+            for(uint32_t w = 0; w < Container::BITSET_WORDS; w++)
+            {
+                for(uint64_t word = c.bits[w]; word; word &= word - 1)
+                    func(high | (w * 64 + __builtin_ctzll(word)));
+            }
+        }
+        else
+        {
+            for(uint16_t low : c.array)
+                func(high | low);
+        }
+    }
+}
+
+#endif // __BITMAP_H__
@@ -0,0 +1,471 @@
+//
+// colfile.cpp
+//
+#include <algorithm>        // std::max
+#include <fstream>          // std::ofstream, std::ifstream
+#include <streambuf>        // std::streambuf
+#include <string.h>         // memcmp, memcpy
+#include "colfile.h"
+
+using namespace colfile;
+
+namespace
+{
+
+// Stream buffer writing (and seeking) in a ColumnFileImage
+class ImageBuffer : public std::streambuf
+{
+public:
+    explicit ImageBuffer(ColumnFileImage& imageIn) : image(imageIn)
+    {
+        image.words.clear();
+        image.size = 0;
+    }
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize count) override
+    {
+        size_t end = pos + count;
+        size_t words = (end + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        if(words > image.words.capacity())
+            image.words.reserve(std::max(words, 2 * image.words.capacity()));
+        if(words > image.words.size())
+            image.words.resize(words, 0);
+
+        memcpy((char*)image.words.data() + pos, data, count);
+        pos = end;
+        image.size = std::max(image.size, pos);
+        return count;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if(traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        off_type base = (dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? (off_type)pos : (off_type)image.size);
+        return seekpos(base + off, which);
+    }
+
+    pos_type seekpos(pos_type posIn, std::ios_base::openmode) override
+    {
+        if(posIn < 0 || (size_t)posIn > image.size)
+            return pos_type(off_type(-1));
+        pos = (size_t)posIn;
+        return posIn;
+    }
+
+private:
+    ColumnFileImage& image;
+    size_t pos{0};
+};
+
+} // namespace
+
+//
+// ColumnFileWriter
+//
+void ColumnFileWriter::Append(const Record& rec)
+{
+    const Schema& schema = rec.GetSchema();
+    for(FieldId id = (FieldId)fields.size(); id < schema.GetSize(); id++)
+    {
+        // New field: no value in the previous rows
+        FieldData& field = fields.emplace_back();
+        field.name = schema.GetName(id);
+        field.data.resize(rowCount, 0);
+        field.tags.resize(rowCount, NONE);
+    }
+
+    for(FieldId id = 0; id < fields.size(); id++)
+    {
+        FieldData& field = fields[id];
+        const Value* value = rec.GetValue(id);
+
+        if(!value)
+        {
+            field.data.push_back(0);
+            field.tags.push_back(NONE);
+        }
+        else if(value->IsInt() && value->GetInt() == (int32_t)value->GetInt())
+        {
+            field.data.push_back((int32_t)value->GetInt());
+            field.tags.push_back(INT);
+        }
+        else if(value->IsNumber())
+        {
+            std::string text;
+            value->Format(text);
+            field.data.push_back((int32_t)field.dict.Intern(text));
+            field.tags.push_back(NUMBER);
+        }
+        else
+        {
+            field.data.push_back((int32_t)field.dict.Intern(value->GetString()));
+            field.tags.push_back(STRING);
+        }
+    }
+
+    rowCount++;
+}
+
+bool ColumnFileWriter::Write(const char* fileName)
+{
+    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+    if(!out)
+    {
+        err = std::string("Cannot create file '") + fileName + "'";
+        return false;
+    }
+
+    if(!Write(out) || !out.flush())
+    {
+        err = std::string("Failed to write file '") + fileName + "'";
+        return false;
+    }
+    return true;
+}
+
+bool ColumnFileWriter::Write(ColumnFileImage& image)
+{
+    ImageBuffer buffer(image);
+    std::ostream out(&buffer);
+    return Write(out);
+}
+
+bool ColumnFileWriter::Write(std::ostream& out)
+{
+    // Make the codes order-preserving
+    std::vector<Dictionary::Code> remap;
+    for(FieldData& field : fields)
+    {
+        if(field.dict.IsSorted())
+            continue;
+
+        field.dict.Sort(&remap);
+        for(size_t row = 0; row < rowCount; row++)
+        {
+            if(field.tags[row] == STRING || field.tags[row] == NUMBER)
+                field.data[row] = (int32_t)remap[field.data[row]];
+        }
+    }
+
+    auto write = [&](const void* data, size_t size) { out.write((const char*)data, size); };
+    auto align = [&]()
+    {
+        static const char zeros[8] = {};
+        size_t pos = (size_t)out.tellp();
+        if(pos % 8)
+            write(zeros, 8 - pos % 8);
+    };
+
+    FileHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.fieldCount = (uint32_t)fields.size();
+    header.rowCount = rowCount;
+    header.rowGroupCount = GetRowGroupCount();
+    write(&header, sizeof(header));
+
+    // Column chunks, row group by row group
+    std::vector<uint64_t> chunkOffsets(header.rowGroupCount * fields.size(), 0);
+
+    for(size_t group = 0; group < header.rowGroupCount; group++)
+    {
+        size_t begin = group * rowGroupSize;
+        size_t end = std::min(begin + rowGroupSize, rowCount);
+
+        for(size_t f = 0; f < fields.size(); f++)
+        {
+            const FieldData& field = fields[f];
+
+            // Chunk type: the type of all rows, or MIXED
+            uint8_t type = field.tags[begin];
+            for(size_t row = begin + 1; row < end && type != MIXED; row++)
+            {
+                if(field.tags[row] != type)
+                    type = MIXED;
+            }
+
+            if(type == NONE)
+                continue;
+
+            align();
+            chunkOffsets[group * fields.size() + f] = (uint64_t)out.tellp();
+
+            ChunkHeader chunk{};
+            chunk.type = type;
+            chunk.rowCount = (uint32_t)(end - begin);
+            write(&chunk, sizeof(chunk));
+            write(field.data.data() + begin, (end - begin) * sizeof(int32_t));
+            if(type == MIXED)
+                write(field.tags.data() + begin, end - begin);
+        }
+    }
+
+    // Field names and dictionaries
+    align();
+    header.fieldsOffset = (uint64_t)out.tellp();
+
+    auto writeString = [&](const std::string& str)
+    {
+        uint32_t len = (uint32_t)str.size();
+        write(&len, sizeof(len));
+        write(str.data(), len);
+    };
+
+    for(const FieldData& field : fields)
+    {
+        writeString(field.name);
+        uint32_t dictSize = (uint32_t)field.dict.GetSize();
+        write(&dictSize, sizeof(dictSize));
+        for(Dictionary::Code code = 0; code < dictSize; code++)
+            writeString(field.dict.GetString(code));
+    }
+
+    // Row group directory
+    align();
+    header.rowGroupsOffset = (uint64_t)out.tellp();
+
+    for(size_t group = 0; group < header.rowGroupCount; group++)
+    {
+        RowGroupEntry entry{};
+        entry.firstRow = group * rowGroupSize;
+        entry.rowCount = std::min(rowGroupSize, rowCount - entry.firstRow);
+        write(&entry, sizeof(entry));
+        write(chunkOffsets.data() + group * fields.size(), fields.size() * sizeof(uint64_t));
+    }
+
+    out.seekp(0);
+    write(&header, sizeof(header));
+    out.seekp(0, std::ios::end);
+
+    if(!out)
+    {
+        err = "Failed to write the column file";
+        return false;
+    }
+    return true;
+}
+
+//
+// ColumnFile
+//
+bool ColumnFile::IsColumnFile(const char* fileName)
+{
+    std::ifstream in(fileName, std::ios::binary);
+    char magic[sizeof(MAGIC)] = {};
+    return in.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool ColumnFile::Corrupted(const char* what)
+{
+    err = std::string("Corrupted column file: invalid ") + what;
+    return false;
+}
+
+bool ColumnFile::Open(const char* fileName, Schema& schema)
+{
+    memory.clear();
+    if(!file.Open(fileName))
+    {
+        err = file.GetError();
+        return false;
+    }
+    return Read(file.GetData(), file.GetSize(), schema);
+}
+
+bool ColumnFile::Load(ColumnFileImage&& image, Schema& schema)
+{
+    file.Close();
+    memory = std::move(image.words);
+    size_t size = image.size;
+    image.size = 0;
+    return Read((const char*)memory.data(), size, schema);
+}
+
+bool ColumnFile::Read(const char* data, size_t size, Schema& schema)
+{
+    fields.clear();
+    fieldIndex.clear();
+    rowGroups.clear();
+    rowCount = 0;
+
+    if(size < sizeof(FileHeader))
+        return Corrupted("header");
+
+    FileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version == 0 || header.version > VERSION)
+        return Corrupted("header");
+    rowCount = header.rowCount;
+
+    // Fields: bind names to the schema and load the dictionaries
+    size_t pos = header.fieldsOffset;
+    auto readU32 = [&](uint32_t& val)
+    {
+        if(pos + sizeof(val) > size)
+            return false;
+        memcpy(&val, data + pos, sizeof(val));
+        pos += sizeof(val);
+        return true;
+    };
+    auto readString = [&](std::string_view& str)
+    {
+        uint32_t len = 0;
+        if(!readU32(len) || pos + len > size)
+            return false;
+        str = std::string_view(data + pos, len);
+        pos += len;
+        return true;
+    };
+
+    // A field takes at least its name length and dictionary size, so the
+    // counts of a corrupted header are bounded before anything is allocated
+    if(header.fieldsOffset > size || header.fieldCount > (size - header.fieldsOffset) / (2 * sizeof(uint32_t)))
+        return Corrupted("field directory");
+
+    fields.resize(header.fieldCount);
+    for(Field& field : fields)
+    {
+        std::string_view name;
+        uint32_t dictSize = 0;
+        if(!readString(name) || !readU32(dictSize))
+            return Corrupted("field");
+
+        field.id = schema.Bind(name);
+        for(uint32_t i = 0; i < dictSize; i++)
+        {
+            std::string_view str;
+            if(!readString(str))
+                return Corrupted("dictionary");
+            field.dict.Intern(str);
+        }
+
+        if(!field.dict.IsSorted())
+            return Corrupted("dictionary order");
+
+        if(field.id >= fieldIndex.size())
+            fieldIndex.resize(field.id + 1, fields.size());
+        fieldIndex[field.id] = &field - fields.data();
+
+        // Numbers are parsed once, not for every row of GetRecord
+        field.values.resize(field.dict.GetSize());
+        for(Dictionary::Code code = 0; code < field.values.size(); code++)
+            field.values[code].Assign(field.dict.GetString(code));
+    }
+
+    // Row group directory
+    size_t entrySize = sizeof(RowGroupEntry) + header.fieldCount * sizeof(uint64_t);
+    if(header.rowGroupsOffset > size || header.rowGroupCount > (size - header.rowGroupsOffset) / entrySize)
+        return Corrupted("row group directory");
+
+    rowGroups.resize(header.rowGroupCount);
+    for(size_t group = 0; group < rowGroups.size(); group++)
+    {
+        const char* ptr = data + header.rowGroupsOffset + group * entrySize;
+        RowGroupEntry entry;
+        memcpy(&entry, ptr, sizeof(entry));
+
+        RowGroup& rowGroup = rowGroups[group];
+        rowGroup.rowCount = entry.rowCount;
+        rowGroup.chunks.resize(header.fieldCount);
+
+        for(size_t f = 0; f < header.fieldCount; f++)
+        {
+            uint64_t offset = 0;
+            memcpy(&offset, ptr + sizeof(entry) + f * sizeof(uint64_t), sizeof(offset));
+            if(offset == 0)
+                continue;
+
+            ChunkHeader chunk;
+            size_t dataSize = entry.rowCount * sizeof(int32_t);
+            if(offset % 8 || offset > size || entry.rowCount > size || offset + sizeof(chunk) + dataSize > size)
+                return Corrupted("column chunk");
+            memcpy(&chunk, data + offset, sizeof(chunk));
+            if(chunk.rowCount != entry.rowCount || chunk.type < INT || chunk.type > NUMBER ||
+               (chunk.type == MIXED && offset + sizeof(chunk) + dataSize + entry.rowCount > size))
+                return Corrupted("column chunk");
+
+            // Note: Chunks are 8-byte aligned, so the data can be used in place
+            Chunk& c = rowGroup.chunks[f];
+            c.type = (ChunkType)chunk.type;
+            c.data = (const int32_t*)(data + offset + sizeof(chunk));
+            c.tags = (chunk.type == MIXED ? (const uint8_t*)(c.data + entry.rowCount) : nullptr);
+
+            // Codes index the dictionary (see GetRecord), so they are checked
+            // once here rather than for every read
+            size_t dictSize = fields[f].dict.GetSize();
+            for(size_t row = 0; row < entry.rowCount; row++)
+            {
+                uint8_t type = (c.tags ? c.tags[row] : c.type);
+                if(type > NUMBER || type == MIXED ||
+                   ((type == STRING || type == NUMBER) && (uint32_t)c.data[row] >= dictSize))
+                    return Corrupted("column chunk");
+            }
+        }
+    }
+
+    return true;
+}
+
+void ColumnFile::GetBatch(size_t group, ColumnBatch& batch) const
+{
+    const RowGroup& rowGroup = rowGroups[group];
+    batch.Clear();
+    batch.SetRowCount(rowGroup.rowCount);
+
+    for(size_t f = 0; f < fields.size(); f++)
+    {
+        const Chunk& chunk = rowGroup.chunks[f];
+        if(chunk.type == INT)
+            batch.SetIntColumn(fields[f].id, chunk.data);
+        else if(chunk.type == STRING)
+            batch.SetStringColumn(fields[f].id, chunk.data, &fields[f].dict);
+    }
+}
+
+void ColumnFile::GetRecord(size_t group, size_t row, Record& rec) const
+{
+    const RowGroup& rowGroup = rowGroups[group];
+    rec.Clear();
+
+    for(size_t f = 0; f < fields.size(); f++)
+    {
+        const Chunk& chunk = rowGroup.chunks[f];
+        uint8_t type = (chunk.tags ? chunk.tags[row] : chunk.type);
+
+        if(type == INT)
+            rec.SetValue(fields[f].id, (int64_t)chunk.data[row]);
+        else if(type == STRING || type == NUMBER)
+            rec.SetValue(fields[f].id, fields[f].values[chunk.data[row]]);
+    }
+}
+
+//
+// ColumnFile::Row
+//
+const Value* ColumnFile::Row::GetValue(FieldId id) const
+{
+    size_t f = (id < file.fieldIndex.size() ? file.fieldIndex[id] : file.fields.size());
+    if(f == file.fields.size())
+        return nullptr;
+
+    const Chunk& chunk = file.rowGroups[group].chunks[f];
+    uint8_t type = (chunk.tags ? chunk.tags[row] : chunk.type);
+
+    if(type == INT)
+    {
+        ints[f] = Value((int64_t)chunk.data[row]);
+        return &ints[f];
+    }
+    if(type == STRING || type == NUMBER)
+        return &file.fields[f].values[chunk.data[row]];
+    return nullptr;
+}
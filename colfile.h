@@ -0,0 +1,217 @@
+//
+// colfile.h
+//
+#ifndef __COLFILE_H__
+#define __COLFILE_H__
+
+#include <iostream>         // std::ostream
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>         // uint8_t, uint32_t, uint64_t
+#include "record.h"
+#include "batch.h"
+#include "ingest.h"
+
+//
+// Binary columnar file format.
+// Rows are stored in row groups, and every row group keeps one column
+// chunk per field: an int32 per row, holding the value for int fields or
+// the dictionary code for string fields. Every field has a per-file sorted
+// dictionary, so codes are order-preserving. Numbers that don't fit into
+// int32 (int64 and double) are kept as the dictionary code of their text.
+// Chunks of fields that are missing in some rows or have values of several
+// types also keep a type tag per row. File layout (all numbers in the host byte order):
+//
+//   FileHeader
+//   column chunks of all row groups (8-byte aligned, ChunkHeader + data)
+//   fields: name and dictionary strings of every field
+//   row group directory: RowGroupEntry + chunk offset per field
+//
+namespace colfile
+{
+
+constexpr char MAGIC[8] = {'Q', 'W', 'C', 'C', 'O', 'L', '1', '\0'};
+constexpr uint32_t VERSION = 2;    // Version 1 files (without NUMBER) are read too
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t fieldCount;
+    uint64_t rowCount;
+    uint64_t rowGroupCount;
+    uint64_t fieldsOffset;
+    uint64_t rowGroupsOffset;
+};
+
+// Column chunk and per row type tag
+enum ChunkType : uint8_t
+{
+    NONE=0,     // No value (chunk offset is 0 if no row of the group has a value)
+    INT,        // int32 value
+    STRING,     // int32 dictionary code
+    MIXED,      // Type of every row is in the tags
+    NUMBER      // int32 dictionary code of the number text
+};
+
+struct ChunkHeader
+{
+    uint8_t type;       // INT, STRING, NUMBER or MIXED (with tags)
+    uint8_t reserved[3];
+    uint32_t rowCount;
+    // int32_t data[rowCount], then uint8_t tags[rowCount] for MIXED
+};
+
+struct RowGroupEntry
+{
+    uint64_t firstRow;
+    uint64_t rowCount;
+    // uint64_t chunkOffsets[fieldCount]
+};
+
+} // namespace colfile
+
+//
+// Struct ColumnFileImage.
+// Columnar file written to memory (see ColumnFileWriter::Write), that
+// ColumnFile::Load takes over without copying.
+//
+struct ColumnFileImage
+{
+    std::vector<uint64_t> words;    // File data (8-byte aligned)
+    size_t size{0};                 // In bytes
+};
+
+//
+// Class ColumnFileWriter.
+// Converts Records into the columnar file. Columns are kept in memory
+// until Write(), since the dictionaries are sorted (and the codes remapped)
+// only when all values are known.
+//
+class ColumnFileWriter
+{
+public:
+    ColumnFileWriter(size_t rowGroupSizeIn = 65536) : rowGroupSize(rowGroupSizeIn) {}
+    ~ColumnFileWriter() = default;
+
+    void Append(const Record& rec);
+    bool Write(const char* fileName);
+    bool Write(std::ostream& out);
+    bool Write(ColumnFileImage& image); // For ColumnFile::Load
+
+    size_t GetRowCount() const { return rowCount; }
+    size_t GetRowGroupCount() const { return (rowCount + rowGroupSize - 1) / rowGroupSize; }
+    const std::string& GetError() const { return err; }
+
+private:
+    struct FieldData
+    {
+        std::string name;
+        Dictionary dict;
+        std::vector<int32_t> data;  // Value or dictionary code per row
+        std::vector<uint8_t> tags;  // ChunkType per row
+    };
+
+    size_t rowGroupSize{65536};
+    size_t rowCount{0};
+    std::vector<FieldData> fields;  // By FieldId of the Record schema
+    std::string err;
+};
+
+//
+// Class ColumnFile (reader).
+// Memory maps the columnar file. Int and string columns of a row group
+// are handed to the batch evaluator in place (without copying or parsing),
+// and Records are only materialized for the matching rows.
+//
+class ColumnFile
+{
+public:
+    ColumnFile() = default;
+    ~ColumnFile() = default;
+
+    // Checks the file magic
+    static bool IsColumnFile(const char* fileName);
+
+    // Maps the file and binds its fields to the schema
+    bool Open(const char* fileName, Schema& schema);
+
+    // Same for a file image kept in memory (moved from image)
+    bool Load(ColumnFileImage&& image, Schema& schema);
+    const std::string& GetError() const { return err; }
+
+    size_t GetRowCount() const { return rowCount; }
+    size_t GetRowGroupCount() const { return rowGroups.size(); }
+    size_t GetRowGroupSize(size_t group) const { return rowGroups[group].rowCount; }
+
+    // Sets batch columns to the row group chunks. Fields that are missing
+    // in some rows of the group, or have values of several types or numbers
+    // out of the int32 range, are left out of the batch (as with
+    // ColumnBatchBuilder).
+    void GetBatch(size_t group, ColumnBatch& batch) const;
+
+    // Materializes a row of the group
+    // Note: Strings are not interned, so the record can be evaluated with
+    // constraints bound to a copy of the schema.
+    void GetRecord(size_t group, size_t row, Record& rec) const;
+
+    //
+    // Row of a row group, evaluated in place: values are looked up in the
+    // columns (by FieldId, as in Record) when the constraints use them,
+    // so rows that don't match are not materialized.
+    //
+    class Row
+    {
+    public:
+        Row(const ColumnFile& fileIn) : file(fileIn), ints(fileIn.fields.size()) {}
+
+        void Set(size_t groupIn, size_t rowIn) { group = groupIn; row = rowIn; }
+        const Value* GetValue(FieldId id) const;
+
+    private:
+        const ColumnFile& file;
+        size_t group{0};
+        size_t row{0};
+        mutable std::vector<Value> ints;    // Int value of the row, by field of the file
+    };
+
+private:
+    struct Field
+    {
+        FieldId id{INVALID_FIELD_ID};
+        Dictionary dict;            // Sorted (order-preserving codes)
+        std::vector<Value> values;  // Parsed dictionary strings, by code
+    };
+
+    struct Chunk
+    {
+        colfile::ChunkType type{colfile::NONE};
+        const int32_t* data{nullptr};
+        const uint8_t* tags{nullptr};   // MIXED only
+    };
+
+    struct RowGroup
+    {
+        size_t rowCount{0};
+        std::vector<Chunk> chunks;  // By field of the file
+    };
+
+    // Reads the directory of the file image, that must stay mapped
+    bool Read(const char* data, size_t size, Schema& schema);
+    bool Corrupted(const char* what);
+
+    MappedFile file;
+    std::vector<uint64_t> memory;   // Loaded image (8-byte aligned)
+    std::vector<Field> fields;
+    std::vector<size_t> fieldIndex;     // Field of the file by FieldId (fields.size() if none)
+    std::vector<RowGroup> rowGroups;
+    size_t rowCount{0};
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    ColumnFile(const ColumnFile&) = delete;
+    ColumnFile& operator=(const ColumnFile&) = delete;
+};
+
+#endif // __COLFILE_H__
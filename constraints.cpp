@@ -3,572 +3,1079 @@
 //
 #include <iostream>         // std::cout
 #include <strings.h>        // strncasecmp
-#include <string.h>         // strchr
+#include <string.h>         // strchr, memchr, strlen
+#include <algorithm>        // std::sort, std::stable_sort
+#include <numeric>          // std::iota
 #include "constraints.h"
 #include "logger.h"
 
-
-bool Constraints::Parse(const char* constraintsStr)
+//
+// Tokenizer
+//
+struct Constraints::Token
 {
-    constraintsTree.reset();
-    err.clear();
-    constraintsStrIn = constraintsStr;
-
-    std::unique_ptr<Node> empty;
-    constraintsTree.reset(Parse(constraintsStr, empty));
-    return (bool)constraintsTree;
-}
-
-Constraints::Node* Constraints::ParseOperand(const char* constraintsStr, size_t& len)
+    enum Type : char
+    {
+        END=0,
+        WORD,       // Unquoted name or value
+        STRING,     // Quoted name or value
+        LPAREN,     // (
+        RPAREN,     // )
+        COMMA,      // ,
+        COMPARE,    // ==, !=, <, <=, >, >=
+        AND, OR, NOT, IN, // Keywords (case insensitive words)
+        INVALID
+    };
+
+    Type type{END};
+    Node::Operator oper{Node::NOOP}; // COMPARE only
+    std::string_view text;  // WORD, STRING (without the quotes) and keywords
+    size_t pos{0};          // Offset in the parsed string
+    size_t size{0};         // Length in the parsed string
+
+    // A keyword is a plain word in the value position
+    bool IsValue() const { return type == WORD || type == STRING || (type >= AND && type <= IN); }
+};
+
+// Splits the parsed string into tokens on demand, one token ahead.
+// Tokens refer to the parsed string, so nothing is allocated.
+class Constraints::Tokenizer
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
+public:
+    Tokenizer(std::string_view sourceIn) : source(sourceIn) { Advance(); }
 
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
-
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+    const Token& Peek() const { return token; }
+    Token Next()
     {
-        err = prefix + "Invalid (empty) constraintsStr";
-        return nullptr;
+        Token next = token;
+        end = token.pos + token.size;
+        Advance();
+        return next;
     }
 
-    // Skip trailing whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+    // End offset of the last token returned by Next()
+    size_t GetEnd() const { return end; }
+
+private:
+    void Advance();
+
+    std::string_view source;
+    size_t pos{0};
+    size_t end{0};
+    Token token;
+};
 
-    // Single operand example:
-    //   Name == Value
-    //   Name != Value
-    //   "Name AAA" == "Value BBB"
-    //
-    // Sub-constraintsStr example:
-    //   (NameSort == 000Test AND IsGroup != 1)
+void Constraints::Tokenizer::Advance()
+{
+    while(pos < source.size() && isspace((unsigned char)source[pos]))
+        pos++;
+
+    token = Token();
+    token.pos = pos;
+    if(pos == source.size())
+        return;
 
-    Node* operand = nullptr;
+    const char* ptr = source.data() + pos;
+    const char* end = source.data() + source.size();
+    char next = (ptr + 1 < end ? ptr[1] : '\0');
 
-    // Parse singe operand or sub-constraintsStr.
-    if(*ptr == '(')
+    switch(*ptr)
     {
-        // Find the end of sub-constraintsStr
-        ptr++;
-        const char* end = strchr(ptr, ')');
-        if(end == nullptr)
+        case '(': token.type = Token::LPAREN; token.size = 1; break;
+        case ')': token.type = Token::RPAREN; token.size = 1; break;
+        case ',': token.type = Token::COMMA;  token.size = 1; break;
+
+        case '=':
+        case '!':
+            // Only == and != (no single '=' or '!')
+            token.type = (next == '=' ? Token::COMPARE : Token::INVALID);
+            token.oper = (*ptr == '=' ? Node::EQ : Node::NE);
+            token.size = (next == '=' ? 2 : 1);
+            break;
+
+        case '<':
+        case '>':
+            token.type = Token::COMPARE;
+            token.oper = (*ptr == '<' ? (next == '=' ? Node::LE : Node::LT) :
+                                        (next == '=' ? Node::GE : Node::GT));
+            token.size = (next == '=' ? 2 : 1);
+            break;
+
+        case '"':
         {
-            err = prefix + "Misformed sub-constraintsStr - missing closing ')'";
-            return nullptr;
+            // Quoted string can have any characters but the quote
+            const char* quote = (const char*)memchr(ptr + 1, '"', end - ptr - 1);
+            if(!quote)
+            {
+                token.type = Token::INVALID;
+                token.size = end - ptr;
+                break;
+            }
+            token.type = Token::STRING;
+            token.text = std::string_view(ptr + 1, quote - ptr - 1);
+            token.size = quote + 1 - ptr;
+            break;
         }
-        else if(ptr == end)
+
+        default:
         {
-            err = prefix + "Misformed (empty) sub-constraintsStr";
-            return nullptr;
+            // Word runs until a space or a character of another token
+            const char* wordEnd = ptr;
+            while(wordEnd < end && !isspace((unsigned char)*wordEnd) && !strchr("()\",=!<>", *wordEnd))
+                wordEnd++;
+
+            token.type = Token::WORD;
+            token.text = std::string_view(ptr, wordEnd - ptr);
+            token.size = wordEnd - ptr;
+
+            auto isKeyword = [&](const char* keyword)
+                { return token.size == strlen(keyword) && strncasecmp(ptr, keyword, token.size) == 0; };
+            if(isKeyword("AND"))
+                token.type = Token::AND;
+            else if(isKeyword("OR"))
+                token.type = Token::OR;
+            else if(isKeyword("NOT"))
+                token.type = Token::NOT;
+            else if(isKeyword("IN"))
+                token.type = Token::IN;
+            break;
         }
+    }
 
-        std::string subConstraints(ptr, end - ptr);
-        ptr = ++end; // The next character after ')'
-
-        DEBUGMSG(prefix << "Begin parsing sub-constraintsStr '" << subConstraints << "'");
-
-        // Parse sub-constraintsStr
-        std::unique_ptr<Node> empty;
-        operand = Parse(subConstraints.c_str(), empty);
-        if(operand == nullptr)
-            return nullptr; // Error is reported by above Parse() call
+    pos += token.size;
+}
 
-        DEBUGMSG(prefix << "End parsing sub-constraintsStr");
-    }
-    else
+bool Constraints::Parse(const char* constraintsStr, Schema* schemaIn /*=nullptr*/)
+{
+    // Release the previous tree at once
+    constraintsTree = nullptr;
+    program.clear();
+    arena.Reset();
+    schema = schemaIn;
+    err.clear();
+    depth = 0;
+    parseOperands.clear();
+    if(constraintsStr == nullptr)
     {
-        // Parse single operand
-        size_t parsedLen = 0;
+        err = "Invalid (null) constraints";
+        return false;
+    }
+    constraintsStrIn = constraintsStr;
 
-        // Read Name argument
-        std::string name;
-        if(!ParseOperandName(ptr, parsedLen, name))
-            return nullptr; // Error is reported by above ParseOperandName() call
-        ptr += parsedLen;
+    // Tokens, names and diagnostic strings refer to the copy in the arena
+    source = arena.CopyString(constraintsStrIn);
+    Tokenizer tokens(source);
+    if(tokens.Peek().type == Token::END)
+    {
+        err = "Empty constraints";
+        return false;
+    }
 
-        // Check if this is "IN (aaa, bbb, ccc)" Value operator
-        if(strncasecmp(ptr, "IN", 2) == 0)
-        {
-            ptr += 2;
-            std::string subConstraints;
-            if(!BuildValuesForOperatorIN(ptr, parsedLen, name, subConstraints))
-                return nullptr; // Error is reported by above BuildValuesForOperatorIN() call
-            ptr += parsedLen;
+    // Note: On failure, partially built nodes stay in the arena until
+    // the next Parse() or destruction
+    constraintsTree = ParseExpression(tokens, 1);
+    if(constraintsTree && tokens.Peek().type != Token::END)
+        constraintsTree = SetParseError(tokens.Peek(), "Expected AND or OR");
+    if(!constraintsTree)
+        return false;
 
-            DEBUGMSG(prefix << "Begin parsing operator IN '" << subConstraints << "'");
+    // Simplify the tree before binding, so the new nodes are bound too
+    if(optimize)
+        constraintsTree = Optimize(constraintsTree);
 
-            // Parse sub-constraintsStr
-            std::unique_ptr<Node> empty;
-            operand = Parse(subConstraints.c_str(), empty);
-            if(operand == nullptr)
-                return nullptr; // Error is reported by above Parse() call
+    // Resolve field names to schema ids
+    if(schema)
+        Bind(constraintsTree);
 
-            DEBUGMSG(prefix << "End parsing operator IN");
-        }
-        else
-        {
-            // Parse operator: ==, !=, <=, >=, <, >
-            Node::Operator oper = ParseOperandOperator(ptr, parsedLen);
-            if(oper == Node::NOOP)
-                return nullptr; // Error is reported by above ParseLogicalOperator() call
-            ptr += parsedLen;
-
-            // Read Value argument
-            parsedLen = 0;
-            std::string value;
-            if(!ParseOperandValue(ptr, parsedLen, value))
-                return nullptr; // Error is reported by above ParseOperandValue() call
-            ptr += parsedLen;
-
-            // Create Element operand
-            Element* elem = new Element(name, value, oper);
-            operand = elem;
-
-            DEBUGMSG(prefix << "Operand is '" << name << "' " << elem->GetOperatorStr()  << " '" << value << "'");
-        }
+    // Lower the tree into a flat program
+    if(!CompileProgram())
+    {
+        constraintsTree = nullptr;
+        return false;
     }
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
+    // Number the final tree, and drop the statistics of the previous one
+    nodeCount = 0;
+    Number(constraintsTree);
+    profiles.assign(nodeCount, Node::Profile());
+    context.profile.clear();
 
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
-    return operand;
+    adaptiveRows = 0;
+    return true;
 }
 
-bool Constraints::ParseOperandName(const char* constraintsStr, size_t& len, std::string& name)
+void Constraints::Number(Node* node)
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
-
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
+    node->SetId((uint32_t)nodeCount++);
+    if(node->GetType() == Node::GROUP)
+    {
+        for(Node* child : ((Group*)node)->GetChildren())
+        {
+            if(child)
+                Number(child);
+        }
+    }
+}
 
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+void Constraints::MergeProfile(Context& ctx) const
+{
+    std::lock_guard<std::mutex> lock(profileMtx);
+    for(size_t i = 0; i < ctx.profile.size() && i < profiles.size(); i++)
     {
-        err = prefix + "Invalid (empty) constraintsStr";
-        return false;
+        const Node::Profile& prof = ctx.profile[i];
+        profiles[i].Add(prof.evalCount, prof.trueCount, prof.shortCircuitCount, prof.cycles);
     }
+    ctx.profile.clear();
+}
 
-    // Skip trailing whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+Constraints::Node::Profile Constraints::GetProfile(const Node& node) const
+{
+    std::lock_guard<std::mutex> lock(profileMtx);
+    Node::Profile prof = profiles[node.GetId()];
+    if(node.GetId() < context.profile.size())
+    {
+        const Node::Profile& own = context.profile[node.GetId()];
+        prof.Add(own.evalCount, own.trueCount, own.shortCircuitCount, own.cycles);
+    }
+    return prof;
+}
 
-    // Read quated or unquated Name argument (until first =, !, <, > or space)
-    bool isQuated = (*ptr == '"');
-    const char* begin = (isQuated ? ++ptr : ptr);
+void Constraints::Bind(Node* node)
+{
+    Node::Type type = node->GetType();
 
-    while(*ptr != '\0' &&
-          *ptr != '=' && *ptr != '!' && *ptr != '<' && *ptr != '>' &&
-          (isQuated ? *ptr != '"' : isspace(*ptr) == 0))
+    if(type == Node::GROUP)
+    {
+        for(Node* child : ((Group*)node)->GetChildren())
+        {
+            if(child)
+                Bind(child);
+        }
+    }
+    else if(type == Node::ELEMENT)
     {
-        ptr++;
+        Element* elem = (Element*)node;
+        elem->SetFieldId(schema->Bind(elem->GetName()));
+        if(Dictionary* dict = schema->GetDictionary(elem->GetFieldId()))
+            elem->Encode(*dict);
     }
-
-    if(isQuated && *ptr != '"')
+    else if(type == Node::ELEMENT_IN)
     {
-        err = prefix + "Invalid Name argument (no closing quote) in '" + (begin - 1) + "'";
-        return false;
+        ElementIN* elem = (ElementIN*)node;
+        elem->SetFieldId(schema->Bind(elem->GetName()));
+        if(Dictionary* dict = schema->GetDictionary(elem->GetFieldId()))
+            elem->Encode(*dict);
+    }
+    else if(type == Node::ELEMENT_RANGE)
+    {
+        ElementRange* elem = (ElementRange*)node;
+        elem->SetFieldId(schema->Bind(elem->GetName()));
+        if(Dictionary* dict = schema->GetDictionary(elem->GetFieldId()))
+            elem->Encode(*dict);
     }
+}
 
-    if(begin == ptr)
+bool Constraints::CompileProgram()
+{
+    program.clear();
+    if(!Compile(constraintsTree))
     {
-        err = prefix + "Invalid (missing) Name argument in '" + constraintsStr + "'";
+        program.clear();
         return false;
     }
 
-    name.assign(begin, ptr - begin);
-
-    if(isQuated)
-        ptr++;
+    // Thread jumps: a jump that lands on a jump of the same kind will
+    // take that jump too (the accumulator is unchanged), so go directly
+    // to its final destination.
+    for(Instruction& instr : program)
+    {
+        if(instr.code != Instruction::JMPF && instr.code != Instruction::JMPT)
+            continue;
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
+        while(instr.target < program.size() && program[instr.target].code == instr.code)
+            instr.target = program[instr.target].target;
+    }
 
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
     return true;
 }
 
-bool Constraints::ParseOperandValue(const char* constraintsStr, size_t& len,
-        std::string& value, const char* terminators/*=nullptr*/)
+bool Constraints::Compile(const Node* node)
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
-
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
-
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+    if(node == nullptr)
     {
-        err = prefix + "Invalid (empty) constraintsStr";
+        err = "Cannot compile invalid (null) logical node";
         return false;
     }
 
-    // Skip trailing whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
-
-    // Read quated or unquated Value argument
-    bool isQuated = (*ptr == '"');
-    const char* begin = (isQuated ? ++ptr : ptr);
+    Node::Type type = node->GetType();
 
-    // Quated value can have any characters.
-    // Unquated terminates on space or any of terminators characters.
-    if(isQuated)
+    if(type == Node::GROUP)
     {
-        // Parse quated value
-        while(*ptr != '\0' && *ptr != '"')
-            ptr++;
+        // Group is compiled as:
+        //   <child 1>
+        //   JMPF end (AND) or JMPT end (OR)
+        //   ...
+        //   <child N>
+        // end:
+        // The accumulator holds the result of the last evaluated child,
+        // which is the result of the group in both short circuit cases.
+        const Group* group = (const Group*)node;
+        Node::Operator oper = group->GetOperator();
+
+        Instruction::OpCode jump = (oper == Node::AND ? Instruction::JMPF :
+                                    oper == Node::OR  ? Instruction::JMPT : Instruction::NOP);
+        if(jump == Instruction::NOP)
+        {
+            err = "Invalid group operand " + GetOperatorStr(oper) + " in logical expression compilation.";
+            return false;
+        }
 
-        if(*ptr != '"')
+        NodeList children = group->GetChildren();
+        if(children.empty())
         {
-            //err = prefix + "Invalid Value argument (no close quote) in '" + constraintsStr + "'";
-            err = prefix + "Invalid Value argument (no closing quote) in '" + (begin - 1) + "'";
+            err = "Badly formed logical expression";
             return false;
         }
+
+        std::vector<size_t> jumps;
+        for(size_t i = 0; i < children.size(); i++)
+        {
+            if(!Compile(children[i]))
+                return false;
+
+            if(i + 1 < children.size())
+            {
+                jumps.push_back(program.size());
+                program.emplace_back();
+                program.back().code = jump;
+            }
+        }
+
+        for(size_t jumpIndex : jumps)
+            program[jumpIndex].target = (uint32_t)program.size();
     }
-    else
+    else if(type == Node::ELEMENT)
     {
-        // Parse unquated value
-        while(*ptr != '\0' && isspace(*ptr) == 0 &&
-                (terminators == nullptr || strchr(terminators, *ptr) == 0))
+        const Element* elem = (const Element*)node;
+        Node::Operator oper = elem->GetOperator();
+
+        Instruction::OpCode code = (oper == Node::EQ ? Instruction::EQ :
+                                    oper == Node::NE ? Instruction::NE :
+                                    oper == Node::LT ? Instruction::LT :
+                                    oper == Node::LE ? Instruction::LE :
+                                    oper == Node::GT ? Instruction::GT :
+                                    oper == Node::GE ? Instruction::GE : Instruction::NOP);
+        if(code == Instruction::NOP)
         {
-            ptr++;
+            err = "Invalid element operand " + GetOperatorStr(oper) + " in logical expression compilation.";
+            return false;
         }
-    }
 
-    if(begin == ptr)
+        Instruction instr;
+        instr.code = code;
+        instr.field = elem->GetFieldId();
+        instr.name = elem->GetName();
+        instr.value = elem->GetValue();
+        instr.node = elem;
+        program.push_back(std::move(instr));
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        const ElementIN* elem = (const ElementIN*)node;
+
+        Instruction instr;
+        instr.code = (elem->IsNegated() ? Instruction::NOT_IN : Instruction::IN);
+        instr.field = elem->GetFieldId();
+        instr.name = elem->GetName();
+        instr.set = &elem->GetValues();
+        instr.node = elem;
+        program.push_back(std::move(instr));
+    }
+    else if(type == Node::ELEMENT_RANGE)
     {
-        err = prefix + "Invalid (empty) Value argument in '" + constraintsStr + "'";
+        const ElementRange* elem = (const ElementRange*)node;
+
+        Instruction instr;
+        instr.code = Instruction::RANGE;
+        instr.field = elem->GetFieldId();
+        instr.name = elem->GetName();
+        instr.range = &elem->GetRange();
+        instr.node = elem;
+        program.push_back(std::move(instr));
+    }
+    else if(type == Node::CONSTANT)
+    {
+        Instruction instr;
+        instr.code = (((const Constant*)node)->GetValue() ? Instruction::SETT : Instruction::SETF);
+        instr.node = node;
+        program.push_back(std::move(instr));
+    }
+    else
+    {
+        err = "Invalid logical node type " + std::to_string(type) + " in logical expression compilation.";
         return false;
     }
 
-    value.assign(begin, ptr - begin);
-    begin = nullptr;
+    return true;
+}
 
-    if(isQuated)
-        ptr++;
+void Constraints::Reorder()
+{
+    adaptiveRows = 0;
+    if(!constraintsTree)
+        return;
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
+    bool changed = false;
+    Reorder(constraintsTree, changed);
 
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
-    return true;
+    // Program instructions are in the tree order
+    if(changed)
+        CompileProgram();
 }
 
-Constraints::Node::Operator Constraints::ParseOperandOperator(const char* constraintsStr, size_t& len)
+// Puts the children with the lower rank first: for AND, the ones that are
+// cheap and likely to fail (cost / fail rate); for OR, the ones that are
+// cheap and likely to pass (cost / pass rate). Returns estimate of the
+// (reordered) node, assuming that the predicates are independent.
+Constraints::Estimate Constraints::Reorder(Node* node, bool& changed)
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
-
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
+    if(node->GetType() != Node::GROUP)
+    {
+        // Pass rate of the recent rows: the counts are halved once they
+        // exceed a few intervals, so old rows weigh less. The smoothing
+        // keeps rate of a predicate that hasn't been evaluated at 0.5.
+        Node::Stats& stats = node->GetStats();
+        uint64_t evalCount = stats.evalCount.load(std::memory_order_relaxed);
+        uint64_t passCount = stats.passCount.load(std::memory_order_relaxed);
+        double pass = (passCount + 0.5) / (evalCount + 1.0);
+        if(evalCount > 4 * adaptiveInterval)
+        {
+            stats.evalCount.store(evalCount / 2, std::memory_order_relaxed);
+            stats.passCount.store(passCount / 2, std::memory_order_relaxed);
+        }
+        return {GetCost(node), pass};
+    }
 
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+    Group* group = (Group*)node;
+    NodeList children = group->GetChildren();
+    for(const Node* child : children)
     {
-        err = prefix + "Invalid (empty) constraintsStr";
-        return Node::NOOP;
+        if(!child)
+            return {0.0, 0.5};
     }
 
-    // Skip whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+    std::vector<Estimate> estimates;
+    for(Node* child : children)
+        estimates.push_back(Reorder(child, changed));
+    bool isAnd = (group->GetOperator() == Node::AND);
 
-    // Supported operators: ==, !=, <=, >=, <, >
-    Node::Operator oper = Node::NOOP;
+    // Stable sort keeps the order of children of the same rank
+    auto rank = [isAnd](const Estimate& est) { return est.cost / (isAnd ? 1.0 - est.pass : est.pass); };
+    std::vector<size_t> order(children.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return rank(estimates[a]) < rank(estimates[b]); });
 
-    if(*(ptr + 1) == '=')
+    if(!std::is_sorted(order.begin(), order.end()))
     {
-        if(*ptr == '=') // ==
-        {
-            oper = Node::EQ;
-            ptr += 2;
-        }
-        else if(*ptr == '!') // !=
+        std::vector<Node*> sorted;
+        std::vector<Estimate> sortedEstimates;
+        for(size_t i : order)
         {
-            oper = Node::NE;
-            ptr += 2;
-        }
-        else if(*ptr == '<') // <=
-        {
-            oper = Node::LE;
-            ptr += 2;
-        }
-        else if(*ptr == '>') // >=
-        {
-            oper = Node::GE;
-            ptr += 2;
+            sorted.push_back(children[i]);
+            sortedEstimates.push_back(estimates[i]);
         }
+        std::copy(sorted.begin(), sorted.end(), children.begin());     // In place
+        estimates.swap(sortedEstimates);
+        changed = true;
     }
-    else if(*ptr == '<')
+
+    // A child is evaluated unless one of the previous ones short circuits
+    // the group
+    double cost = 0.0;
+    double reach = 1.0;
+    for(const Estimate& est : estimates)
     {
-        oper = Node::LT;
-        ptr++;
+        cost += reach * est.cost;
+        reach *= (isAnd ? est.pass : 1.0 - est.pass);
     }
-    else if(*ptr == '>')
+    return {cost, isAnd ? reach : 1.0 - reach};
+}
+
+// Rough relative cost of a predicate evaluation
+double Constraints::GetCost(const Node* node)
+{
+    if(node->GetType() == Node::ELEMENT_IN)
+        return 2.0; // Hash lookup
+    if(node->GetType() == Node::CONSTANT)
+        return 0.0;
+    if(node->GetType() == Node::ELEMENT_RANGE)
     {
-        oper = Node::GT;
-        ptr++;
+        // Two compares
+        const ValueRange& range = ((const ElementRange*)node)->GetRange();
+        return (range.lo.IsNumber() && range.hi.IsNumber() ? 2.0 : 4.0);
     }
+
+    const Element* elem = (const Element*)node;
+    const Value& value = elem->GetValue();
+    Node::Operator oper = elem->GetOperator();
+
+    // Number compares, and equality of interned strings (code compare)
+    if(value.IsNumber() || (value.IsInterned() && (oper == Node::EQ || oper == Node::NE)))
+        return 1.0;
+    return 2.0; // String compare
+}
+
+//
+// Parser
+//
+// Sets the error at the token position. Returns nullptr for convenience.
+Constraints::Node* Constraints::SetParseError(const Token& token, const char* what)
+{
+    err = std::string(what) + " at position " + std::to_string(token.pos);
+    if(token.type == Token::END)
+        err += " (end of constraints)";
     else
+        err += " near '" + std::string(source.substr(token.pos, 16)) + (token.pos + 16 < source.size() ? "...'" : "'");
+    return nullptr;
+}
+
+void Constraints::SetConstraints(Node* node, size_t begin, size_t end)
+{
+    if(diagnostics)
+        node->SetConstraints(source.substr(begin, end - begin));
+}
+
+Constraints::NodeList Constraints::NewNodeList(Node* const* children, size_t count)
+{
+    Node** nodes = (Node**)arena.Allocate(count * sizeof(Node*), alignof(Node*));
+    std::copy(children, children + count, nodes);
+    return NodeList(nodes, count);
+}
+
+Constraints::Group* Constraints::NewGroup(Node* const* children, size_t count, Node::Operator oper)
+{
+    return arena.New<Group>(NewNodeList(children, count), oper);
+}
+
+// Note: The children array is reused if it is large enough (the optimizer
+// only removes children)
+void Constraints::SetChildren(Group* group, const std::vector<Node*>& children)
+{
+    NodeList current = group->GetChildren();
+    if(children.size() > current.size())
     {
-        //err = prefix + "Invalid Operator in '" + constraintsStr + "'";
-        err = prefix + "Invalid Operator in '" + ptr + "'";
-        return Node::NOOP;
+        group->SetChildren(NewNodeList(children.data(), children.size()));
+        return;
     }
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
-
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
-    return oper;
+    std::copy(children.begin(), children.end(), current.begin());
+    group->SetChildren(NodeList(current.begin(), children.size()));
 }
 
-bool Constraints::BuildValuesForOperatorIN(const char* constraintsStr, size_t& len,
-        const std::string& name, std::string& subConstraints)
+// Precedence climbing: parses operands joined by operators of at least
+// minPrecedence (OR is 1, AND is 2). A run of the same operator is one group.
+Constraints::Node* Constraints::ParseExpression(Tokenizer& tokens, int minPrecedence)
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
+    size_t begin = tokens.Peek().pos;
+    Node* lhs = ParseUnary(tokens);
+    if(!lhs)
+        return nullptr;
 
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
+    // Operands of the current run of the same operator, that becomes a
+    // group (with the children in the arena) once the run ends. They are
+    // pushed on the shared parseOperands stack from base on, above the runs
+    // of the enclosing calls, so no call allocates its own.
+    size_t base = parseOperands.size();
+    parseOperands.push_back(lhs);
+    Node::Operator groupOper = Node::NOOP;
+    size_t end = 0;
+    auto endGroup = [&]()
+    {
+        Group* group = NewGroup(parseOperands.data() + base, parseOperands.size() - base, groupOper);
+        SetConstraints(group, begin, end);
+        parseOperands.resize(base);
+        parseOperands.push_back(group);
+    };
 
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+    for(;;)
     {
-        err = prefix + "Invalid (empty) constraintsStr";
-        return false;
+        Token::Type type = tokens.Peek().type;
+        int precedence = (type == Token::OR ? 1 : type == Token::AND ? 2 : 0);
+        if(precedence == 0 || precedence < minPrecedence)
+            break;
+        tokens.Next();
+
+        Node* rhs = ParseExpression(tokens, precedence + 1);
+        if(!rhs)
+        {
+            parseOperands.resize(base);
+            return nullptr;
+        }
+
+        Node::Operator oper = (type == Token::AND ? Node::AND : Node::OR);
+        if(parseOperands.size() - base > 1 && oper != groupOper)
+            endGroup();
+        groupOper = oper;
+        parseOperands.push_back(rhs);
+        end = tokens.GetEnd();
     }
 
-    // Skip trailing whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+    if(parseOperands.size() - base > 1)
+        endGroup();
+    Node* node = parseOperands[base];
+    parseOperands.resize(base);
+    return node;
+}
 
-    if(*ptr != '(')
+Constraints::Node* Constraints::ParseUnary(Tokenizer& tokens)
+{
+    // Note: The depth is restored on every return, including the errors
+    struct DepthGuard
     {
-        err = prefix + "Misformed IN operator - missing beginning ')'";
-        return false;
-    }
+        int& depth;
+        DepthGuard(int& depthIn) : depth(depthIn) { depth++; }
+        ~DepthGuard() { depth--; }
+    } depthGuard(depth);
+
+    // Bound the recursion (and the stack) for the untrusted input
+    const int MAX_DEPTH = 256;
+    if(depth > MAX_DEPTH)
+        return SetParseError(tokens.Peek(), "Constraints are nested too deeply");
 
-    // Find the end of sub-constraintsStr
-    ptr++;
-    const char* end = strchr(ptr, ')');
-    if(end == nullptr)
+    const Token& token = tokens.Peek();
+
+    if(token.type == Token::NOT)
     {
-        err = prefix + "Misformed IN operator - missing closing ')'";
-        return false;
+        tokens.Next();
+        Node* operand = ParseUnary(tokens);
+        return (operand ? Negate(operand) : nullptr);
     }
-    else if(ptr == end)
+
+    if(token.type == Token::LPAREN)
     {
-        err = prefix + "Misformed (empty) IN operator";
-        return false;
+        tokens.Next();
+        if(tokens.Peek().type == Token::RPAREN)
+            return SetParseError(tokens.Peek(), "Empty sub-constraints");
+
+        Node* node = ParseExpression(tokens, 1);
+        if(!node)
+            return nullptr;
+
+        if(tokens.Peek().type != Token::RPAREN)
+            return SetParseError(tokens.Peek(), "Missing closing ')'");
+        tokens.Next();
+        return node;
     }
 
-    size_t parsedLen = 0;
-    std::string value;
+    return ParsePredicate(tokens);
+}
 
-    while(ptr < end)
+Constraints::Node* Constraints::ParsePredicate(Tokenizer& tokens)
+{
+    // Name (in the parsed string, that is kept in the arena)
+    Token name = tokens.Peek();
+    if(name.type == Token::INVALID && name.size > 0 && source[name.pos] == '"')
+        return SetParseError(name, "Missing closing quote");
+    if(name.type != Token::WORD && name.type != Token::STRING)
+        return SetParseError(name, "Expected a field name");
+    if(name.text.empty())
+        return SetParseError(name, "Empty field name");
+    tokens.Next();
+
+    Node* node = nullptr;
+    bool negate = false;
+    if(tokens.Peek().type == Token::NOT)
     {
-        // Stop reading unquated value on comma or ')'
-        if(!ParseOperandValue(ptr, parsedLen, value, ",)"))
-            return false; // Error is reported by above ParseOperandValue() call
-
-        ptr += parsedLen;
-        subConstraints += ('"' + name + "\" == \"" + value + '"');
+        // name NOT IN (...)
+        negate = true;
+        tokens.Next();
+        if(tokens.Peek().type != Token::IN)
+            return SetParseError(tokens.Peek(), "Expected IN after NOT");
+    }
 
-        // We should point to either comma or ')'
-        if(*ptr == ',')
-        {
-            subConstraints += " OR ";
-        }
-        else if(*ptr != ')')
+    Token oper = tokens.Next();
+    if(oper.type == Token::IN)
+    {
+        if(tokens.Peek().type != Token::LPAREN)
+            return SetParseError(tokens.Peek(), "Expected '(' after IN");
+        tokens.Next();
+
+        ElementIN* elem = arena.New<ElementIN>(name.text);
+        if(negate)
+            elem->SetOperator(Node::NOT_IN);
+        for(;;)
         {
-            err = prefix + "Misformed IN operator around '" + (ptr - parsedLen) + "'";
-            return false;
+            Token value = tokens.Peek();
+            if(value.type == Token::RPAREN && elem->GetValues().GetSize() == 0)
+                return SetParseError(value, "Empty IN list");
+            if(value.type == Token::INVALID && value.size > 0 && source[value.pos] == '"')
+                return SetParseError(value, "Missing closing quote");
+            if(!value.IsValue())
+                return SetParseError(value, "Expected a value of the IN list");
+            tokens.Next();
+            elem->AddValue(value.text);
+
+            Token separator = tokens.Next();
+            if(separator.type == Token::RPAREN)
+                break;
+            if(separator.type != Token::COMMA)
+                return SetParseError(separator, "Expected ',' or ')' in the IN list");
         }
-
-        ptr++;
+        node = elem;
+    }
+    else if(oper.type == Token::COMPARE)
+    {
+        Token value = tokens.Peek();
+        if(value.type == Token::INVALID && value.size > 0 && source[value.pos] == '"')
+            return SetParseError(value, "Missing closing quote");
+        if(!value.IsValue() || (value.type == Token::WORD && value.text.empty()))
+            return SetParseError(value, "Expected a value");
+        tokens.Next();
+
+        Value operand;
+        operand.Assign(value.text);
+        node = arena.New<Element>(name.text, operand, oper.oper);
+    }
+    else
+    {
+        return SetParseError(oper, "Expected a comparison operator or IN");
     }
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
-
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
-    return true;
+    SetConstraints(node, name.pos, tokens.GetEnd());
+    return node;
 }
 
-Constraints::Node::Operator Constraints::ParseLogicalOperator(const char* constraintsStr, size_t& len)
+// Pushes NOT down to the predicates (De Morgan's laws), so the tree stays
+// AND/OR of predicates. Comparisons are negated by the complementary
+// operator (values are totally ordered), and IN and NOT IN swap.
+Constraints::Node* Constraints::Negate(Node* node)
 {
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
-
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStr ? constraintsStr : "null") << "'");
+    Node::Type type = node->GetType();
 
-    if(constraintsStr == nullptr || *constraintsStr == '\0')
+    if(type == Node::GROUP)
     {
-        err = prefix + "Invalid (empty) constraintsStr";
-        return Node::NOOP;
+        Group* group = (Group*)node;
+        group->SetOperator(group->GetOperator() == Node::AND ? Node::OR : Node::AND);
+        for(Node*& child : group->GetChildren())
+            child = Negate(child);
+        SetGroupConstraints(group);
+    }
+    else if(type == Node::ELEMENT)
+    {
+        Element* elem = (Element*)node;
+        Node::Operator oper = elem->GetOperator();
+        elem->SetOperator(oper == Node::EQ ? Node::NE : oper == Node::NE ? Node::EQ :
+                          oper == Node::LT ? Node::GE : oper == Node::GE ? Node::LT :
+                          oper == Node::GT ? Node::LE : Node::GT);
+        if(diagnostics)
+            elem->SetConstraints(arena.CopyString(GetCanonical(elem)));
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        ElementIN* elem = (ElementIN*)node;
+        elem->SetOperator(elem->IsNegated() ? Node::IN : Node::NOT_IN);
+        if(diagnostics)
+            elem->SetConstraints(arena.CopyString(GetCanonical(elem)));
     }
 
-    // Skip whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+    return node;
+}
 
-    // Supported operators: AND, OR
-    Node::Operator oper = Node::NOOP;
+std::ostream& Constraints::Dump(std::ostream& os, const Node* node, int level) const
+{
+    if(node == nullptr)
+        return os;
+
+    if(level == 0)
+        os << __func__ << ": Constraints: '" << constraintsStrIn << "'" << std::endl;
+
+    level++;
+    os << __func__ << "[" << level << "]: " << node << ' ' << std::string((level-1) * 3, '.');
+
+    Node::Type type = node->GetType();
+
+    if(type == Node::GROUP)
+    {
+        const Group* group = (const Group*)node;
+        DumpProfile(group->Dump(os), *node) << std::endl;
 
-    if(strncasecmp(ptr, "AND", 3) == 0 && (isspace(ptr[3]) || ptr[3] == '\0'))
+        // Recurse on the children
+        for(const Node* child : group->GetChildren())
+            Dump(os, child, level);
+    }
+    else if(type == Node::ELEMENT)
+    {
+        const Element* elem = (const Element*)node;
+        DumpProfile(elem->Dump(os), *node) << std::endl;
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        const ElementIN* elem = (const ElementIN*)node;
+        DumpProfile(elem->Dump(os), *node) << std::endl;
+    }
+    else if(type == Node::ELEMENT_RANGE)
     {
-        ptr += 3;
-        oper = Node::AND;
-        DEBUGMSG(prefix << "Operator is 'AND'");
+        const ElementRange* elem = (const ElementRange*)node;
+        DumpProfile(elem->Dump(os), *node) << std::endl;
     }
-    else if(strncasecmp(ptr, "OR", 2) == 0 && (isspace(ptr[2]) || ptr[2] == '\0'))
+    else if(type == Node::CONSTANT)
     {
-        ptr += 2;
-        oper = Node::OR;
-        DEBUGMSG(prefix << "Operator is 'OR'");
+        const Constant* constant = (const Constant*)node;
+        DumpProfile(constant->Dump(os), *node) << std::endl;
     }
     else
     {
-        //err = prefix + "Invalid Operator in '" + constraintsStr + "'";
-        err = prefix + "Invalid Operator in '" + ptr + "'";
-        return Node::NOOP;
+        os << "Invalid logical node (type " << type << ')' << std::endl;
     }
 
-    // Skip remaining whitespaces
-    while(isspace(*ptr))
-        ptr++;
-
-    // Set size of parsed constraintsStr
-    len = (ptr - constraintsStr);
-    return oper;
+    return os;
 }
 
-Constraints::Node* Constraints::Parse(const char* constraintsStr, std::unique_ptr<Node>& node)
+// Profiling statistics of the node (if the profiling is enabled)
+std::ostream& Constraints::DumpProfile(std::ostream& os, const Node& node) const
 {
-    depth++;
-    std::string prefix = std::string(__func__) + "[" + std::to_string(depth) + "]: ";
+    if(!profile)
+        return os;
 
-    DEBUGMSG(prefix << "Constraints is '" << (constraintsStrStr ? constraintsStrStr : "null") << "'");
+    Node::Profile prof = GetProfile(node);
+    uint64_t evalCount = prof.evalCount;
+    uint64_t trueCount = prof.trueCount;
+    uint64_t cycles = prof.cycles;
+
+    os << " [evals=" << evalCount << " true=" << trueCount << " false=" << evalCount - trueCount;
+    if(node.GetType() == Node::GROUP)
+        os << " short=" << prof.shortCircuitCount;
+    os << " cycles=" << cycles;
+    if(evalCount > 0)
+        os << " (" << cycles / evalCount << "/eval)";
+    return os << "]";
+}
 
-    if(constraintsStr == nullptr)
+// Writes str as a JSON string literal
+static std::ostream& DumpJsonString(std::ostream& os, std::string_view str)
+{
+    static const char* hex = "0123456789abcdef";
+
+    os << '"';
+    for(char c : str)
     {
-        err = "Invalid (empty) constraintsStr";
-        return nullptr;
+        if(c == '"' || c == '\\')
+            os << '\\' << c;
+        else if((unsigned char)c < 0x20)
+            os << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+        else
+            os << c;
     }
+    return os << '"';
+}
+
+std::ostream& Constraints::DumpJson(std::ostream& os) const
+{
+    os << "{\"constraints\":";
+    DumpJsonString(os, constraintsStrIn) << ",\"profile\":" << (profile ? "true" : "false") << ",\"root\":";
+    if(constraintsTree)
+        DumpJson(os, constraintsTree);
+    else
+        os << "null";
+    return os << "}" << std::endl;
+}
 
-    // Skip whitespaces
-    const char* ptr = constraintsStr;
-    while(isspace(*ptr))
-        ptr++;
+std::ostream& Constraints::DumpJson(std::ostream& os, const Node* node) const
+{
+    auto dumpValue = [&](const Value& value) -> std::ostream&
+    {
+        if(value.IsNumber())
+            return os << value;
+        return DumpJsonString(os, value.GetString());
+    };
 
-    // Do we have first operand?
-    std::unique_ptr<Node> operand1;
-    size_t len = 0;
+    Node::Type type = node->GetType();
+    os << "{\"type\":\"" << (type == Node::GROUP         ? "group"   :
+                             type == Node::ELEMENT       ? "element" :
+                             type == Node::ELEMENT_IN    ? "in"      :
+                             type == Node::ELEMENT_RANGE ? "range"   :
+                             type == Node::CONSTANT      ? "constant" : "unknown") << "\"";
 
-    if(node.get() != nullptr)
+    if(type == Node::GROUP)
     {
-        operand1 = std::move(node);
+        os << ",\"operator\":\"" << GetOperatorStr(node->GetOperator()) << "\"";
     }
-    else if(*ptr != '\0')
+    else if(type == Node::ELEMENT)
     {
-        // Parse first operand. It could be singe operand or sub-constraintsStr.
-        operand1.reset(ParseOperand(ptr, len));
-        if(operand1.get() == nullptr)
-        {
-            err.insert(0, prefix + "Failed to parse first operand, ");
-            return nullptr;
-        }
-        operand1->SetConstraints(ptr, len);
-        ptr += len;
+        const Element* elem = (const Element*)node;
+        os << ",\"field\":";
+        DumpJsonString(os, elem->GetName()) << ",\"operator\":\"" << GetOperatorStr(elem->GetOperator()) << "\",\"value\":";
+        dumpValue(elem->GetValue());
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        const ElementIN* elem = (const ElementIN*)node;
+        os << ",\"field\":";
+        DumpJsonString(os, elem->GetName()) << ",\"operator\":\"" << GetOperatorStr(elem->GetOperator())
+                                            << "\",\"values\":" << elem->GetValues().GetSize();
+    }
+    else if(type == Node::ELEMENT_RANGE)
+    {
+        const ElementRange* elem = (const ElementRange*)node;
+        const ValueRange& range = elem->GetRange();
+        os << ",\"field\":";
+        DumpJsonString(os, elem->GetName()) << ",\"lo\":";
+        dumpValue(range.lo) << ",\"lo_inclusive\":" << (range.loInclusive ? "true" : "false") << ",\"hi\":";
+        dumpValue(range.hi) << ",\"hi_inclusive\":" << (range.hiInclusive ? "true" : "false");
+    }
+    else if(type == Node::CONSTANT)
+    {
+        os << ",\"value\":" << (((const Constant*)node)->GetValue() ? "true" : "false");
     }
 
-    // Do we have more constraintsStr to parse?
-    Node* root = nullptr;
+    if(!node->GetConstraints().empty())
+    {
+        os << ",\"constraints\":";
+        DumpJsonString(os, node->GetConstraints());
+    }
 
-    if(*ptr == '\0')
+    if(profile)
     {
-        // We are done
-        root = operand1.release();
+        Node::Profile prof = GetProfile(*node);
+        uint64_t evalCount = prof.evalCount;
+        uint64_t trueCount = prof.trueCount;
+        os << ",\"evals\":" << evalCount << ",\"true\":" << trueCount << ",\"false\":" << evalCount - trueCount
+           << ",\"short_circuits\":" << prof.shortCircuitCount << ",\"cycles\":" << prof.cycles;
     }
-    else
+
+    if(type == Node::GROUP)
     {
-        // Parse AND or OR operator
-        Node::Operator oper = ParseLogicalOperator(ptr, len);
-        if(oper == Node::NOOP)
+        os << ",\"children\":[";
+        NodeList children = ((const Group*)node)->GetChildren();
+        for(size_t i = 0; i < children.size(); i++)
         {
-            err.insert(0, prefix + "Failed to parse operator, ");
-            return nullptr;
+            if(i > 0)
+                os << ",";
+            DumpJson(os, children[i]);
         }
-        ptr += len;
+        os << "]";
+    }
 
-        // Parse second operand. It could be single operand or sub-constraintsStr.
-        Node* operand2 = ParseOperand(ptr, len);
-        if(operand2 == nullptr)
-        {
-            err.insert(0, prefix + "Failed to parse operand, ");
-            return nullptr;
-        }
-        operand2->SetConstraints(ptr, len);
-        ptr += len;
+    return os << "}";
+}
+
+std::ostream& Constraints::DumpProgram(std::ostream& os) const
+{
+    static const char* opCodeStr[] = { "NOP", "EQ", "NE", "LT", "LE", "GT", "GE", "IN", "NOT_IN", "RANGE", "JMPF", "JMPT", "SETF", "SETT" };
 
-        Group* group = new Group(operand1.release(), operand2, oper);
+    os << __func__ << ": " << program.size() << " instruction(s)" << std::endl;
 
-        std::unique_ptr<Node> newNode(group);
-        root = Parse(ptr, newNode);
+    for(size_t i = 0; i < program.size(); i++)
+    {
+        const Instruction& instr = program[i];
+        os << __func__ << "[" << i << "]: " << opCodeStr[(int)instr.code];
+
+        if(instr.code == Instruction::JMPF || instr.code == Instruction::JMPT)
+            os << " " << instr.target;
+        else if(instr.code == Instruction::SETF || instr.code == Instruction::SETT)
+            ; // No operands
+        else if(instr.code == Instruction::IN || instr.code == Instruction::NOT_IN)
+            os << " '" << instr.name << "'" << (instr.field == INVALID_FIELD_ID ? "" : "#" + std::to_string(instr.field))
+               << " (" << instr.set->GetSize() << " values)";
+        else if(instr.code == Instruction::RANGE)
+            os << " '" << instr.name << "'" << (instr.field == INVALID_FIELD_ID ? "" : "#" + std::to_string(instr.field))
+               << (instr.range->loInclusive ? " [" : " (") << instr.range->lo << ", " << instr.range->hi
+               << (instr.range->hiInclusive ? "]" : ")");
+        else
+            os << " '" << instr.name << "'" << (instr.field == INVALID_FIELD_ID ? "" : "#" + std::to_string(instr.field))
+               << " " << instr.value;
+
+        os << std::endl;
     }
 
-    // We are done
-    DEBUGMSG(prefix << "Parsing complete");
-    depth--;
-    return root;
+    return os;
 }
 
-std::ostream& Constraints::Dump(std::ostream& os, const Node* node)
+std::string Constraints::GetCanonical(const Node* node)
 {
-    if(node == nullptr)
-        return os;
-
-    if(node == constraintsTree.get())
+    auto valueStr = [](const Value& value)
     {
-        depth = 0;
-        os << __func__ << ": Constraints: '" << constraintsStrIn << "'" << std::endl;
-    }
+        std::string str;
+        if(value.IsNumber())
+        {
+            value.Format(str);
+            return str;
+        }
 
-    depth++;
-    os << __func__ << "[" << depth << "]: " << node << ' ' << std::string((depth-1) * 3, '.');
+        str = "\"";
+        for(char c : value.GetString())
+        {
+            if(c == '"' || c == '\\')
+                str += '\\';
+            str += c;
+        }
+        return str + '"';
+    };
 
     Node::Type type = node->GetType();
 
     if(type == Node::GROUP)
     {
-        Group* group = (Group*)node;
-        group->Dump(os) << std::endl;
+        // Operands of the nested groups of the same (associative) operator
+        Node::Operator oper = node->GetOperator();
+        std::vector<std::string> operands;
+        std::vector<const Node*> stack{node};
+
+        while(!stack.empty())
+        {
+            const Node* next = stack.back();
+            stack.pop_back();
+
+            if(next && next->GetType() == Node::GROUP && next->GetOperator() == oper)
+            {
+                for(const Node* child : ((const Group*)next)->GetChildren())
+                    stack.push_back(child);
+            }
+            else
+            {
+                operands.push_back(next ? GetCanonical(next) : std::string());
+            }
+        }
 
-        // Recurse on the first child
-        Dump(os, group->GetLChild());
+        // AND/OR are commutative
+        std::sort(operands.begin(), operands.end());
 
-        // Recurse on the second child
-        Dump(os, group->GetRChild());
+        std::string str = GetOperatorStr(oper) + "(";
+        for(size_t i = 0; i < operands.size(); i++)
+            str += (i > 0 ? "," : "") + operands[i];
+        return str + ")";
     }
     else if(type == Node::ELEMENT)
     {
-        Element* elem = (Element*)node;
-        elem->Dump(os) << std::endl;
+        const Element* elem = (const Element*)node;
+        return std::string(elem->GetName()) + GetOperatorStr(elem->GetOperator()) + valueStr(elem->GetValue());
     }
-    else
+    else if(type == Node::ELEMENT_IN)
     {
-        os << "Invalid logical node (type " << type << ')' << std::endl;
+        const ElementIN* elem = (const ElementIN*)node;
+        std::vector<std::string> values;
+        elem->GetValues().ForEach([&](const Value& value) { values.push_back(valueStr(value)); });
+        std::sort(values.begin(), values.end());
+
+        std::string str = std::string(elem->GetName()) + (elem->IsNegated() ? " NOT IN(" : " IN(");
+        for(size_t i = 0; i < values.size(); i++)
+            str += (i > 0 ? "," : "") + values[i];
+        return str + ")";
+    }
+    else if(type == Node::ELEMENT_RANGE)
+    {
+        const ElementRange* elem = (const ElementRange*)node;
+        const ValueRange& range = elem->GetRange();
+        return valueStr(range.lo) + (range.loInclusive ? "<=" : "<") + std::string(elem->GetName()) +
+               (range.hiInclusive ? "<=" : "<") + valueStr(range.hi);
+    }
+    else if(type == Node::CONSTANT)
+    {
+        return (((const Constant*)node)->GetValue() ? "TRUE" : "FALSE");
     }
 
-    depth--;
-    return os;
+    return "UNKNOWN";
 }
 
 const std::string& Constraints::GetOperatorStr(Node::Operator operIn)
@@ -583,6 +1090,9 @@ const std::string& Constraints::GetOperatorStr(Node::Operator operIn)
                operIn == Node::GE        ? ">="        :
                operIn == Node::AND       ? "AND"       :
                operIn == Node::OR        ? "OR"        :
+               operIn == Node::IN        ? "IN"        :
+               operIn == Node::RANGE     ? "RANGE"     :
+               operIn == Node::NOT_IN    ? "NOT IN"    :
             /* operIn == Node::ISNOTNULL ? "ISNOTNULL" : */
             /* operIn == Node::ISNULL    ? "ISNULL"    : */ "UNKNOWN (" + std::to_string(operIn) + ")");
 
@@ -4,67 +4,39 @@
 #ifndef __CONSTRAINTS_H__
 #define __CONSTRAINTS_H__
 
+#include <atomic>
+#include <chrono>           // std::chrono::steady_clock
 #include <iostream>         // std::cout
-#include <memory>           // std::unique_ptr
+#include <mutex>
 #include <string>
-#include <variant>
-
-//
-// Class Value
-//
-class Value
-{
-public:
-    Value(const std::string& valueStr) { *this = valueStr; }
-    Value() = default;
-    ~Value() = default;
-
-    Value& operator=(const std::string& valueStr)
-    {
-        // If the _value is numeric, then treat is a number
-        bool isNumeric = false;
-        for(const char c : valueStr)
-        {
-            if(!(isNumeric = isdigit(c)))
-                break;
-        }
-
-        if(isNumeric)
-            value = std::stoi(valueStr);
-        else
-            value = valueStr;
-
-        return *this;
-    }
-
-    bool operator==(const Value& valueIn) const { return value == valueIn.value; }
-    bool operator!=(const Value& valueIn) const { return value != valueIn.value; }
-    bool operator<(const Value& valueIn) const { return value < valueIn.value; }
-    bool operator<=(const Value& valueIn) const { return value <= valueIn.value; }
-    bool operator>(const Value& valueIn) const { return value > valueIn.value; }
-    bool operator>=(const Value& valueIn) const { return value >= valueIn.value; }
-
-    // Diagnostic
-    bool IsString() const { return std::holds_alternative<std::string>(value); }
-
-    std::ostream& Dump(std::ostream& os) const
-    {
-        if(IsString())
-            return os << "'" << std::get<std::string>(value) << "'";
-        else
-            return os << std::get<int>(value);
-    }
-
-private:
-    std::variant<std::string, int> value;
-
-    friend std::ostream& operator<<(std::ostream& os, const Value& val);
-};
-
-inline std::ostream& operator<<(std::ostream& os, const Value& val) { return val.Dump(os); }
+#include <string_view>
+#include <vector>
+#include <utility>          // std::move
+#include <stdint.h>         // uint32_t, int64_t
+#include "value.h"
+#include "record.h"
+#include "arena.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>      // __rdtsc
+#endif
+
+class ColumnBatch;
+struct Column;
+class Selection;
+class Index;
+class RowBitmap;
 
 //
 // Class Constraints
+// Note: All nodes of the parsed tree and their strings are allocated
+// from the Constraints arena, and released at once on re-parse or
+// destruction.
+//
+// Note: Evaluation with a Context doesn't modify the Constraints, so once
+// parsed, they can be evaluated by many threads at once, each thread with
+// its own Context. Evaluation without a Context uses the Constraints own
+// one, as well as the adaptive mode reordering, so it is single threaded.
 //
 class Constraints
 {
@@ -73,7 +45,7 @@ class Constraints
     public:
         enum Type : char
         {
-            UNKNOWN=0, NODE, ELEMENT, GROUP
+            UNKNOWN=0, NODE, ELEMENT, ELEMENT_IN, ELEMENT_RANGE, GROUP, CONSTANT
         };
 
         enum Operator : char
@@ -88,7 +60,10 @@ class Constraints
             ISNOTNULL, // TODO
             ISNULL,    // TODO
             AND,       // AND
-            OR         // OR
+            OR,        // OR
+            IN,        // IN (aaa, bbb, ccc)
+            RANGE,     // lo < (<=) value < (<=) hi (merged by the optimizer)
+            NOT_IN     // NOT IN (aaa, bbb, ccc)
         };
 
         Node(Type typeIn, Node::Operator operIn) : type(typeIn), oper(operIn) {}
@@ -96,138 +71,619 @@ class Constraints
 
         Type GetType() const { return type; }
         Operator GetOperator() const { return oper; }
+        void SetOperator(Operator operIn) { oper = operIn; }
+
+        // Diagnostic (empty if diagnostics are disabled)
+        std::string_view GetConstraints() const { return constraintsStr; }
+        void SetConstraints(std::string_view str) { constraintsStr = str; }
+
+        // Adaptive mode statistics (predicate nodes only)
+        // Note: Counters are exact (relaxed atomic increments), but threads
+        // evaluating shared constraints at once contend for their cache
+        // line. The parallel scan gives every worker its own constraints
+        // in the adaptive mode, so they are not shared then.
+        struct Stats
+        {
+            std::atomic<uint64_t> evalCount{0};
+            std::atomic<uint64_t> passCount{0};
+        };
 
-        // Diagnostic
-        const std::string& GetConstraints() const { return constraintsStr; }
-        virtual void SetConstraints(const char* ptr, size_t size) { /*For child to override*/ }
+        const Stats& GetStats() const { return stats; }
+        Stats& GetStats() { return stats; }
+        void AddStats(uint64_t evalCount, uint64_t passCount) const
+        {
+            stats.evalCount.fetch_add(evalCount, std::memory_order_relaxed);
+            stats.passCount.fetch_add(passCount, std::memory_order_relaxed);
+        }
+
+        // Profiling statistics (all nodes, see SetProfile). They are
+        // recorded per thread in the Context, by the node id.
+        struct Profile
+        {
+            uint64_t evalCount{0};
+            uint64_t trueCount{0};
+            uint64_t shortCircuitCount{0}; // Group returned before its last child
+            uint64_t cycles{0};            // Including the children
+
+            void Add(uint64_t evalCountIn, uint64_t trueCountIn, uint64_t shortCircuitCountIn, uint64_t cyclesIn)
+            {
+                evalCount += evalCountIn;
+                trueCount += trueCountIn;
+                shortCircuitCount += shortCircuitCountIn;
+                cycles += cyclesIn;
+            }
+        };
+
+        // Index of the node in the parsed tree (see Constraints::Number)
+        uint32_t GetId() const { return id; }
+        void SetId(uint32_t idIn) { id = idIn; }
 
     protected:
         Type type{UNKNOWN};
         Operator oper{NOOP};
-        std::string constraintsStr; // Only used for Diagnostic
+        std::string_view constraintsStr; // Only used for Diagnostic (in arena)
+        uint32_t id{0};
+        mutable Stats stats;
     };
     // End of class Node
 
+    // Children of a group: an array in the arena (the optimizer knows the
+    // final size, so a group doesn't need a growable heap vector)
+    class NodeList
+    {
+    public:
+        NodeList() = default;
+        NodeList(Node** nodesIn, size_t sizeIn) : nodes(nodesIn), count(sizeIn) {}
+
+        Node** begin() const { return nodes; }
+        Node** end() const { return nodes + count; }
+        Node*& operator[](size_t i) const { return nodes[i]; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+    private:
+        Node** nodes{nullptr};
+        size_t count{0};
+    };
+
     class Element : public Node
     {
     public:
-        Element(const std::string& nameIn, const std::string& valueIn, Node::Operator operIn)
+        Element(std::string_view nameIn, const Value& valueIn, Node::Operator operIn)
             : Node(ELEMENT, operIn), name(nameIn), value(valueIn) { refCount++; }
         virtual ~Element() { refCount--; }
 
-        const std::string& GetName() const { return name; }
+        std::string_view GetName() const { return name; }
         const Value& GetValue() const { return value; }
 
-        // Diagnostic
-        inline static int refCount{0};
-        static int GetRefCount() { return refCount; }
-
-        virtual void SetConstraints(const char* ptr, size_t size) override
+        // Interns a string value, so it compares to the encoded
+        // field values by the dictionary code
+        void Encode(Dictionary& dict)
         {
-            constraintsStr = '{' + std::string(ptr, size) + '}';
+            if(value.IsString())
+                value = Value(dict.InternString(value.GetString()));
         }
 
-        std::ostream& Dump(std::ostream& os)
+        // Field id in the Schema the constraints are bound to
+        FieldId GetFieldId() const { return fieldId; }
+        void SetFieldId(FieldId id) { fieldId = id; }
+
+        // Diagnostic
+        inline static std::atomic<int> refCount{0};
+        static int GetRefCount() { return refCount; }
+
+        std::ostream& Dump(std::ostream& os) const
         {
             return os << "Element: '" << name << "' " << GetOperatorStr(GetOperator()) << " " << value << " " << GetConstraints();
         }
 
     private:
-        std::string name;
+        std::string_view name;  // In arena
         Value value;
+        FieldId fieldId{INVALID_FIELD_ID};
     };
     // End of class Element
 
-    class Group : public Node
+    // Element for operator IN (or NOT IN): tests membership of the field
+    // value in a prebuilt set, so the field is looked up only once per test.
+    class ElementIN : public Node
     {
     public:
-        Group(Node* lChildIn, Node* rChildIn, Node::Operator operIn)
-            : Node(GROUP, operIn), lChild(lChildIn), rChild(rChildIn)
+        ElementIN(std::string_view nameIn) : Node(ELEMENT_IN, IN), name(nameIn) { refCount++; }
+        virtual ~ElementIN() { refCount--; }
+
+        std::string_view GetName() const { return name; }
+        const ValueSet& GetValues() const { return values; }
+        void AddValue(std::string_view valueStr) { values.Insert(Value().Assign(valueStr)); }
+        bool IsNegated() const { return GetOperator() == NOT_IN; }
+        void Encode(Dictionary& dict) { values.Encode(dict); }
+
+        // Field id in the Schema the constraints are bound to
+        FieldId GetFieldId() const { return fieldId; }
+        void SetFieldId(FieldId id) { fieldId = id; }
+
+        // Diagnostic
+        inline static std::atomic<int> refCount{0};
+        static int GetRefCount() { return refCount; }
+
+        std::ostream& Dump(std::ostream& os) const
         {
-            refCount++;
-            constraintsStr = '[' + lChild->GetConstraints() + ' ' + GetOperatorStr(GetOperator()) + ' ' + rChild->GetConstraints() + ']';
+            return os << "ElementIN: '" << name << "' " << GetOperatorStr(GetOperator()) << " ("
+                      << values.GetSize() << " values) " << GetConstraints();
         }
+
+    private:
+        std::string_view name;  // In arena
+        ValueSet values;
+        FieldId fieldId{INVALID_FIELD_ID};
+    };
+    // End of class ElementIN
+
+    // Element for a range of values: the optimizer merges range
+    // predicates on the same field into a single interval test.
+    class ElementRange : public Node
+    {
+    public:
+        ElementRange(std::string_view nameIn, const ValueRange& rangeIn)
+            : Node(ELEMENT_RANGE, RANGE), name(nameIn), range(rangeIn) { refCount++; }
+        virtual ~ElementRange() { refCount--; }
+
+        std::string_view GetName() const { return name; }
+        const ValueRange& GetRange() const { return range; }
+        void Encode(Dictionary& dict) { range.Encode(dict); }
+
+        // Field id in the Schema the constraints are bound to
+        FieldId GetFieldId() const { return fieldId; }
+        void SetFieldId(FieldId id) { fieldId = id; }
+
+        // Diagnostic
+        inline static std::atomic<int> refCount{0};
+        static int GetRefCount() { return refCount; }
+
+        std::ostream& Dump(std::ostream& os) const
+        {
+            return os << "ElementRange: " << range.lo << (range.loInclusive ? " <= '" : " < '") << name
+                      << (range.hiInclusive ? "' <= " : "' < ") << range.hi << " " << GetConstraints();
+        }
+
+    private:
+        std::string_view name;  // In arena
+        ValueRange range;
+        FieldId fieldId{INVALID_FIELD_ID};
+    };
+    // End of class ElementRange
+
+    // AND/OR of any number of children. The parser builds a group for every
+    // run of the same operator, and the optimizer flattens nested groups of
+    // the same operator.
+    class Group : public Node
+    {
+    public:
+        // Children array must be allocated in the arena (see NewGroup)
+        Group(NodeList childrenIn, Node::Operator operIn)
+            : Node(GROUP, operIn), children(childrenIn) { refCount++; }
         virtual ~Group() { refCount--; }
 
-        const Node* GetLChild() const { return lChild.get(); }
-        const Node* GetRChild() const { return rChild.get(); }
+        // AND/OR are commutative, so children can be evaluated in any order
+        NodeList GetChildren() const { return children; }
+        void SetChildren(NodeList childrenIn) { children = childrenIn; }
 
         // Diagnostic
-        inline static int refCount{0};
+        inline static std::atomic<int> refCount{0};
         static int GetRefCount() { return refCount; }
 
-        std::ostream& Dump(std::ostream& os)
+        std::ostream& Dump(std::ostream& os) const
         {
             return os << "Group " << GetOperatorStr(GetOperator()) << ": " << GetConstraints();
         }
 
     private:
-        std::unique_ptr<Node> lChild;
-        std::unique_ptr<Node> rChild;
+        NodeList children;              // In arena
     };
     // End of class Group
 
+    // Constraints folded by the optimizer into a constant result
+    class Constant : public Node
+    {
+    public:
+        Constant(bool valueIn) : Node(CONSTANT, NOOP), value(valueIn) { refCount++; }
+        virtual ~Constant() { refCount--; }
+
+        bool GetValue() const { return value; }
+
+        // Diagnostic
+        inline static std::atomic<int> refCount{0};
+        static int GetRefCount() { return refCount; }
+
+        std::ostream& Dump(std::ostream& os) const
+        {
+            return os << "Constant: " << (value ? "TRUE" : "FALSE") << " " << GetConstraints();
+        }
+
+    private:
+        bool value{false};
+    };
+    // End of class Constant
+
+    // Instruction of the compiled (flat) constraints program.
+    // The program is evaluated with a single boolean accumulator:
+    // predicate instructions set the accumulator, and jump instructions
+    // implement AND/OR short circuit by skipping the rest of a group.
+    struct Instruction
+    {
+        enum OpCode : char
+        {
+            NOP=0,
+            EQ,        // acc = (value == operand)
+            NE,        // acc = (value != operand)
+            LT,        // acc = (value < operand)
+            LE,        // acc = (value <= operand)
+            GT,        // acc = (value > operand)
+            GE,        // acc = (value >= operand)
+            IN,        // acc = (value is in set)
+            NOT_IN,    // acc = (value is not in set)
+            RANGE,     // acc = (value is in range)
+            JMPF,      // if(!acc) goto target (AND short circuit)
+            JMPT,      // if(acc) goto target (OR short circuit)
+            SETF,      // acc = false (constant)
+            SETT       // acc = true (constant)
+        };
+
+        OpCode code{NOP};
+        uint32_t target{0}; // Jump target (JMPF/JMPT only)
+        FieldId field{INVALID_FIELD_ID}; // Predicate operand field id
+        std::string_view name; // Predicate operand name (owned by the tree)
+        Value value;        // Predicate operand value
+        const ValueSet* set{nullptr}; // Set operand (IN and NOT_IN only, owned by the tree)
+        const ValueRange* range{nullptr}; // Range operand (RANGE only, owned by the tree)
+        const Node* node{nullptr};  // Predicate node (adaptive statistics)
+    };
+    // End of struct Instruction
+
 public:
+    // Evaluation strategy. The compiled program is the default; the
+    // tree walker is kept for diagnostic and benchmarking purposes.
+    enum EvalMode : char
+    {
+        EVAL_PROGRAM=0, EVAL_TREE
+    };
+
+    // Per thread evaluation state: the error of a failed evaluation and
+    // the batch evaluation scratch space (reused across batches)
+    class Context
+    {
+    public:
+        Context() = default;
+        ~Context() = default;
+
+        const std::string& GetError() const { return err; }
+
+    private:
+        friend class Constraints;
+
+        std::string err;
+        std::vector<std::vector<uint64_t>> batchMasks; // One mask per tree level
+        std::vector<uint8_t> batchLookup;              // Per dictionary entry result
+        std::vector<uint64_t> batchRange;              // Upper bound mask of a range
+        std::vector<Node::Profile> profile;            // Per node id (see MergeProfile)
+
+        // Omit implementation of the copy constructor and assignment operator
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+    };
+
     Constraints() = default;
     ~Constraints() = default;
 
-    bool Parse(const char* constraintsStr);
-    bool Parse(const std::string& constraintsStr) { return Parse(constraintsStr.c_str()); }
-    bool IsValid() { return (bool)constraintsTree; }
-    const std::string& GetError() { return err; }
+    // Diagnostic strings (see Dump) are kept by default. Disable them to
+    // save parse time and memory. Takes effect on the next Parse().
+    void SetDiagnostics(bool enable) { diagnostics = enable; }
+
+    // Simplifies the parsed tree (enabled by default): flattens nested
+    // groups of the same operator, removes duplicate predicates, merges
+    // range predicates on the same field into a single interval, and folds
+    // contradictions and tautologies into a constant. Takes effect on the
+    // next Parse().
+    // Note: A folded predicate is not evaluated, so a row that has no value
+    // for its field may match (or not) rather than report an error.
+    void SetOptimize(bool enable) { optimize = enable; }
+
+    // Note: If schema is given, then field names are bound to the schema
+    // (registering new ones), and constraints can be evaluated for objects
+    // that look up values by FieldId, such as Record.
+    bool Parse(const char* constraintsStr, Schema* schema = nullptr);
+    bool Parse(const std::string& constraintsStr, Schema* schema = nullptr)
+        { return Parse(constraintsStr.c_str(), schema); }
+    bool IsValid() const { return constraintsTree != nullptr; }
+
+    // Constraints were folded into a constant: no row (or every row) matches
+    bool IsAlwaysFalse() const { return IsConstant(false); }
+    bool IsAlwaysTrue() const { return IsConstant(true); }
+    const std::string& GetError() const { return err; }
+
+    void SetEvalMode(EvalMode mode) { evalMode = mode; }
+    EvalMode GetEvalMode() const { return evalMode; }
+
+    // Adaptive mode: records how often every predicate passes, and every
+    // interval evaluated rows reorders children of AND/OR groups so that
+    // cheap and decisive predicates are evaluated first. The order only
+    // changes between Evaluate() calls (or batches), never within one.
+    // Evaluation with a Context records the statistics, but doesn't
+    // reorder (see the note above).
+    // Note: A reordered AND/OR may short circuit a predicate on a missing
+    // field that would have reported an error (or vice versa).
+    void SetAdaptive(bool enable, size_t interval = 1024)
+    {
+        adaptive = enable;
+        adaptiveInterval = (interval > 0 ? interval : 1);
+        adaptiveRows = 0;
+    }
+    bool IsAdaptive() const { return adaptive; }
+
+    // Profiling mode (EXPLAIN ANALYZE): records for every node how many
+    // times it was evaluated, its true/false counts, how often a group
+    // short circuited, and the CPU cycles spent (see Dump and DumpJson).
+    // Rows are evaluated by walking the tree then (even in the EVAL_PROGRAM
+    // mode), so the statistics are recorded for the groups as well. Batches
+    // record per node rows rather than evaluations.
+    // Note: The statistics are kept until the next Parse().
+    void SetProfile(bool enable) { profile = enable; }
+    bool IsProfile() const { return profile; }
+
+    // Adds the profiling statistics recorded in the context (by another
+    // thread, see Evaluate) to the ones reported by Dump, and clears them.
+    // Thread safe, so every thread can merge its context once it is done.
+    void MergeProfile(Context& ctx) const;
+
+    // Reentrant evaluation. Returns false (with the error in the context)
+    // if the object can't be evaluated.
+    template<class OBJECT>
+    bool Evaluate(const OBJECT& object, bool& result, Context& ctx) const
+    {
+        if(!constraintsTree)
+        {
+            ctx.err = "Invalid (null) root logical node";
+            return false;
+        }
+        if(IsSlotIndexed<OBJECT>::value && !schema)
+        {
+            ctx.err = "Constraints are not bound to a schema";
+            return false;
+        }
+        if(profile)
+        {
+            if(ctx.profile.size() < nodeCount)
+                ctx.profile.resize(nodeCount);
+            return EvaluateImpl<NodeProfiler>(*constraintsTree, object, result, ctx);
+        }
+        if(evalMode == EVAL_TREE)
+            return EvaluateImpl<NoProfiler>(*constraintsTree, object, result, ctx);
+        if(adaptive)
+            return EvaluateProgram<true>(object, result, ctx);
+        return EvaluateProgram<false>(object, result, ctx);
+    }
 
+    // Single threaded evaluation (see GetError), that also reorders
+    // the predicates in the adaptive mode
     template<class OBJECT>
     bool Evaluate(const OBJECT& object, bool& result)
     {
-        if(constraintsTree)
-            return EvaluateImpl(*constraintsTree, object, result);
-        err = "Invalid (null) root logical node";
-        return false;
+        bool res = Evaluate(object, result, context);
+        if(!res)
+            err = context.err;
+        if(adaptive && ++adaptiveRows >= adaptiveInterval)
+            Reorder();
+        return res;
     }
 
+    // Evaluates a block of rows in columnar form. Bit i of the selection
+    // is set if row i matches. Constraints must be bound to the schema
+    // the batch columns are indexed by (see batch.h).
+    bool EvaluateBatch(const ColumnBatch& batch, Selection& selection, Context& ctx) const;
+    bool EvaluateBatch(const ColumnBatch& batch, Selection& selection);
+
+    // Evaluates constraints for all rows of the index with bitmap AND/OR
+    // (see index.h). Fails if a constraint field is not indexed.
+    // Note: Rows that miss a field don't pass the predicates on the field
+    // (Evaluate reports an error for them instead).
+    bool EvaluateIndex(const Index& index, RowBitmap& result);
+
+    // Canonical form of the parsed constraints: ignores whitespace and
+    // quoting, flattens nested groups of the same operator and sorts the
+    // operands of AND/OR and the values of IN. Constraints that differ only
+    // in these have the same canonical form (used as a cache key).
+    std::string GetCanonical() const { return (constraintsTree ? GetCanonical(constraintsTree) : std::string()); }
+
     // Diagnostic
-    std::ostream& Dump(std::ostream& os) { return Dump(os, constraintsTree.get()); }
+    // Note: In the profiling mode, the nodes are annotated with their
+    // statistics.
+    std::ostream& Dump(std::ostream& os) const { return Dump(os, constraintsTree, 0); }
+    std::ostream& DumpJson(std::ostream& os) const;
+    std::ostream& DumpProgram(std::ostream& os) const;
 
 private:
-    Node* Parse(const char* constraintsStr, std::unique_ptr<Node>& node);
-    Node* ParseOperand(const char* constraintsStr, size_t& len);
-    Node::Operator ParseLogicalOperator(const char* constraintsStr, size_t& len);
-
-    bool ParseOperandName(const char* constraintsStr, size_t& len, std::string& name);
-    bool ParseOperandValue(const char* constraintsStr, size_t& len,
-            std::string& value, const char* terminators=nullptr);
-    Node::Operator ParseOperandOperator(const char* constraintsStr, size_t& len);
-    bool BuildValuesForOperatorIN(const char* constraintsStr, size_t& len,
-            const std::string& name, std::string& subConstraints);
-
-    std::ostream& Dump(std::ostream& msg, const Node* node);
+    // Single pass parser: a tokenizer and precedence climbing over its
+    // tokens (see constraints.cpp). AND binds tighter than OR, and NOT
+    // is pushed down to the predicates.
+    //   expression := unary { (AND | OR) unary }
+    //   unary      := NOT unary | '(' expression ')' | predicate
+    //   predicate  := name (== | != | < | <= | > | >=) value
+    //               | name [NOT] IN '(' value { ',' value } ')'
+    struct Token;
+    class Tokenizer;
+
+    Node* ParseExpression(Tokenizer& tokens, int minPrecedence);
+    Node* ParseUnary(Tokenizer& tokens);
+    Node* ParsePredicate(Tokenizer& tokens);
+    Node* Negate(Node* node);
+    Node* SetParseError(const Token& token, const char* what);
+
+    // Sets diagnostic string of the node to source[begin, end)
+    // (if diagnostics are enabled)
+    void SetConstraints(Node* node, size_t begin, size_t end);
+
+    // Algebraic simplification of the parsed tree (see optimizer.cpp).
+    // Returns the simplified node, that may be a new one.
+    Node* Optimize(Node* node);
+    bool MergePredicates(std::vector<Node*>& operands, bool isAnd);
+    bool MergeAnd(std::string_view name, const std::vector<Node*>& preds, std::vector<Node*>& result);
+    bool MergeOr(const std::vector<Node*>& preds, std::vector<Node*>& result);
+    Node* NewElement(std::string_view name, const Value& value, Node::Operator oper);
+    Node* NewConstant(bool value);
+    void SetGroupConstraints(Group* group);
+
+    // Groups with the children copied into the arena
+    Group* NewGroup(Node* const* children, size_t count, Node::Operator oper);
+    void SetChildren(Group* group, const std::vector<Node*>& children);
+    NodeList NewNodeList(Node* const* children, size_t count);
+
+    bool IsConstant(bool value) const
+    {
+        return constraintsTree && constraintsTree->GetType() == Node::CONSTANT &&
+               ((const Constant*)constraintsTree)->GetValue() == value;
+    }
+
+    // Lowers constraints tree into a flat program
+    bool CompileProgram();
+    bool Compile(const Node* node);
+
+    // Adaptive mode: reorders children of AND/OR groups by the statistics
+    // and recompiles the program if the order has changed
+    struct Estimate
+    {
+        double cost;    // Expected cost of a node evaluation
+        double pass;    // Expected pass rate
+    };
+
+    void Reorder();
+    Estimate Reorder(Node* node, bool& changed);
+    static double GetCost(const Node* node);
+
+    // Binds Element field names to the schema and interns
+    // their string values for the dictionary encoded fields
+    void Bind(Node* node);
+
+    // Assigns the node ids of the tree (counted by nodeCount)
+    void Number(Node* node);
+
+    // Merged profile of the node and the one of the own context
+    Node::Profile GetProfile(const Node& node) const;
+
+    std::ostream& Dump(std::ostream& msg, const Node* node, int level) const;
+    std::ostream& DumpJson(std::ostream& os, const Node* node) const;
+    std::ostream& DumpProfile(std::ostream& os, const Node& node) const;
+    static std::string GetCanonical(const Node* node);
     static const std::string& GetOperatorStr(Node::Operator operIn);
 
     // Evaluates a logical expression for OBJECT
     // Note: OBJECT must provide GetValue() method with a follow signature:
     // const Value* Object::GetValue(const std::string& name) const;
+    // (or with std::string_view name, that avoids a temporary std::string)
+    // or, for constraints parsed with a Schema:
+    // const Value* Object::GetValue(FieldId id) const;
     //
     // Note: We must be able to handle different object types. One way would
     // be to make Object::GetValue() method virtual, but that will affect
     // performance with a large volume of objects. Template implementation
     // allows to avoid using virtual functions and hence perform better.
+    // PROFILER is NoProfiler or NodeProfiler (see below).
+    template<class PROFILER, class OBJECT>
+    bool EvaluateImpl(const Node& node, const OBJECT& object, bool& result, Context& ctx) const;
+
+    // CPU cycle counter (or nanoseconds where there is none)
+    static uint64_t GetCycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // Profiling policies of EvaluateImpl. NoProfiler compiles to nothing,
+    // so the evaluation without profiling doesn't pay for it.
+    struct NoProfiler
+    {
+        static uint64_t Start() { return 0; }
+        static void Stop(Context&, const Node&, uint64_t, bool, bool) {}
+    };
+
+    struct NodeProfiler
+    {
+        static uint64_t Start() { return GetCycles(); }
+        static void Stop(Context& ctx, const Node& node, uint64_t start, bool result, bool shortCircuit)
+            { ctx.profile[node.GetId()].Add(1, result, shortCircuit, GetCycles() - start); }
+    };
+
+    // Evaluates node for all rows of the index into result (see index.cpp)
+    bool EvaluateIndexImpl(const Node& node, const Index& index, RowBitmap& result);
+    static bool GetIndexRange(const Node& node, FieldId& field, int64_t& lo, int64_t& hi);
+
+    // Evaluates node for all rows of the batch into mask (see batch.cpp)
+    bool EvaluateBatchImpl(const Node& node, const ColumnBatch& batch, uint64_t* mask, size_t level, Context& ctx) const;
+    void ProfileBatch(const Node& node, const uint64_t* mask, size_t rowCount, uint64_t start, bool shortCircuit, Context& ctx) const;
+    bool EvaluateBatchElement(const Element& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const;
+    bool EvaluateBatchElementIN(const ElementIN& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const;
+    bool EvaluateBatchElementRange(const ElementRange& element, const ColumnBatch& batch, uint64_t* mask, Context& ctx) const;
+    static void EvaluateBatchCompare(const Column& col, Node::Operator logicalOperator,
+            const Value& operand, size_t rowCount, uint64_t* mask);
+
+    // Looks up the field value the way OBJECT supports (see record.h)
     template<class OBJECT>
-    bool EvaluateImpl(const Node& node, const OBJECT& object, bool& result);
+    static const Value* GetObjectValue(const OBJECT& object, FieldId id, std::string_view name)
+    {
+        if constexpr(IsSlotIndexed<OBJECT>::value)
+            return object.GetValue(id);     // Single array index
+        else if constexpr(IsViewIndexed<OBJECT>::value)
+            return object.GetValue(name);   // Look up by name
+        else
+            return object.GetValue(std::string(name));
+    }
+
+    // Evaluates the compiled program for OBJECT (same OBJECT requirements
+    // as above). Runs as a single loop without recursion or downcasting.
+    // ADAPTIVE records the statistics.
+    template<bool ADAPTIVE, class OBJECT>
+    bool EvaluateProgram(const OBJECT& object, bool& result, Context& ctx) const;
+
+    // ConstraintSet indexes the parsed tree nodes
+    friend class ConstraintSet;
 
     // Class data
-    std::unique_ptr<Node> constraintsTree;
+    Arena arena;                    // Owns constraintsTree nodes and strings
+    Node* constraintsTree = nullptr;
+    std::vector<Instruction> program;
+    Schema* schema = nullptr;       // Schema the constraints are bound to
+    EvalMode evalMode = EVAL_PROGRAM;
+
+    Context context;                // Evaluation without a Context
     std::string err;
     std::string constraintsStrIn;   // Only used for Diagnostic
-    int depth = 0;                  // Only used for Diagnostic
+    std::string_view source;        // Parsed string (in arena)
+    bool diagnostics = true;        // Keep diagnostic strings of nodes
+    bool optimize = true;           // Simplify the parsed tree
+    bool adaptive = false;          // Reorder predicates by the statistics
+    bool profile = false;           // Record per node statistics
+    size_t adaptiveInterval = 1024; // Rows between reorders
+    size_t adaptiveRows = 0;        // Rows since the last reorder
+    int depth = 0;                  // Parser nesting depth
+    std::vector<Node*> parseOperands; // Parser operand runs (a stack, reused)
+    size_t nodeCount = 0;           // Nodes of the tree (see Number)
+
+    // Profiles merged from the contexts of other threads, by node id
+    mutable std::mutex profileMtx;
+    mutable std::vector<Node::Profile> profiles;
 
     // Omit implementation of the copy constructor and assignment operator
     Constraints(const Constraints&) = delete;
     Constraints& operator=(const Constraints&) = delete;
 };
 
-template<class OBJECT>
-bool Constraints::EvaluateImpl(const Node& node, const OBJECT& object, bool& result)
+template<class PROFILER, class OBJECT>
+bool Constraints::EvaluateImpl(const Node& node, const OBJECT& object, bool& result, Context& ctx) const
 {
+    uint64_t start = PROFILER::Start();
+
     // Create an iterator for the child nodes of the current group.
     Node::Type type = node.GetType();
 
@@ -235,52 +691,41 @@ bool Constraints::EvaluateImpl(const Node& node, const OBJECT& object, bool& res
     {
         const Group& group = (const Group&)node;
         Node::Operator logicalOperator = group.GetOperator();
-        bool resultA = false;
-        bool resultB = false;
-
-        const Node* pLChild = group.GetLChild();
-        const Node* pBChild = group.GetRChild();
 
-        if(!pLChild || !pBChild)
+        if(group.GetChildren().empty())
         {
-            err = "Badly formed logical expression";
+            ctx.err = "Badly formed logical expression";
             return false;
         }
 
-        // Recurse on the L child
-        if(!EvaluateImpl(*pLChild, object, resultA))
-            return false;
-
-        // Short circuit OR  eval if A is TRUE.
-        // Short circuit AND eval if A is FALSE.
-        if(logicalOperator == Node::OR && resultA)
-        {
-            result = true;
-            return true;
-        }
-        else if(logicalOperator == Node::AND && !resultA)
+        if(logicalOperator != Node::AND && logicalOperator != Node::OR)
         {
-            result = false;
-            return true;
+            ctx.err = "Invalid group operand " +  GetOperatorStr(logicalOperator) + " in logical expression evaluation.";
+            return false;
         }
 
-        // Recurse on the R child
-        if(!EvaluateImpl(*pBChild, object, resultB))
-            return false;
+        // Short circuit OR  eval on the first TRUE child.
+        // Short circuit AND eval on the first FALSE child.
+        bool shortCircuit = (logicalOperator == Node::OR);
+        NodeList children = group.GetChildren();
 
-        switch(logicalOperator)
+        for(size_t i = 0; i < children.size(); i++)
         {
-            case Node::OR:
-                result = (resultA || resultB);
-                break;
-
-            case Node::AND:
-                result = (resultA && resultB);
-                break;
+            if(!children[i])
+            {
+                ctx.err = "Badly formed logical expression";
+                return false;
+            }
 
-            default:
-                err = "Invalid group operand " +  GetOperatorStr(logicalOperator) + " in logical expression evaluation.";
+            // Recurse on the child
+            if(!EvaluateImpl<PROFILER>(*children[i], object, result, ctx))
                 return false;
+
+            if(result == shortCircuit)
+            {
+                PROFILER::Stop(ctx, node, start, result, i + 1 < children.size());
+                return true;
+            }
         }
     }
     else if(type == Node::ELEMENT)
@@ -288,12 +733,12 @@ bool Constraints::EvaluateImpl(const Node& node, const OBJECT& object, bool& res
         const Element& element = (const Element&)node;
         Node::Operator logicalOperator = element.GetOperator();
 
-        const Value* valueA = object.GetValue(element.GetName());
+        const Value* valueA = GetObjectValue(object, element.GetFieldId(), element.GetName());
         if(!valueA)
         {
             // TODO: If we don't have a value then we have nothing to evaluate.
             // We should consider returning "true" with result set to "false".
-            err = "Evaluated object doesn't have a value for a name '" + element.GetName() + "'";
+            ctx.err = "Evaluated object doesn't have a value for a name '" + std::string(element.GetName()) + "'";
             return false;
         }
 
@@ -334,16 +779,118 @@ bool Constraints::EvaluateImpl(const Node& node, const OBJECT& object, bool& res
 //                break;
 
             default:
-                err = "Invalid element operand " + GetOperatorStr(logicalOperator) + " in logical expression evaluation.";
+                ctx.err = "Invalid element operand " + GetOperatorStr(logicalOperator) + " in logical expression evaluation.";
                 return false;
         }
+
+        if(adaptive)
+            element.AddStats(1, result);
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        const ElementIN& element = (const ElementIN&)node;
+
+        const Value* valueA = GetObjectValue(object, element.GetFieldId(), element.GetName());
+        if(!valueA)
+        {
+            ctx.err = "Evaluated object doesn't have a value for a name '" + std::string(element.GetName()) + "'";
+            return false;
+        }
+
+        result = (element.GetValues().Contains(*valueA) != element.IsNegated());
+
+        if(adaptive)
+            element.AddStats(1, result);
+    }
+    else if(type == Node::ELEMENT_RANGE)
+    {
+        const ElementRange& element = (const ElementRange&)node;
+
+        const Value* valueA = GetObjectValue(object, element.GetFieldId(), element.GetName());
+        if(!valueA)
+        {
+            ctx.err = "Evaluated object doesn't have a value for a name '" + std::string(element.GetName()) + "'";
+            return false;
+        }
+
+        result = element.GetRange().Contains(*valueA);
+
+        if(adaptive)
+            element.AddStats(1, result);
+    }
+    else if(type == Node::CONSTANT)
+    {
+        result = ((const Constant&)node).GetValue();
     }
     else
     {
-        err = "Invalid logical node type " + type;
+        ctx.err = "Invalid logical node type " + std::to_string(type) + " in logical expression evaluation.";
         return false;
     }
 
+    PROFILER::Stop(ctx, node, start, result, false);
+    return true;
+}
+
+template<bool ADAPTIVE, class OBJECT>
+bool Constraints::EvaluateProgram(const OBJECT& object, bool& result, Context& ctx) const
+{
+    const Instruction* begin = program.data();
+    const Instruction* end = begin + program.size();
+    bool acc = false;
+
+    for(const Instruction* ip = begin; ip < end; ++ip)
+    {
+        switch(ip->code)
+        {
+            case Instruction::JMPF:
+                if(!acc)
+                    ip = begin + ip->target - 1; // -1 to compensate for ++ip
+                continue;
+
+            case Instruction::JMPT:
+                if(acc)
+                    ip = begin + ip->target - 1; // -1 to compensate for ++ip
+                continue;
+
+            case Instruction::SETF:
+            case Instruction::SETT:
+                acc = (ip->code == Instruction::SETT);
+                continue;
+
+            default:
+                break;
+        }
+
+        const Value* valueA = GetObjectValue(object, ip->field, ip->name);
+        if(!valueA)
+        {
+            ctx.err = "Evaluated object doesn't have a value for a name '" + std::string(ip->name) + "'";
+            return false;
+        }
+
+        switch(ip->code)
+        {
+            case Instruction::EQ: acc = (*valueA == ip->value); break;
+            case Instruction::NE: acc = (*valueA != ip->value); break;
+            case Instruction::LT: acc = (*valueA <  ip->value); break;
+            case Instruction::LE: acc = (*valueA <= ip->value); break;
+            case Instruction::GT: acc = (*valueA >  ip->value); break;
+            case Instruction::GE: acc = (*valueA >= ip->value); break;
+            case Instruction::IN: acc = ip->set->Contains(*valueA); break;
+            case Instruction::NOT_IN: acc = !ip->set->Contains(*valueA); break;
+            case Instruction::RANGE: acc = ip->range->Contains(*valueA); break;
+
+            default:
+                ctx.err = "Invalid instruction (opcode " + std::to_string(ip->code) + ") in program evaluation.";
+                return false;
+        }
+
+        if constexpr(ADAPTIVE)
+            ip->node->AddStats(1, acc);
+    }
+
+    result = acc;
     return true;
 }
 
@@ -0,0 +1,360 @@
+//
+// constraintset.cpp
+//
+#include <algorithm>        // std::sort, std::unique
+#include "constraintset.h"
+
+bool ConstraintSet::Add(Id id, const char* constraintsStr)
+{
+    err.clear();
+
+    // Node diagnostic strings are not used, so don't keep them
+    constraints.SetDiagnostics(false);
+    if(!constraints.Parse(constraintsStr, schema))
+    {
+        err = constraints.GetError();
+        return false;
+    }
+
+    // Validate the whole tree first, so a failure doesn't leave
+    // predicates of a partially added subscription behind
+    Subscription sub;
+    sub.id = id;
+    uint32_t subIndex = (uint32_t)subscriptions.size();
+
+    // Constraints folded into a constant have no predicates to count:
+    // true ones match every record, and false ones never match
+    if(constraints.IsAlwaysTrue() || constraints.IsAlwaysFalse())
+    {
+        if(constraints.IsAlwaysTrue())
+            always.push_back(subIndex);
+        subscriptions.push_back(std::move(sub));
+        subEpoch.resize(subscriptions.size(), 0);
+        subCount.resize(subscriptions.size(), 0);
+        return true;
+    }
+
+    std::vector<const Node*> leaves;
+    if(!AddNode(constraints.constraintsTree, leaves, sub.program))
+        return false;
+
+    // Map the tree leaves to the (shared) predicates
+    std::vector<PredId> preds(leaves.size());
+    for(size_t i = 0; i < leaves.size(); i++)
+        preds[i] = AddPredicate(leaves[i]);
+
+    for(Step& step : sub.program)
+    {
+        if(step.code == Step::PRED)
+            step.pred = preds[step.pred];
+        else if(step.code == Step::OR)
+            sub.conjunctive = false;
+    }
+
+    // A predicate repeated in the constraints is counted once
+    std::sort(preds.begin(), preds.end());
+    preds.erase(std::unique(preds.begin(), preds.end()), preds.end());
+    for(PredId pred : preds)
+        predicates[pred].subs.push_back(subIndex);
+
+    sub.predCount = (uint32_t)preds.size();
+    if(sub.conjunctive)
+        sub.program.clear();
+
+    subscriptions.push_back(std::move(sub));
+    subEpoch.resize(subscriptions.size(), 0);
+    subCount.resize(subscriptions.size(), 0);
+    return true;
+}
+
+// Collects the tree leaves and builds the postfix program over their
+// indexes in leaves (mapped to predicates by the caller)
+bool ConstraintSet::AddNode(const Node* node, std::vector<const Node*>& leaves, std::vector<Step>& program)
+{
+    if(node == nullptr)
+    {
+        err = "Invalid (null) logical node";
+        return false;
+    }
+
+    Node::Type type = node->GetType();
+    Node::Operator logicalOperator = node->GetOperator();
+
+    if(type == Node::GROUP)
+    {
+        const Constraints::Group* group = (const Constraints::Group*)node;
+        if(logicalOperator != Node::AND && logicalOperator != Node::OR)
+        {
+            err = "Invalid group operand " + Constraints::GetOperatorStr(logicalOperator) + " in constraint set.";
+            return false;
+        }
+
+        Constraints::NodeList children = group->GetChildren();
+        for(size_t i = 0; i < children.size(); i++)
+        {
+            if(!AddNode(children[i], leaves, program))
+                return false;
+
+            // Combine every child after the first with the previous ones
+            if(i > 0)
+                program.push_back({logicalOperator == Node::AND ? Step::AND : Step::OR, 0});
+        }
+    }
+    else if((type == Node::ELEMENT && logicalOperator >= Node::EQ && logicalOperator <= Node::GE) ||
+            type == Node::ELEMENT_IN || type == Node::ELEMENT_RANGE)
+    {
+        program.push_back({Step::PRED, (PredId)leaves.size()});
+        leaves.push_back(node);
+    }
+    else
+    {
+        err = "Invalid logical node type " + std::to_string(type) + " or operand " +
+              Constraints::GetOperatorStr(logicalOperator) + " in constraint set.";
+        return false;
+    }
+
+    return true;
+}
+
+ConstraintSet::PredId ConstraintSet::AddPredicate(const Node* node)
+{
+    // Canonical form of the predicate: field, operator and value(s)
+    auto valueKey = [](const Value& value)
+    {
+        // Note: Equal numbers have the same text (2.0 is "2")
+        std::string key = (value.IsNumber() ? "n" : "s");
+        if(value.IsNumber())
+            value.Format(key);
+        else
+            key += value.GetString();
+        return key;
+    };
+
+    FieldId field = INVALID_FIELD_ID;
+    std::string key;
+
+    if(node->GetType() == Node::ELEMENT_IN)
+    {
+        const Constraints::ElementIN* elem = (const Constraints::ElementIN*)node;
+        field = elem->GetFieldId();
+
+        std::vector<std::string> values;
+        elem->GetValues().ForEach([&](const Value& value) { values.push_back(valueKey(value)); });
+        std::sort(values.begin(), values.end());
+        for(const std::string& value : values)
+            key += value + '\0';
+    }
+    else if(node->GetType() == Node::ELEMENT_RANGE)
+    {
+        const Constraints::ElementRange* elem = (const Constraints::ElementRange*)node;
+        const ValueRange& range = elem->GetRange();
+        field = elem->GetFieldId();
+        key = (range.loInclusive ? "[" : "(") + valueKey(range.lo) + '\0' + valueKey(range.hi) + (range.hiInclusive ? "]" : ")");
+    }
+    else
+    {
+        const Constraints::Element* elem = (const Constraints::Element*)node;
+        field = elem->GetFieldId();
+        key = valueKey(elem->GetValue());
+    }
+
+    key = std::to_string(field) + ':' + std::to_string(node->GetOperator()) + ':' + key;
+
+    auto it = predicateKeys.find(key);
+    if(it != predicateKeys.end())
+        return it->second;
+
+    // Add a new predicate and index it by the field
+    PredId pred = (PredId)predicates.size();
+    predicateKeys.emplace(std::move(key), pred);
+
+    Predicate& predicate = predicates.emplace_back();
+    predicate.field = field;
+    predicate.oper = node->GetOperator();
+    predEpoch.resize(predicates.size(), 0);
+
+    FieldIndex& index = GetFieldIndex(field);
+    auto addEq = [&](const Value& value)
+    {
+        if(value.IsNumber())
+            index.numEq[value].push_back(pred);
+        else
+            index.strEq[value.GetString()].push_back(pred);
+    };
+
+    if(predicate.oper == Node::IN)
+    {
+        ((const Constraints::ElementIN*)node)->GetValues().ForEach(addEq);
+    }
+    else if(predicate.oper == Node::NOT_IN)
+    {
+        // The tree is released by the next Add(), so the set is copied
+        predicate.set = ((const Constraints::ElementIN*)node)->GetValues();
+        index.others.push_back(pred);
+    }
+    else if(predicate.oper == Node::RANGE)
+    {
+        predicate.range = ((const Constraints::ElementRange*)node)->GetRange();
+        index.others.push_back(pred);
+    }
+    else
+    {
+        predicate.value = ((const Constraints::Element*)node)->GetValue();
+        if(predicate.oper == Node::EQ)
+            addEq(predicate.value);
+        else
+            index.others.push_back(pred);
+    }
+
+    return pred;
+}
+
+ConstraintSet::FieldIndex& ConstraintSet::GetFieldIndex(FieldId field)
+{
+    if(field >= fieldIndexes.size())
+        fieldIndexes.resize(field + 1, (uint32_t)-1);
+
+    if(fieldIndexes[field] == (uint32_t)-1)
+    {
+        fieldIndexes[field] = (uint32_t)fields.size();
+        fields.emplace_back().field = field;
+    }
+
+    return fields[fieldIndexes[field]];
+}
+
+void ConstraintSet::Match(const Record& rec, std::vector<Id>& ids)
+{
+    ids.clear();
+    candidates.clear();
+    matched.clear();
+
+    // Start a new epoch (reset the scratch state on wrap around)
+    if(++epoch == 0)
+    {
+        std::fill(predEpoch.begin(), predEpoch.end(), 0);
+        std::fill(subEpoch.begin(), subEpoch.end(), 0);
+        epoch = 1;
+    }
+
+    // Evaluate every distinct predicate once, field by field
+    for(const FieldIndex& index : fields)
+    {
+        const Value* value = rec.GetValue(index.field);
+        if(!value)
+            continue;
+
+        // Equality and IN predicates that pass for the value
+        const std::vector<PredId>* eq = nullptr;
+        if(value->IsNumber())
+        {
+            auto it = index.numEq.find(*value);
+            eq = (it == index.numEq.end() ? nullptr : &it->second);
+        }
+        else
+        {
+            auto it = index.strEq.find(value->GetString());
+            eq = (it == index.strEq.end() ? nullptr : &it->second);
+        }
+
+        if(eq)
+        {
+            for(PredId pred : *eq)
+                Pass(pred);
+        }
+
+        for(PredId pred : index.others)
+        {
+            const Value& operand = predicates[pred].value;
+            bool result = false;
+
+            switch(predicates[pred].oper)
+            {
+                case Node::NE: result = (*value != operand); break;
+                case Node::LT: result = (*value <  operand); break;
+                case Node::LE: result = (*value <= operand); break;
+                case Node::GT: result = (*value >  operand); break;
+                case Node::GE: result = (*value >= operand); break;
+                case Node::RANGE: result = predicates[pred].range.Contains(*value); break;
+                case Node::NOT_IN: result = !predicates[pred].set.Contains(*value); break;
+                default: break;
+            }
+
+            if(result)
+                Pass(pred);
+        }
+    }
+
+    // Subscriptions that match every record
+    matched.insert(matched.end(), always.begin(), always.end());
+
+    // Subscriptions with OR are evaluated if any of their predicates passed
+    for(uint32_t sub : candidates)
+    {
+        if(EvaluateProgram(subscriptions[sub]))
+            matched.push_back(sub);
+    }
+
+    std::sort(matched.begin(), matched.end());
+    for(uint32_t sub : matched)
+        ids.push_back(subscriptions[sub].id);
+}
+
+void ConstraintSet::Pass(PredId pred)
+{
+    predEpoch[pred] = epoch;
+
+    for(uint32_t sub : predicates[pred].subs)
+    {
+        const Subscription& subscription = subscriptions[sub];
+        if(subEpoch[sub] != epoch)
+        {
+            subEpoch[sub] = epoch;
+            subCount[sub] = 0;
+            if(!subscription.conjunctive)
+                candidates.push_back(sub);
+        }
+
+        // Conjunction matches when all its predicates passed
+        if(++subCount[sub] == subscription.predCount && subscription.conjunctive)
+            matched.push_back(sub);
+    }
+}
+
+bool ConstraintSet::EvaluateProgram(const Subscription& sub)
+{
+    stack.clear();
+
+    for(const Step& step : sub.program)
+    {
+        if(step.code == Step::PRED)
+        {
+            stack.push_back(predEpoch[step.pred] == epoch);
+            continue;
+        }
+
+        char rResult = stack.back();
+        stack.pop_back();
+        if(step.code == Step::AND)
+            stack.back() = stack.back() && rResult;
+        else
+            stack.back() = stack.back() || rResult;
+    }
+
+    return !stack.empty() && stack.back();
+}
+
+void ConstraintSet::Clear()
+{
+    predicates.clear();
+    predicateKeys.clear();
+    fields.clear();
+    fieldIndexes.clear();
+    subscriptions.clear();
+    always.clear();
+    predEpoch.clear();
+    subEpoch.clear();
+    subCount.clear();
+    epoch = 0;
+    err.clear();
+}
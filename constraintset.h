@@ -0,0 +1,123 @@
+//
+// constraintset.h
+//
+#ifndef __CONSTRAINTSET_H__
+#define __CONSTRAINTSET_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>         // uint32_t
+#include "constraints.h"
+
+//
+// Class ConstraintSet (multi-query matching).
+// Matches a record against many registered constraints (subscriptions)
+// at once. The elementary predicates (field, operator, value) of all
+// subscriptions are de-duplicated and indexed by field: equality and IN
+// predicates of a field are found with a single hash lookup of the record
+// value, and the rest are evaluated directly. Every distinct predicate is
+// evaluated at most once per record.
+//
+// Subscriptions that are plain conjunctions (AND only) are matched by
+// counting their passed predicates. Other subscriptions are evaluated over
+// the predicate results, but only if at least one of their predicates
+// passed (AND/OR expressions are false when all their predicates are false).
+//
+// Note: A record that has no value for a field doesn't pass the predicates
+// on the field (Constraints::Evaluate reports an error instead).
+//
+class ConstraintSet
+{
+public:
+    using Id = uint32_t;    // Subscription id, given by the caller
+
+    ConstraintSet(Schema& schemaIn) : schema(&schemaIn) {}
+    ~ConstraintSet() = default;
+
+    // Parses constraints and registers them with the given id
+    bool Add(Id id, const char* constraintsStr);
+    bool Add(Id id, const std::string& constraintsStr) { return Add(id, constraintsStr.c_str()); }
+    const std::string& GetError() const { return err; }
+
+    // Returns ids of all subscriptions the record matches (in the order
+    // of registration)
+    void Match(const Record& rec, std::vector<Id>& ids);
+
+    size_t GetSize() const { return subscriptions.size(); }
+    size_t GetPredicateCount() const { return predicates.size(); }
+    void Clear();
+
+private:
+    using Node = Constraints::Node;
+    using PredId = uint32_t;
+
+    struct Predicate
+    {
+        FieldId field{INVALID_FIELD_ID};
+        Node::Operator oper{Node::NOOP};
+        Value value;                    // Operand (not used by IN, NOT IN and RANGE)
+        ValueRange range;               // Operand of RANGE
+        ValueSet set;                   // Operand of NOT IN
+        std::vector<uint32_t> subs;     // Subscriptions using the predicate
+    };
+
+    // Expression of a not conjunctive subscription in postfix form
+    struct Step
+    {
+        enum OpCode : char { PRED=0, AND, OR };
+
+        OpCode code{PRED};
+        PredId pred{0};
+    };
+
+    struct Subscription
+    {
+        Id id{0};
+        uint32_t predCount{0};          // Number of distinct predicates
+        bool conjunctive{true};
+        std::vector<Step> program;      // Not conjunctive only
+    };
+
+    // Predicates on a single field
+    struct FieldIndex
+    {
+        FieldId field{INVALID_FIELD_ID};
+        std::unordered_map<Value, std::vector<PredId>, ValueHash> numEq; // EQ and IN (integers and doubles)
+        std::unordered_map<std::string, std::vector<PredId>> strEq;      // EQ and IN
+        std::vector<PredId> others;                                      // Evaluated one by one
+    };
+
+    bool AddNode(const Node* node, std::vector<const Node*>& leaves, std::vector<Step>& program);
+    PredId AddPredicate(const Node* node);
+    FieldIndex& GetFieldIndex(FieldId field);
+
+    void Pass(PredId pred);
+    bool EvaluateProgram(const Subscription& sub);
+
+    Schema* schema{nullptr};
+    Constraints constraints;        // Parser for the added constraints
+    std::vector<Predicate> predicates;
+    std::unordered_map<std::string, PredId> predicateKeys; // Canonical form -> predicate
+    std::vector<FieldIndex> fields;
+    std::vector<uint32_t> fieldIndexes; // FieldId -> index in fields (or -1)
+    std::vector<Subscription> subscriptions;
+    std::vector<uint32_t> always;       // Subscriptions folded to true
+    std::string err;
+
+    // Match scratch state. Entries are valid for the current epoch only,
+    // so they don't have to be reset for every record.
+    uint32_t epoch{0};
+    std::vector<uint32_t> predEpoch;    // Predicate passed in the epoch
+    std::vector<uint32_t> subEpoch;     // Subscription count is of the epoch
+    std::vector<uint32_t> subCount;     // Passed predicates of a subscription
+    std::vector<uint32_t> candidates;   // Not conjunctive subscriptions to evaluate
+    std::vector<uint32_t> matched;      // Matched subscriptions
+    std::vector<char> stack;            // EvaluateProgram() stack
+
+    // Omit implementation of the copy constructor and assignment operator
+    ConstraintSet(const ConstraintSet&) = delete;
+    ConstraintSet& operator=(const ConstraintSet&) = delete;
+};
+
+#endif // __CONSTRAINTSET_H__
@@ -0,0 +1,140 @@
+//
+// datagen.cpp
+//
+#include <algorithm>        // std::upper_bound
+#include <cmath>            // std::pow
+#include <fstream>          // std::ofstream
+#include "datagen.h"
+
+namespace
+{
+    // Real values of the books.txt fields, used before the generated ones
+    const std::vector<std::string_view> LANGUAGES = {"English", "French", "Spanish", "Russian",
+            "German", "Italian", "Japanese", "Portuguese"};
+    const std::vector<std::string_view> GENRES = {"Novel", "Poetry", "Romance", "Detective",
+            "Adventure", "Whodunits", "Drama", "Fantasy"};
+    const std::vector<std::string_view> NATIONALITIES = {"British", "French", "American", "Russian",
+            "Spanish", "Belgian", "German", "Italian"};
+
+    const std::vector<std::string_view>* GetKnownValues(std::string_view fieldName)
+    {
+        if(fieldName == "Language")
+            return &LANGUAGES;
+        if(fieldName == "Genre")
+            return &GENRES;
+        if(fieldName == "Nationality")
+            return &NATIONALITIES;
+        return nullptr;
+    }
+}
+
+DataGenerator::DataGenerator(const DataGenOptions& optsIn) : opts(optsIn), rng(optsIn.seed)
+{
+    static const char* BOOKS_FIELDS[] = {"Autor", "Language", "Genre", "BookNumber", "Nationality"};
+
+    for(size_t i = 0; i < opts.fields; i++)
+    {
+        Field& field = fields.emplace_back();
+        if(i < 5)
+        {
+            field.name = BOOKS_FIELDS[i];
+            field.isInt = (field.name == "BookNumber");
+        }
+        else
+        {
+            field.name = "Field" + std::to_string(i + 1);
+            field.isInt = (i % 2 == 0);
+        }
+
+        if(field.isInt)
+            field.cardinality = std::max(opts.maxNumber, 1);
+        else if(field.name == "Autor")
+            field.cardinality = std::max<size_t>(opts.rows / 4, 1);
+        else
+            field.cardinality = std::max<size_t>(opts.cardinality, 1);
+
+        if(!field.isInt)
+        {
+            field.values.reserve(field.cardinality);
+            for(size_t k = 0; k < field.cardinality; k++)
+                field.values.push_back(GetString(field.name, k));
+        }
+
+        if(opts.skew > 0)
+        {
+            double sum = 0;
+            field.cdf.reserve(field.cardinality);
+            for(size_t k = 0; k < field.cardinality; k++)
+            {
+                sum += 1.0 / std::pow((double)(k + 1), opts.skew);
+                field.cdf.push_back(sum);
+            }
+            for(double& p : field.cdf)
+                p /= sum;
+        }
+    }
+}
+
+std::string DataGenerator::GetString(std::string_view fieldName, size_t k)
+{
+    const std::vector<std::string_view>* known = GetKnownValues(fieldName);
+    if(known && k < known->size())
+        return std::string((*known)[k]);
+
+    if(fieldName == "Autor")
+        return "Author " + std::to_string(k);
+    return std::string(fieldName) + "_" + std::to_string(k);
+}
+
+size_t DataGenerator::Draw(const Field& field)
+{
+    if(field.cdf.empty())
+        return std::uniform_int_distribution<size_t>(0, field.cardinality - 1)(rng);
+
+    double p = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    size_t k = std::upper_bound(field.cdf.begin(), field.cdf.end(), p) - field.cdf.begin();
+    return std::min(k, field.cardinality - 1);
+}
+
+void DataGenerator::Next(std::string& line)
+{
+    line.clear();
+    for(const Field& field : fields)
+    {
+        if(!line.empty())
+            line += ',';
+        line += field.name;
+        line += '=';
+
+        size_t k = Draw(field);
+        if(field.isInt)
+            line += std::to_string(k);
+        else
+            line += field.values[k];
+    }
+}
+
+bool DataGenerator::Write(const char* fileName)
+{
+    std::ofstream out(fileName, std::ios::trunc);
+    if(!out)
+    {
+        err = std::string("Cannot create file '") + fileName + "'";
+        return false;
+    }
+
+    std::string line;
+    for(size_t row = 0; row < opts.rows; row++)
+    {
+        Next(line);
+        line += '\n';
+        out.write(line.data(), line.size());
+    }
+
+    if(!out)
+    {
+        err = std::string("Failed to write file '") + fileName + "'";
+        return false;
+    }
+    return true;
+}
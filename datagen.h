@@ -0,0 +1,77 @@
+//
+// datagen.h
+//
+#ifndef __DATAGEN_H__
+#define __DATAGEN_H__
+
+#include <random>           // std::mt19937
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>         // uint32_t
+
+//
+// Options of the generated data (see DataGenerator)
+//
+struct DataGenOptions
+{
+    size_t rows{200000};
+    size_t fields{5};           // The books.txt fields first, then FieldN ones
+    size_t cardinality{16};     // Distinct values of a low cardinality string field
+    int maxNumber{1000};        // Integer values are in [0, maxNumber)
+    double skew{0.0};           // Zipf exponent of the value distribution (0 for uniform)
+    uint32_t seed{1};
+};
+
+//
+// Class DataGenerator.
+// Generates "name=value,name=value,..." lines shaped like books.txt. The
+// first five fields are the books.txt ones: Autor (rows / 4 distinct values),
+// Language, Genre and Nationality (options.cardinality distinct values each)
+// and BookNumber (an integer). Additional fields alternate between low
+// cardinality strings and integers. Value k of a field is drawn with the
+// probability proportional to 1 / (k + 1)^skew, so the lower values are the
+// more frequent ones with a positive skew.
+//
+class DataGenerator
+{
+public:
+    DataGenerator(const DataGenOptions& optsIn);
+    ~DataGenerator() = default;
+
+    // Replaces line with the next generated row
+    void Next(std::string& line);
+
+    // Writes options.rows generated rows into the file, one per line
+    bool Write(const char* fileName);
+    const std::string& GetError() const { return err; }
+
+    const DataGenOptions& GetOptions() const { return opts; }
+
+    // Returns value k of a string field (the way the generator writes it),
+    // to build constraints that match the generated data
+    static std::string GetString(std::string_view fieldName, size_t k);
+
+private:
+    struct Field
+    {
+        std::string name;
+        bool isInt{false};
+        size_t cardinality{0};
+        std::vector<double> cdf;    // Cumulative distribution (skew > 0)
+        std::vector<std::string> values;
+    };
+
+    size_t Draw(const Field& field);
+
+    const DataGenOptions opts;
+    std::vector<Field> fields;
+    std::mt19937 rng;
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    DataGenerator(const DataGenerator&) = delete;
+    DataGenerator& operator=(const DataGenerator&) = delete;
+};
+
+#endif // __DATAGEN_H__
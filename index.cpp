@@ -0,0 +1,499 @@
+//
+// index.cpp
+//
+#include <algorithm>        // std::stable_sort, std::lower_bound, std::find_if
+#include <atomic>
+#include <cmath>            // std::ceil, std::floor
+#include "index.h"
+#include "constraints.h"
+
+//
+// Index
+//
+void Index::Build(const MappedFile& file, size_t maxCardinality /*=1024*/)
+{
+    static std::atomic<uint64_t> lastVersion{0};
+    version = ++lastVersion;
+
+    rows.clear();
+    fields.clear();
+
+    LineParser parser(*schema);
+    Record rec(*schema);
+
+    file.ForEachLine([&](std::string_view line)
+    {
+        uint32_t row = (uint32_t)rows.size();
+        rows.push_back(line);
+        parser.Parse(line, rec);
+
+        if(fields.size() < schema->GetSize())
+            fields.resize(schema->GetSize());
+
+        for(FieldId id = 0; id < fields.size(); id++)
+        {
+            FieldIndex& field = fields[id];
+            const Value* value = rec.GetValue(id);
+            if(!value)
+                continue;
+
+            // Rows are added in ascending order (the fast path)
+            int64_t num = 0;
+            bool isIntegral = value->GetIntegral(num);
+            field.present.Add(row);
+            if(isIntegral)
+                field.sorted.emplace_back(num, row);
+            else if(value->IsDouble())
+                field.doubleRows.Add(row);
+            else
+                field.stringRows.Add(row);
+
+            if(!field.indexed)
+                continue;
+
+            if(isIntegral)
+                field.intValues[num].Add(row);
+            else if(value->IsDouble())
+                field.doubleValues[value->GetDouble()].Add(row);
+            else
+                field.strValues[value->GetString()].Add(row);
+
+            // High cardinality field: bitmaps would take more than the data
+            if(field.GetCardinality() > maxCardinality)
+            {
+                field.indexed = false;
+                field.intValues.clear();
+                field.doubleValues.clear();
+                field.strValues.clear();
+            }
+        }
+    });
+
+    // Sort by value, keeping rows of the same value in ascending order
+    for(FieldIndex& field : fields)
+    {
+        std::stable_sort(field.sorted.begin(), field.sorted.end(),
+                [](const std::pair<int64_t, uint32_t>& a, const std::pair<int64_t, uint32_t>& b) { return a.first < b.first; });
+    }
+}
+
+const RowBitmap* Index::FieldIndex::Find(const Value& value) const
+{
+    int64_t num = 0;
+    if(value.GetIntegral(num))
+    {
+        auto it = intValues.find(num);
+        return (it == intValues.end() ? nullptr : &it->second);
+    }
+    if(value.IsDouble())
+    {
+        auto it = doubleValues.find(value.GetDouble());
+        return (it == doubleValues.end() ? nullptr : &it->second);
+    }
+    auto it = strValues.find(value.GetString());
+    return (it == strValues.end() ? nullptr : &it->second);
+}
+
+void Index::GetRange(const FieldIndex& field, int64_t lo, int64_t hi, RowBitmap& rows)
+{
+    rows.Clear();
+
+    if(lo <= hi)
+    {
+        auto begin = std::lower_bound(field.sorted.begin(), field.sorted.end(), lo,
+                [](const std::pair<int64_t, uint32_t>& entry, int64_t val) { return entry.first < val; });
+        auto end = std::upper_bound(begin, field.sorted.end(), hi,
+                [](int64_t val, const std::pair<int64_t, uint32_t>& entry) { return val < entry.first; });
+
+        // Matches are sorted by value, so sort them by row for the bitmap
+        std::vector<uint32_t> matches;
+        matches.reserve(end - begin);
+        for(auto it = begin; it != end; ++it)
+            matches.push_back(it->second);
+        std::sort(matches.begin(), matches.end());
+
+        for(uint32_t row : matches)
+            rows.Add(row);
+    }
+
+    if(lo == INT64_MIN && !field.stringRows.IsEmpty())
+    {
+        RowBitmap combined;
+        RowBitmap::Or(rows, field.stringRows, combined);
+        rows = std::move(combined);
+    }
+}
+
+size_t Index::GetBitmapCount() const
+{
+    size_t count = 0;
+    for(const FieldIndex& field : fields)
+        count += field.GetCardinality();
+    return count;
+}
+
+size_t Index::GetMemorySize() const
+{
+    size_t size = rows.capacity() * sizeof(std::string_view);
+    for(const FieldIndex& field : fields)
+    {
+        size += field.present.GetMemorySize() + field.stringRows.GetMemorySize() + field.doubleRows.GetMemorySize();
+        size += field.sorted.capacity() * sizeof(field.sorted[0]);
+        field.ForEach([&](const Value&, const RowBitmap& bitmap) { size += bitmap.GetMemorySize(); });
+    }
+    return size;
+}
+
+//
+// Constraints index evaluation
+//
+bool Constraints::EvaluateIndex(const Index& index, RowBitmap& result)
+{
+    if(!constraintsTree)
+    {
+        err = "Invalid (null) root logical node";
+        return false;
+    }
+    if(schema != &index.GetSchema())
+    {
+        err = "Constraints are not bound to the index schema";
+        return false;
+    }
+
+    return EvaluateIndexImpl(*constraintsTree, index, result);
+}
+
+bool Constraints::EvaluateIndexImpl(const Node& node, const Index& index, RowBitmap& result)
+{
+    Node::Type type = node.GetType();
+    result.Clear();
+
+    if(type == Node::GROUP)
+    {
+        const Group& group = (const Group&)node;
+        Node::Operator logicalOperator = group.GetOperator();
+
+        NodeList children = group.GetChildren();
+        if(children.empty())
+        {
+            err = "Badly formed logical expression";
+            return false;
+        }
+
+        if(logicalOperator != Node::AND && logicalOperator != Node::OR)
+        {
+            err = "Invalid group operand " +  GetOperatorStr(logicalOperator) + " in index evaluation.";
+            return false;
+        }
+
+        for(const Node* child : children)
+        {
+            if(!child)
+            {
+                err = "Badly formed logical expression";
+                return false;
+            }
+        }
+
+        // All bounds of a range on the same field are a single probe (even
+        // if the optimizer hasn't merged them)
+        struct Bounds
+        {
+            FieldId field;
+            int64_t lo;
+            int64_t hi;
+        };
+        std::vector<Bounds> ranges;
+        std::vector<bool> isRange(children.size(), false);
+        if(logicalOperator == Node::AND)
+        {
+            for(size_t i = 0; i < children.size(); i++)
+            {
+                FieldId fieldId = INVALID_FIELD_ID;
+                int64_t lo, hi;
+                if(!GetIndexRange(*children[i], fieldId, lo, hi))
+                    continue;
+                const Index::FieldIndex* field = index.GetField(fieldId);
+                if(!field || !field->HasRangeIndex())
+                    continue;
+
+                isRange[i] = true;
+                auto it = std::find_if(ranges.begin(), ranges.end(), [&](const Bounds& b) { return b.field == fieldId; });
+                if(it == ranges.end())
+                {
+                    ranges.push_back({fieldId, lo, hi});
+                    continue;
+                }
+                it->lo = std::max(it->lo, lo);
+                it->hi = std::min(it->hi, hi);
+            }
+        }
+
+        bool first = true;
+        RowBitmap childResult;
+        auto combine = [&]()
+        {
+            if(first)
+            {
+                result = std::move(childResult);
+                first = false;
+                return;
+            }
+
+            RowBitmap combined;
+            if(logicalOperator == Node::AND)
+                RowBitmap::And(result, childResult, combined);
+            else
+                RowBitmap::Or(result, childResult, combined);
+            result = std::move(combined);
+        };
+
+        for(const Bounds& range : ranges)
+        {
+            // Short circuit AND if no row passed
+            if(!first && result.IsEmpty())
+                return true;
+            Index::GetRange(*index.GetField(range.field), range.lo, range.hi, childResult);
+            combine();
+        }
+
+        for(size_t i = 0; i < children.size(); i++)
+        {
+            if(isRange[i])
+                continue;
+
+            // Short circuit AND if no row passed
+            if(!first && logicalOperator == Node::AND && result.IsEmpty())
+                return true;
+
+            if(!EvaluateIndexImpl(*children[i], index, childResult))
+                return false;
+            combine();
+        }
+    }
+    else if(type == Node::ELEMENT)
+    {
+        const Element& element = (const Element&)node;
+        Node::Operator logicalOperator = element.GetOperator();
+        const Value& operand = element.GetValue();
+
+        const Index::FieldIndex* field = index.GetField(element.GetFieldId());
+        if(!field)
+        {
+            // No row has a value for the field
+            return true;
+        }
+
+        // Integer range is a range index probe
+        FieldId fieldId = INVALID_FIELD_ID;
+        int64_t lo, hi;
+        if(field->HasRangeIndex() && GetIndexRange(element, fieldId, lo, hi))
+        {
+            Index::GetRange(*field, lo, hi, result);
+            return true;
+        }
+
+        if(!field->indexed)
+        {
+            err = "Field '" + std::string(element.GetName()) + "' is not indexed";
+            return false;
+        }
+
+        // Rows with the operand value
+        const RowBitmap* eq = field->Find(operand);
+
+        if(logicalOperator == Node::EQ)
+        {
+            if(eq)
+                result = *eq;
+        }
+        else if(logicalOperator == Node::NE)
+        {
+            if(eq)
+                RowBitmap::AndNot(field->present, *eq, result);
+            else
+                result = field->present;
+        }
+        else if(logicalOperator >= Node::LT && logicalOperator <= Node::GE)
+        {
+            // Union of the bitmaps of all values in the range
+            // (the field has a low cardinality)
+            field->ForEach([&](const Value& value, const RowBitmap& rows)
+            {
+                bool inRange = (logicalOperator == Node::LT ? value <  operand :
+                                logicalOperator == Node::LE ? value <= operand :
+                                logicalOperator == Node::GT ? value >  operand : value >= operand);
+                if(inRange)
+                {
+                    RowBitmap combined;
+                    RowBitmap::Or(result, rows, combined);
+                    result = std::move(combined);
+                }
+            });
+        }
+        else
+        {
+            err = "Invalid element operand " + GetOperatorStr(logicalOperator) + " in index evaluation.";
+            return false;
+        }
+    }
+    else if(type == Node::ELEMENT_IN)
+    {
+        const ElementIN& element = (const ElementIN&)node;
+
+        const Index::FieldIndex* field = index.GetField(element.GetFieldId());
+        if(!field)
+        {
+            // No row has a value for the field
+            return true;
+        }
+
+        if(!field->indexed)
+        {
+            err = "Field '" + std::string(element.GetName()) + "' is not indexed";
+            return false;
+        }
+
+        // Union of the bitmaps of the set values
+        element.GetValues().ForEach([&](const Value& value)
+        {
+            if(const RowBitmap* rows = field->Find(value))
+            {
+                RowBitmap combined;
+                RowBitmap::Or(result, *rows, combined);
+                result = std::move(combined);
+            }
+        });
+
+        // NOT IN: the rows with the field, but none of the values
+        if(element.IsNegated())
+        {
+            RowBitmap rest;
+            RowBitmap::AndNot(field->present, result, rest);
+            result = std::move(rest);
+        }
+    }
+    else if(type == Node::ELEMENT_RANGE)
+    {
+        const ElementRange& element = (const ElementRange&)node;
+
+        const Index::FieldIndex* field = index.GetField(element.GetFieldId());
+        if(!field)
+        {
+            // No row has a value for the field
+            return true;
+        }
+
+        // Integer interval is a single range index probe
+        FieldId fieldId = INVALID_FIELD_ID;
+        int64_t lo, hi;
+        if(field->HasRangeIndex() && GetIndexRange(element, fieldId, lo, hi))
+        {
+            Index::GetRange(*field, lo, hi, result);
+            return true;
+        }
+
+        if(!field->indexed)
+        {
+            err = "Field '" + std::string(element.GetName()) + "' is not indexed";
+            return false;
+        }
+
+        // Union of the bitmaps of all values in the range
+        field->ForEach([&](const Value& value, const RowBitmap& rows)
+        {
+            if(element.GetRange().Contains(value))
+            {
+                RowBitmap combined;
+                RowBitmap::Or(result, rows, combined);
+                result = std::move(combined);
+            }
+        });
+    }
+    else if(type == Node::CONSTANT)
+    {
+        if(((const Constant&)node).GetValue())
+            result.SetRange((uint32_t)index.GetRowCount());
+    }
+    else
+    {
+        err = "Invalid logical node type " + std::to_string(type) + " in index evaluation.";
+        return false;
+    }
+
+    return true;
+}
+
+namespace
+{
+
+// Converts a bound of a range into an inclusive integer bound (x > 2.5 is
+// x >= 3, x < 5 is x <= 4). Returns false if it is not a number, or out of
+// the range. INT64_MIN is not a lower bound, since GetRange() takes it as
+// no bound (see below).
+bool GetIntBound(const Value& value, bool inclusive, bool lower, int64_t& bound)
+{
+    if(value.IsInt())
+    {
+        int64_t num = value.GetInt();
+        if(!inclusive && num == (lower ? INT64_MAX : INT64_MIN))
+            return false;
+        bound = (inclusive ? num : lower ? num + 1 : num - 1);
+    }
+    else if(value.IsDouble())
+    {
+        double num = value.GetDouble();
+        double rounded = (lower ? std::ceil(num) : std::floor(num));
+        if(!inclusive && rounded == num)
+            rounded += (lower ? 1 : -1);
+        if(!(rounded >= -0x1p63 && rounded < 0x1p63))
+            return false;
+        bound = (int64_t)rounded;
+    }
+    else
+    {
+        return false;
+    }
+
+    return !(lower && bound == INT64_MIN);
+}
+
+} // namespace
+
+// Converts a range predicate with number operands into integer [lo, hi]
+bool Constraints::GetIndexRange(const Node& node, FieldId& field, int64_t& lo, int64_t& hi)
+{
+    if(node.GetType() == Node::ELEMENT_RANGE)
+    {
+        const ElementRange& element = (const ElementRange&)node;
+        const ValueRange& range = element.GetRange();
+        if(!GetIntBound(range.lo, range.loInclusive, true, lo) || !GetIntBound(range.hi, range.hiInclusive, false, hi))
+            return false;
+
+        field = element.GetFieldId();
+        return true;
+    }
+
+    if(node.GetType() != Node::ELEMENT)
+        return false;
+
+    const Element& element = (const Element&)node;
+    const Value& operand = element.GetValue();
+    lo = INT64_MIN;
+    hi = INT64_MAX;
+
+    bool isBound = false;
+    switch(element.GetOperator())
+    {
+        case Node::LT: isBound = GetIntBound(operand, false, false, hi); break;
+        case Node::LE: isBound = GetIntBound(operand, true, false, hi);  break;
+        case Node::GT: isBound = GetIntBound(operand, false, true, lo);  break;
+        case Node::GE: isBound = GetIntBound(operand, true, true, lo);   break;
+        default: return false;
+    }
+    if(!isBound)
+        return false;
+
+    field = element.GetFieldId();
+    return true;
+}
@@ -0,0 +1,107 @@
+//
+// index.h
+//
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <utility>          // std::pair
+#include <stdint.h>         // uint32_t, int64_t
+#include "record.h"
+#include "bitmap.h"
+#include "ingest.h"
+
+//
+// Class Index (inverted bitmap index and sorted range index).
+// Keeps a RowBitmap of the matching rows for every (field, value) pair of
+// the low cardinality fields of an input file, and the integer values of
+// every field sorted with their row numbers, so a range predicate is a
+// binary search (O(log n + matches)). Fields with fractional (double)
+// values have no range index. Constraints on the indexed fields are
+// evaluated with bitmap AND/OR (see Constraints::EvaluateIndex) without
+// reading the rows; only the matching rows are materialized.
+// Rows are the lines of the mapped file, which must outlive the Index.
+//
+class Index
+{
+public:
+    // Indexes of a single field
+    struct FieldIndex
+    {
+        RowBitmap present;      // Rows that have a value for the field
+
+        // Bitmap per value (only if the field is within the cardinality limit)
+        bool indexed{true};
+        std::unordered_map<int64_t, RowBitmap> intValues;       // Integral doubles too
+        std::unordered_map<double, RowBitmap> doubleValues;
+        std::unordered_map<std::string, RowBitmap> strValues;
+
+        // Range index: (value, row) pairs of the integer values sorted by
+        // the value, and rows with string values (less than any integer).
+        // Only used if there are no rows with fractional values.
+        std::vector<std::pair<int64_t, uint32_t>> sorted;
+        RowBitmap stringRows;
+        RowBitmap doubleRows;
+
+        size_t GetCardinality() const { return intValues.size() + doubleValues.size() + strValues.size(); }
+        bool HasRangeIndex() const { return doubleRows.IsEmpty(); }
+
+        // Rows with the value (nullptr if there are none)
+        const RowBitmap* Find(const Value& value) const;
+
+        // Calls func(const Value&, const RowBitmap&) for every distinct value
+        template<class FUNC>
+        void ForEach(FUNC func) const
+        {
+            for(const auto& [val, rows] : intValues)
+                func(Value(val), rows);
+            for(const auto& [val, rows] : doubleValues)
+                func(Value(val), rows);
+            for(const auto& [val, rows] : strValues)
+                func(Value(val), rows);
+        }
+    };
+
+    Index(Schema& schemaIn) : schema(&schemaIn) {}
+    ~Index() = default;
+
+    // Indexes all lines of the file. Fields with more than maxCardinality
+    // distinct values get no bitmaps (only integer ranges on them can be
+    // evaluated with the index).
+    void Build(const MappedFile& file, size_t maxCardinality = 1024);
+
+    size_t GetRowCount() const { return rows.size(); }
+    std::string_view GetRow(uint32_t row) const { return rows[row]; }
+
+    // Returns nullptr if the file has no values for the field
+    const FieldIndex* GetField(FieldId id) const { return (id < fields.size() ? &fields[id] : nullptr); }
+
+    // Rows with the field value in [lo, hi] (one binary search for both
+    // bounds). Rows with a string value are in any range that has no
+    // lower bound (lo == INT64_MIN), since a string is less than a number.
+    static void GetRange(const FieldIndex& field, int64_t lo, int64_t hi, RowBitmap& rows);
+
+    const Schema& GetSchema() const { return *schema; }
+
+    // Data version stamp: unique for every Build() (see QueryCache)
+    uint64_t GetVersion() const { return version; }
+
+    // Diagnostic
+    size_t GetBitmapCount() const;
+    size_t GetMemorySize() const;
+
+private:
+    Schema* schema{nullptr};
+    std::vector<std::string_view> rows; // Lines of the mapped file
+    std::vector<FieldIndex> fields;     // By FieldId
+    uint64_t version{0};
+
+    // Omit implementation of the copy constructor and assignment operator
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+};
+
+#endif // __INDEX_H__
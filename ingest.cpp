@@ -0,0 +1,211 @@
+//
+// ingest.cpp
+//
+#include <fcntl.h>          // open()
+#include <sys/mman.h>       // mmap()
+#include <sys/stat.h>       // fstat()
+#include <sys/inotify.h>    // inotify_init1()
+#include <poll.h>           // poll()
+#include <unistd.h>         // close(), pread()
+#include <string.h>         // strerror()
+#include <errno.h>
+#include "ingest.h"
+
+//
+// MappedFile
+//
+bool MappedFile::Open(const char* fileName)
+{
+    Close();
+
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0)
+    {
+        err = std::string("Cannot open file '") + fileName + "': " + strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        err = std::string("Cannot stat file '") + fileName + "': " + strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    if(size > 0)
+    {
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED)
+        {
+            err = std::string("Cannot map file '") + fileName + "': " + strerror(errno);
+            size = 0;
+            close(fd);
+            return false;
+        }
+
+        // The file is scanned once from the beginning to the end
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        data = (const char*)ptr;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data)
+        munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+}
+
+//
+// FollowedFile
+//
+bool FollowedFile::Open(const char* fileNameIn)
+{
+    Close();
+    fileName = fileNameIn;
+
+    fd = open(fileNameIn, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        err = "Cannot open file '" + fileName + "': " + strerror(errno);
+        return false;
+    }
+
+    // Watch before the first read, so no append is missed
+    inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(inotifyFd < 0 || inotify_add_watch(inotifyFd, fileNameIn, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+    {
+        err = "Cannot watch file '" + fileName + "': " + strerror(errno);
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void FollowedFile::Close()
+{
+    if(fd >= 0)
+        close(fd);
+    if(inotifyFd >= 0)
+        close(inotifyFd);
+    fd = inotifyFd = -1;
+    offset = 0;
+    buffer.clear();
+}
+
+long FollowedFile::Read()
+{
+    if(fd < 0)
+    {
+        err = "File is not open";
+        return -1;
+    }
+
+    uint64_t readOffset = offset + buffer.size();
+
+    // Truncated (rewritten) file: start over
+    struct stat st;
+    if(fstat(fd, &st) == 0 && (uint64_t)st.st_size < readOffset)
+    {
+        offset = readOffset = 0;
+        buffer.clear();
+    }
+
+    size_t size = buffer.size();
+    buffer.resize(size + READ_SIZE);
+    ssize_t count = pread(fd, buffer.data() + size, READ_SIZE, readOffset);
+    buffer.resize(size + std::max<ssize_t>(count, 0));
+
+    if(count < 0)
+        err = "Cannot read file '" + fileName + "': " + strerror(errno);
+    return count;
+}
+
+bool FollowedFile::Wait(int timeoutMs /*=-1*/)
+{
+    pollfd pfd{inotifyFd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeoutMs);
+    if(ready < 0)
+    {
+        err = std::string("Cannot wait for the file changes: ") + strerror(errno);
+        return false;
+    }
+
+    // Drain the events: any number of modifications is a single read
+    alignas(inotify_event) char events[4096];
+    for(ssize_t size; ready > 0 && (size = read(inotifyFd, events, sizeof(events))) > 0; )
+    {
+        for(ssize_t pos = 0; pos < size; )
+        {
+            // Note: While the file is open, it isn't removed on deletion
+            // (no IN_DELETE_SELF), only its link count drops to 0
+            const inotify_event* event = (const inotify_event*)(events + pos);
+            struct stat st;
+            if((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) ||
+               ((event->mask & IN_ATTRIB) && fstat(fd, &st) == 0 && st.st_nlink == 0))
+            {
+                err = "File '" + fileName + "' was deleted or moved";
+                return false;
+            }
+            pos += sizeof(inotify_event) + event->len;
+        }
+    }
+    return true;
+}
+
+//
+// LineParser
+//
+std::string_view LineParser::Trim(std::string_view str)
+{
+    const char* whiteSpace = " \t\v\r\n";
+    size_t start = str.find_first_not_of(whiteSpace);
+    if(start == std::string_view::npos)
+        return std::string_view();
+    size_t end = str.find_last_not_of(whiteSpace);
+    return str.substr(start, end - start + 1);
+}
+
+void LineParser::Parse(std::string_view line, Record& rec)
+{
+    rec.Clear();
+
+    size_t pos = 0;
+    for(size_t index = 0; pos <= line.size(); index++)
+    {
+        // Next comma separated token
+        size_t end = line.find(',', pos);
+        if(end == std::string_view::npos)
+            end = line.size();
+        std::string_view token = line.substr(pos, end - pos);
+        pos = end + 1;
+
+        // Spit token into name and value
+        size_t eq = token.find('=');
+        if(eq == std::string_view::npos)
+            continue;
+
+        std::string_view name = Trim(token.substr(0, eq));
+        std::string_view value = Trim(token.substr(eq + 1));
+
+        // Look up the field id, first in the cache by the token position
+        if(index >= fieldCache.size())
+            fieldCache.resize(index + 1, std::make_pair(std::string(), INVALID_FIELD_ID));
+
+        auto& [cachedName, cachedId] = fieldCache[index];
+        if(cachedId == INVALID_FIELD_ID || cachedName != name)
+        {
+            cachedName.assign(name.data(), name.size());
+            cachedId = schema->Bind(name);
+        }
+
+        rec.SetValue(cachedId, value, schema->GetDictionary(cachedId));
+    }
+}
@@ -0,0 +1,188 @@
+//
+// ingest.h
+//
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <string>
+#include <string_view>
+#include <utility>          // std::pair
+#include <type_traits>      // std::is_same_v
+#include <vector>
+#include <string.h>         // memchr
+#include <stdint.h>         // uint64_t
+#include "record.h"
+
+//
+// Class MappedFile.
+// Read-only memory mapping of the whole input file.
+//
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+
+    bool Open(const char* fileName);
+    void Close();
+
+    const char* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+    const std::string& GetError() const { return err; }
+
+    // Calls func(std::string_view line) for every line of the file.
+    // Lines don't include the '\n' (and '\r' of "\r\n") terminator.
+    // If func returns bool, then the iteration stops once it returns false.
+    // Returns false if it stopped before the last line.
+    template<class FUNC>
+    bool ForEachLine(FUNC func) const { return ForEachLine(data, data + size, func); }
+
+    template<class FUNC>
+    static bool ForEachLine(const char* begin, const char* end, FUNC func);
+
+private:
+    const char* data{nullptr};
+    size_t size{0};
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+template<class FUNC>
+bool MappedFile::ForEachLine(const char* begin, const char* end, FUNC func)
+{
+    for(const char* ptr = begin; ptr < end; )
+    {
+        const char* eol = (const char*)memchr(ptr, '\n', end - ptr);
+        const char* next = (eol ? eol + 1 : end);
+        if(!eol)
+            eol = end;
+
+        if(eol > ptr && eol[-1] == '\r')
+            eol--;
+
+        std::string_view line(ptr, eol - ptr);
+        ptr = next;
+
+        if constexpr(std::is_same_v<decltype(func(line)), bool>)
+        {
+            if(!func(line))
+                return ptr >= end;
+        }
+        else
+        {
+            func(line);
+        }
+    }
+    return true;
+}
+
+//
+// Class FollowedFile.
+// Reads the lines appended to a growing file (as "tail -f" does). The file
+// offset is kept between reads, so a read costs only the size of the new
+// data, and only complete lines are returned (a partial last line is kept
+// until its '\n' arrives). Appends are waited for with inotify. If the file
+// is truncated, it is read again from the beginning.
+//
+class FollowedFile
+{
+public:
+    FollowedFile() = default;
+    ~FollowedFile() { Close(); }
+
+    // Opens the file and starts watching it (the lines already in the
+    // file are returned by the first ReadLines)
+    bool Open(const char* fileName);
+    void Close();
+
+    // Calls func(std::string_view line) for every complete line appended
+    // since the last call (as MappedFile::ForEachLine does; if func returns
+    // false, the rest of the lines is skipped). Returns false on error.
+    template<class FUNC>
+    bool ReadLines(FUNC func);
+
+    // Waits until the file is modified (or timeoutMs elapses, -1 for no
+    // timeout). Returns false if the file is deleted or moved (it can't
+    // be followed), or on error.
+    bool Wait(int timeoutMs = -1);
+
+    uint64_t GetOffset() const { return offset; }   // End of the last returned line
+    const std::string& GetError() const { return err; }
+
+private:
+    // Reads up to READ_SIZE new bytes after the buffered ones. Returns the
+    // number of bytes read, or -1 on error.
+    long Read();
+
+    static constexpr size_t READ_SIZE = 1024 * 1024;
+
+    std::string fileName;
+    int fd{-1};
+    int inotifyFd{-1};
+    uint64_t offset{0};
+    std::vector<char> buffer;       // Bytes after offset (a partial line)
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    FollowedFile(const FollowedFile&) = delete;
+    FollowedFile& operator=(const FollowedFile&) = delete;
+};
+
+template<class FUNC>
+bool FollowedFile::ReadLines(FUNC func)
+{
+    bool done = false;
+    for(long count; !done && (count = Read()) != 0; )
+    {
+        if(count < 0)
+            return false;
+
+        // Complete lines only
+        const char* begin = buffer.data();
+        const char* last = (const char*)memrchr(begin, '\n', buffer.size());
+        if(!last)
+            continue;
+
+        const char* end = last + 1;
+        MappedFile::ForEachLine(begin, end, [&](std::string_view line)
+        {
+            if constexpr(std::is_same_v<decltype(func(line)), bool>)
+                done = done || !func(line);
+            else
+                func(line);
+            return !done;
+        });
+
+        offset += end - begin;
+        buffer.erase(buffer.begin(), buffer.begin() + (end - begin));
+    }
+    return true;
+}
+
+//
+// Class LineParser.
+// Tokenizes "name=value, name=value, ..." lines in place (with
+// std::string_view) into a reusable Record. Field ids are cached by
+// the token position, so lines with the same layout don't look up the
+// Schema, and steady state parsing doesn't allocate.
+//
+class LineParser
+{
+public:
+    LineParser(Schema& schemaIn) : schema(&schemaIn) {}
+    ~LineParser() = default;
+
+    void Parse(std::string_view line, Record& rec);
+
+    // Trims leading/trailing white spaces
+    static std::string_view Trim(std::string_view str);
+
+private:
+    Schema* schema{nullptr};
+    std::vector<std::pair<std::string, FieldId>> fieldCache; // By token position
+};
+
+#endif // __INGEST_H__
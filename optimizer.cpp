@@ -0,0 +1,407 @@
+//
+// optimizer.cpp
+//
+#include <unordered_set>
+#include "constraints.h"
+
+//
+// Constraints optimizer (algebraic simplification of the parsed tree)
+//
+namespace
+{
+
+// Bound of the range predicates on a field (no bound if value is nullptr)
+struct Bound
+{
+    const Value* value{nullptr};
+    bool inclusive{false};
+};
+
+bool Below(const Value& val, const Bound& hi)
+{
+    return !hi.value || (hi.inclusive ? val <= *hi.value : val < *hi.value);
+}
+
+bool Above(const Value& val, const Bound& lo)
+{
+    return !lo.value || (lo.inclusive ? val >= *lo.value : val > *lo.value);
+}
+
+} // namespace
+
+Constraints::Node* Constraints::Optimize(Node* node)
+{
+    if(node->GetType() != Node::GROUP)
+        return node;
+
+    // Note: Badly formed groups are left for the compilation to report
+    Group* group = (Group*)node;
+    Node::Operator oper = group->GetOperator();
+    if(oper != Node::AND && oper != Node::OR)
+        return node;
+
+    bool isAnd = (oper == Node::AND);
+
+    // Flatten the (simplified) nested groups of the same operator
+    std::vector<Node*> operands;
+    for(Node* child : group->GetChildren())
+    {
+        if(!child)
+            return node;
+
+        child = Optimize(child);
+        if(child->GetType() == Node::GROUP && child->GetOperator() == oper)
+        {
+            NodeList children = ((Group*)child)->GetChildren();
+            operands.insert(operands.end(), children.begin(), children.end());
+        }
+        else
+        {
+            operands.push_back(child);
+        }
+    }
+
+    // FALSE absorbs AND and TRUE absorbs OR, the other constant is dropped.
+    // Duplicate operands are dropped too (x AND x is x).
+    std::vector<Node*> unique;
+    std::unordered_set<std::string> keys;
+    for(Node* operand : operands)
+    {
+        if(operand->GetType() == Node::CONSTANT)
+        {
+            if(((Constant*)operand)->GetValue() != isAnd)
+                return operand;
+            continue;
+        }
+
+        if(keys.insert(GetCanonical(operand)).second)
+            unique.push_back(operand);
+    }
+
+    if(!MergePredicates(unique, isAnd))
+        return NewConstant(!isAnd);
+
+    if(unique.empty())
+        return NewConstant(isAnd);
+    if(unique.size() == 1)
+        return unique.front();
+
+    SetChildren(group, unique);
+    SetGroupConstraints(group);
+    return group;
+}
+
+// Merges the predicates on the same field. Returns false if the group is
+// a contradiction (AND) or a tautology (OR) of the predicates of a field.
+bool Constraints::MergePredicates(std::vector<Node*>& operands, bool isAnd)
+{
+    auto isPredicate = [](const Node* node)
+    {
+        return (node->GetType() == Node::ELEMENT && node->GetOperator() >= Node::EQ && node->GetOperator() <= Node::GE) ||
+               node->GetType() == Node::ELEMENT_RANGE;
+    };
+
+    auto getName = [](const Node* node)
+    {
+        return (node->GetType() == Node::ELEMENT_RANGE ? ((const ElementRange*)node)->GetName() :
+                                                         ((const Element*)node)->GetName());
+    };
+
+    std::vector<Node*> result;
+    std::vector<bool> merged(operands.size(), false);
+
+    for(size_t i = 0; i < operands.size(); i++)
+    {
+        if(merged[i])
+            continue;
+
+        if(!isPredicate(operands[i]))
+        {
+            result.push_back(operands[i]);
+            continue;
+        }
+
+        // Predicates on the field, in place of the first one
+        std::string_view name = getName(operands[i]);
+        std::vector<Node*> preds;
+        for(size_t j = i; j < operands.size(); j++)
+        {
+            if(!merged[j] && isPredicate(operands[j]) && getName(operands[j]) == name)
+            {
+                preds.push_back(operands[j]);
+                merged[j] = true;
+            }
+        }
+
+        if(preds.size() == 1)
+            result.push_back(preds.front());
+        else if(!(isAnd ? MergeAnd(name, preds, result) : MergeOr(preds, result)))
+            return false;
+    }
+
+    operands.swap(result);
+    return true;
+}
+
+// Intersection of the predicates on a field: a single equality, or the
+// tightest bounds (as a single interval) and the != values within them
+bool Constraints::MergeAnd(std::string_view name, const std::vector<Node*>& preds, std::vector<Node*>& result)
+{
+    Bound lo, hi;
+    Node* loNode = nullptr;     // Predicates the bounds came from
+    Node* hiNode = nullptr;
+    Node* eq = nullptr;
+    std::vector<Node*> ne;
+
+    auto tightenLo = [&](const Value& val, bool inclusive, Node* node)
+    {
+        if(!lo.value || val > *lo.value || (val == *lo.value && !inclusive))
+        {
+            lo = {&val, inclusive};
+            loNode = node;
+        }
+    };
+    auto tightenHi = [&](const Value& val, bool inclusive, Node* node)
+    {
+        if(!hi.value || val < *hi.value || (val == *hi.value && !inclusive))
+        {
+            hi = {&val, inclusive};
+            hiNode = node;
+        }
+    };
+
+    for(Node* pred : preds)
+    {
+        if(pred->GetType() == Node::ELEMENT_RANGE)
+        {
+            const ValueRange& range = ((ElementRange*)pred)->GetRange();
+            tightenLo(range.lo, range.loInclusive, pred);
+            tightenHi(range.hi, range.hiInclusive, pred);
+            continue;
+        }
+
+        const Value& val = ((Element*)pred)->GetValue();
+        switch(pred->GetOperator())
+        {
+            case Node::EQ:
+                if(eq && ((Element*)eq)->GetValue() != val)
+                    return false; // x == a AND x == b
+                eq = pred;
+                break;
+
+            case Node::NE: ne.push_back(pred); break;
+            case Node::LT: tightenHi(val, false, pred); break;
+            case Node::LE: tightenHi(val, true, pred); break;
+            case Node::GT: tightenLo(val, false, pred); break;
+            default:       tightenLo(val, true, pred); break;
+        }
+    }
+
+    // Equality implies all other predicates, or contradicts one of them
+    if(eq)
+    {
+        const Value& val = ((Element*)eq)->GetValue();
+        if(!Above(val, lo) || !Below(val, hi))
+            return false;
+        for(const Node* pred : ne)
+        {
+            if(((const Element*)pred)->GetValue() == val)
+                return false;
+        }
+
+        result.push_back(eq);
+        return true;
+    }
+
+    // Note: Numbers are dense (a field may have double values), so
+    // (5, 6) is not empty and [5, 6) is not a single value
+    if(lo.value && hi.value)
+    {
+        if(*lo.value > *hi.value || (*lo.value == *hi.value && !(lo.inclusive && hi.inclusive)))
+            return false; // Empty interval
+
+        if(*lo.value == *hi.value)
+        {
+            // Single value interval, but != may exclude it
+            const Value& val = *lo.value;
+            for(const Node* pred : ne)
+            {
+                if(((const Element*)pred)->GetValue() == val)
+                    return false;
+            }
+
+            result.push_back(NewElement(name, val, Node::EQ));
+            return true;
+        }
+
+        if(loNode == hiNode)
+        {
+            result.push_back(loNode);
+        }
+        else
+        {
+            ValueRange range{*lo.value, *hi.value, lo.inclusive, hi.inclusive};
+            ElementRange* elem = arena.New<ElementRange>(name, range);
+            if(diagnostics)
+                elem->SetConstraints(arena.CopyString(GetCanonical(elem)));
+            result.push_back(elem);
+        }
+    }
+    else if(lo.value || hi.value)
+    {
+        result.push_back(lo.value ? loNode : hiNode);
+    }
+
+    // != values out of the bounds are implied by them
+    for(Node* pred : ne)
+    {
+        const Value& val = ((Element*)pred)->GetValue();
+        if(Above(val, lo) && Below(val, hi))
+            result.push_back(pred);
+    }
+
+    return true;
+}
+
+// Union of the predicates on a field: the loosest bounds, and the values
+// and intervals not within them. Tautologies, such as x < 5 OR x >= 5 and
+// x == 5 OR x != 5, return false.
+bool Constraints::MergeOr(const std::vector<Node*>& preds, std::vector<Node*>& result)
+{
+    Bound lo, hi;
+    Node* loNode = nullptr;     // Predicates the bounds came from
+    Node* hiNode = nullptr;
+    std::vector<Node*> ne;
+
+    auto loosenLo = [&](const Value& val, bool inclusive, Node* node)
+    {
+        if(!lo.value || val < *lo.value || (val == *lo.value && inclusive))
+        {
+            lo = {&val, inclusive};
+            loNode = node;
+        }
+    };
+    auto loosenHi = [&](const Value& val, bool inclusive, Node* node)
+    {
+        if(!hi.value || val > *hi.value || (val == *hi.value && inclusive))
+        {
+            hi = {&val, inclusive};
+            hiNode = node;
+        }
+    };
+
+    for(Node* pred : preds)
+    {
+        if(pred->GetType() == Node::ELEMENT_RANGE)
+            continue;
+
+        const Value& val = ((Element*)pred)->GetValue();
+        switch(pred->GetOperator())
+        {
+            case Node::NE: ne.push_back(pred); break;
+            case Node::LT: loosenHi(val, false, pred); break;
+            case Node::LE: loosenHi(val, true, pred); break;
+            case Node::GT: loosenLo(val, false, pred); break;
+            case Node::GE: loosenLo(val, true, pred); break;
+            default:       break;
+        }
+    }
+
+    // x < a OR x > b covers all values if a > b
+    if(lo.value && hi.value)
+    {
+        if(*hi.value > *lo.value || (*hi.value == *lo.value && (lo.inclusive || hi.inclusive)))
+            return false;
+    }
+
+    // Does another predicate of the field pass for the value?
+    auto passes = [&](const Value& val, const Node* except)
+    {
+        if((lo.value && Above(val, lo)) || (hi.value && Below(val, hi)))
+            return true;
+
+        for(const Node* pred : preds)
+        {
+            if(pred == except)
+                continue;
+            if(pred->GetType() == Node::ELEMENT_RANGE && ((const ElementRange*)pred)->GetRange().Contains(val))
+                return true;
+            if(pred->GetType() == Node::ELEMENT && pred->GetOperator() == Node::EQ &&
+               ((const Element*)pred)->GetValue() == val)
+                return true;
+        }
+        return false;
+    };
+
+    // x != a OR x != b is a tautology (the values are distinct, as the
+    // duplicates are removed), and so is x != a OR p where p passes for a.
+    // Otherwise, x != a implies the other predicates.
+    if(!ne.empty())
+    {
+        if(ne.size() > 1 || passes(((const Element*)ne.front())->GetValue(), ne.front()))
+            return false;
+
+        result.push_back(ne.front());
+        return true;
+    }
+
+    for(Node* pred : preds)
+    {
+        if(pred->GetType() == Node::ELEMENT_RANGE)
+        {
+            // Keep the intervals that are not within the bounds
+            const ValueRange& range = ((const ElementRange*)pred)->GetRange();
+            if(!(lo.value && Above(range.lo, lo)) && !(hi.value && Below(range.hi, hi)))
+                result.push_back(pred);
+        }
+        else if(pred->GetOperator() == Node::EQ)
+        {
+            // Keep the values that are not within the bounds
+            const Value& val = ((const Element*)pred)->GetValue();
+            if(!(lo.value && Above(val, lo)) && !(hi.value && Below(val, hi)))
+                result.push_back(pred);
+        }
+        else if(pred == loNode || pred == hiNode)
+        {
+            result.push_back(pred);
+        }
+    }
+
+    return true;
+}
+
+Constraints::Node* Constraints::NewElement(std::string_view name, const Value& value, Node::Operator oper)
+{
+    Element* elem = arena.New<Element>(name, value, oper);
+    if(diagnostics)
+        elem->SetConstraints(arena.CopyString(GetCanonical(elem)));
+    return elem;
+}
+
+Constraints::Node* Constraints::NewConstant(bool value)
+{
+    Constant* constant = arena.New<Constant>(value);
+    if(diagnostics)
+        constant->SetConstraints(arena.CopyString(value ? "TRUE" : "FALSE"));
+    return constant;
+}
+
+// Rebuilds the diagnostic string of a group from its children
+// (the same way the parsed constraints are written)
+void Constraints::SetGroupConstraints(Group* group)
+{
+    if(!diagnostics)
+        return;
+
+    std::string str;
+    for(const Node* child : group->GetChildren())
+    {
+        if(!str.empty())
+            str += ' ' + GetOperatorStr(group->GetOperator()) + ' ';
+        if(child->GetType() == Node::GROUP)
+            str += '(' + std::string(child->GetConstraints()) + ')';
+        else
+            str += child->GetConstraints();
+    }
+    group->SetConstraints(arena.CopyString(str));
+}
@@ -0,0 +1,119 @@
+//
+// output.h
+//
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <iostream>         // std::cout
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>         // std::to_chars
+#include <unistd.h>         // write()
+#include <poll.h>           // poll()
+#include <errno.h>
+#include "record.h"
+
+//
+// Class OutputBuffer.
+// Collects the output in memory and writes it to the stream in large
+// blocks, so a printed row neither flushes the stream (as std::endl does)
+// nor costs a write system call.
+// Note: Flush() the buffer before writing to the stream directly, and
+// the stream after that if the output must be visible at once.
+// The output can also go to a file descriptor (a socket), unbuffered by
+// a stream. Once a write to it fails, the rest of the output is dropped
+// (see IsFailed). A non-blocking descriptor is polled while it is full,
+// and the write fails if cancelFd becomes readable or the descriptor
+// stays full for timeoutMs (-1 waits forever).
+//
+class OutputBuffer
+{
+public:
+    OutputBuffer(std::ostream& osIn, size_t capacityIn = 64 * 1024) : os(&osIn), capacity(capacityIn)
+        { buffer.reserve(capacity); }
+    OutputBuffer(int fdIn, int cancelFdIn = -1, int timeoutMsIn = -1, size_t capacityIn = 64 * 1024)
+        : fd(fdIn), cancelFd(cancelFdIn), timeoutMs(timeoutMsIn), capacity(capacityIn)
+        { buffer.reserve(capacity); }
+    ~OutputBuffer() { Flush(); }
+
+    void Write(std::string_view str)
+    {
+        buffer.append(str);
+        Commit();
+    }
+
+    void WriteInt(int64_t value)
+    {
+        char buf[24];
+        auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        buffer.append(buf, ptr - buf);
+        Commit();
+    }
+
+    // Writes the record line (see Record::Format)
+    void Write(const Record& rec, const std::vector<FieldId>* fields = nullptr)
+    {
+        rec.Format(buffer, fields);
+        Commit();
+    }
+
+    void Flush()
+    {
+        if(buffer.empty())
+            return;
+        if(os)
+            os->write(buffer.data(), buffer.size());
+        else
+            WriteFd();
+        buffer.clear();
+    }
+
+    bool IsFailed() const { return failed; }
+
+private:
+    void WriteFd()
+    {
+        for(size_t pos = 0; pos < buffer.size() && !failed; )
+        {
+            ssize_t count = write(fd, buffer.data() + pos, buffer.size() - pos);
+            if(count > 0)
+                pos += count;
+            else if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                failed = !WaitFd();
+            else if(count < 0 && errno != EINTR)
+                failed = true;
+        }
+    }
+
+    // Waits until the descriptor is writable. Returns false if canceled
+    // or timed out.
+    bool WaitFd()
+    {
+        pollfd fds[2] = {{fd, POLLOUT, 0}, {cancelFd, POLLIN, 0}};
+        int ret = poll(fds, (cancelFd >= 0 ? 2 : 1), timeoutMs);
+        if(ret < 0)
+            return errno == EINTR;
+        return ret > 0 && !fds[1].revents;
+    }
+
+    void Commit()
+    {
+        if(buffer.size() >= capacity)
+            Flush();
+    }
+
+    std::ostream* os{nullptr};
+    int fd{-1};
+    int cancelFd{-1};
+    int timeoutMs{-1};
+    const size_t capacity;
+    std::string buffer;
+    bool failed{false};
+
+    // Omit implementation of the copy constructor and assignment operator
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+};
+
+#endif // __OUTPUT_H__
@@ -0,0 +1,62 @@
+//
+// querycache.cpp
+//
+#include "querycache.h"
+
+QueryCache::Rows QueryCache::Find(const std::string& key, uint64_t dataVersion)
+{
+    auto it = keys.find(key);
+    if(it == keys.end())
+    {
+        misses++;
+        return nullptr;
+    }
+
+    // Result of another data version is stale
+    if(it->second->dataVersion != dataVersion)
+    {
+        Erase(it->second);
+        misses++;
+        return nullptr;
+    }
+
+    // Move to the front of the LRU list
+    entries.splice(entries.begin(), entries, it->second);
+    hits++;
+    return entries.front().rows;
+}
+
+QueryCache::Rows QueryCache::Insert(const std::string& key, uint64_t dataVersion, RowBitmap rows)
+{
+    auto it = keys.find(key);
+    if(it != keys.end())
+        Erase(it->second);
+
+    size_t size = sizeof(Entry) + 2 * key.size() + rows.GetMemorySize();
+    Rows shared = std::make_shared<const RowBitmap>(std::move(rows));
+    if(size > memoryLimit)
+        return shared;
+
+    // Evict the least recently used entries
+    while(!entries.empty() && memorySize + size > memoryLimit)
+        Erase(std::prev(entries.end()));
+
+    entries.push_front({key, dataVersion, shared, size});
+    keys.emplace(key, entries.begin());
+    memorySize += size;
+    return shared;
+}
+
+void QueryCache::Erase(EntryList::iterator it)
+{
+    memorySize -= it->memorySize;
+    keys.erase(it->key);
+    entries.erase(it);
+}
+
+void QueryCache::Clear()
+{
+    entries.clear();
+    keys.clear();
+    memorySize = 0;
+}
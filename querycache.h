@@ -0,0 +1,71 @@
+//
+// querycache.h
+//
+#ifndef __QUERYCACHE_H__
+#define __QUERYCACHE_H__
+
+#include <list>
+#include <memory>           // std::shared_ptr
+#include <string>
+#include <unordered_map>
+#include <stdint.h>         // uint64_t
+#include "bitmap.h"
+
+//
+// Class QueryCache.
+// LRU cache of query results (matching row ids) keyed by the canonical
+// form of the constraints (see Constraints::GetCanonical), so queries that
+// differ only in whitespace, quoting or operand order share an entry.
+// Every entry is stamped with the version of the data it was computed for
+// (see Index::GetVersion) and is not returned for another version. The
+// least recently used entries are evicted to keep the memory limit.
+//
+class QueryCache
+{
+public:
+    using Rows = std::shared_ptr<const RowBitmap>;
+
+    QueryCache(size_t memoryLimitIn = 64 * 1024 * 1024) : memoryLimit(memoryLimitIn) {}
+    ~QueryCache() = default;
+
+    // Returns nullptr if there is no entry for the data version
+    Rows Find(const std::string& key, uint64_t dataVersion);
+
+    // Returns the inserted rows
+    // Note: Results larger than the memory limit are not cached
+    Rows Insert(const std::string& key, uint64_t dataVersion, RowBitmap rows);
+
+    void Clear();
+
+    // Diagnostic
+    size_t GetSize() const { return entries.size(); }
+    size_t GetMemorySize() const { return memorySize; }
+    size_t GetHits() const { return hits; }
+    size_t GetMisses() const { return misses; }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        uint64_t dataVersion{0};
+        Rows rows;
+        size_t memorySize{0};
+    };
+
+    using EntryList = std::list<Entry>;
+
+    void Erase(EntryList::iterator it);
+
+    EntryList entries;  // Most recently used first
+    std::unordered_map<std::string, EntryList::iterator> keys;
+    size_t memoryLimit{0};
+    size_t memorySize{0};
+    size_t hits{0};
+    size_t misses{0};
+
+    // Omit implementation of the copy constructor and assignment operator
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+};
+
+#endif // __QUERYCACHE_H__
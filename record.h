@@ -0,0 +1,228 @@
+//
+// record.h
+//
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <iostream>         // std::cout
+#include <algorithm>        // std::fill
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <type_traits>      // std::void_t
+#include <utility>          // std::declval
+#include <stdint.h>         // uint32_t
+#include "value.h"
+
+// Small integer id of a field, assigned by the Schema
+using FieldId = uint32_t;
+constexpr FieldId INVALID_FIELD_ID = (FieldId)-1;
+
+//
+// Class Schema (field registry).
+// Maps field names to dense integer ids. Constraints bind their field
+// names against the Schema at parse time, and Records store their values
+// by these ids, so evaluation never has to look up a field by name.
+//
+class Schema
+{
+public:
+    Schema() = default;
+    ~Schema() = default;
+
+    // Returns id of the existing field or registers a new one
+    FieldId Bind(std::string_view name)
+    {
+        auto it = ids.find(name);
+        if(it != ids.end())
+            return it->second;
+
+        FieldId id = (FieldId)names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), id);
+        return id;
+    }
+
+    // Returns id of the existing field or INVALID_FIELD_ID
+    FieldId Find(std::string_view name) const
+    {
+        auto it = ids.find(name);
+        return (it == ids.end() ? INVALID_FIELD_ID : it->second);
+    }
+
+    const std::string& GetName(FieldId id) const { return names[id]; }
+    size_t GetSize() const { return names.size(); }
+
+    // String values of the encoded fields are interned in the schema
+    // Dictionary, so records and constraints carry integer codes for them
+    void SetEncoded(FieldId id)
+    {
+        if(id >= encoded.size())
+            encoded.resize(id + 1, false);
+        encoded[id] = true;
+    }
+    void SetEncodeAll(bool encodeAllIn) { encodeAll = encodeAllIn; }
+    bool IsEncoded(FieldId id) const { return encodeAll || (id < encoded.size() && encoded[id]); }
+
+    // Returns nullptr if the field is not encoded
+    Dictionary* GetDictionary(FieldId id) { return (IsEncoded(id) ? &dict : nullptr); }
+    const Dictionary& GetDictionary() const { return dict; }
+
+    // Iterates over (name, id) pairs ordered by name
+    template<class FUNC>
+    void ForEach(FUNC func) const
+    {
+        for(const auto& [name, id] : ids)
+            func(name, id);
+    }
+
+private:
+    // Note: std::less<> allows look up by std::string_view without
+    // constructing a temporary std::string
+    std::map<std::string, FieldId, std::less<>> ids;
+    std::vector<std::string> names;
+
+    Dictionary dict;
+    std::vector<char> encoded;  // By FieldId
+    bool encodeAll{false};
+};
+
+//
+// Class Record.
+// Stores values in a flat array indexed by FieldId of the Schema.
+// Record can be reused for many rows: Clear() only resets presence flags
+// so the values (and their string buffers) are recycled.
+//
+class Record
+{
+public:
+    Record(const Schema& schemaIn) : schema(&schemaIn) {}
+    ~Record() = default;
+
+    const Value* GetValue(FieldId id) const
+    {
+        return (id < present.size() && present[id] ? &values[id] : nullptr);
+    }
+
+    void SetValue(FieldId id, const std::string& valueStr)
+    {
+        Reserve(id);
+        values[id] = valueStr;
+        present[id] = true;
+    }
+
+    void SetValue(FieldId id, const Value& value)
+    {
+        Reserve(id);
+        values[id] = value;
+        present[id] = true;
+    }
+
+    void SetValue(FieldId id, int64_t value)
+    {
+        Reserve(id);
+        values[id] = Value(value);
+        present[id] = true;
+    }
+
+    // Doesn't allocate in steady state (when the value is recycled
+    // or the string is already in the dictionary)
+    void SetValue(FieldId id, std::string_view valueStr, Dictionary* dict = nullptr)
+    {
+        Reserve(id);
+        values[id].Assign(valueStr, dict);
+        present[id] = true;
+    }
+
+    void Clear() { std::fill(present.begin(), present.end(), false); }
+
+    const Schema& GetSchema() const { return *schema; }
+
+    std::ostream& Dump(std::ostream& os = std::cout) const
+    {
+        bool empty = true;
+        schema->ForEach([&](const std::string& name, FieldId id)
+        {
+            const Value* value = GetValue(id);
+            if(!value)
+                return;
+            if(!empty)
+                os << ", ";
+            os << "'" << name << "'=" << *value;
+            empty = false;
+        });
+        return (empty ? os : os << std::endl);
+    }
+
+    // Appends the line Dump() prints (ending with '\n' rather than a flush),
+    // or, if fields are given, the line of only these fields in their order
+    void Format(std::string& out, const std::vector<FieldId>* fields = nullptr) const
+    {
+        size_t start = out.size();
+        auto format = [&](const std::string& name, FieldId id)
+        {
+            const Value* value = GetValue(id);
+            if(!value)
+                return;
+            if(out.size() > start)
+                out += ", ";
+            out += '\'';
+            out += name;
+            out += "'=";
+            value->Format(out);
+        };
+
+        if(fields && !fields->empty())
+        {
+            for(FieldId id : *fields)
+                format(schema->GetName(id), id);
+        }
+        else
+        {
+            schema->ForEach(format);
+        }
+
+        if(out.size() > start)
+            out += '\n';
+    }
+
+private:
+    void Reserve(FieldId id)
+    {
+        if(id >= values.size())
+        {
+            values.resize(id + 1);
+            present.resize(id + 1, false);
+        }
+    }
+
+    const Schema* schema{nullptr};
+    std::vector<Value> values;
+    std::vector<char> present;
+};
+
+//
+// Object value look up traits. Evaluated objects provide one of
+//   const Value* GetValue(FieldId id) const;
+//   const Value* GetValue(std::string_view name) const;
+//   const Value* GetValue(const std::string& name) const;
+//
+
+// Detects if OBJECT looks up values by FieldId rather than by name
+template<class OBJECT, class = void>
+struct IsSlotIndexed : std::false_type {};
+
+template<class OBJECT>
+struct IsSlotIndexed<OBJECT,
+    std::void_t<decltype(std::declval<const OBJECT&>().GetValue(std::declval<FieldId>()))>> : std::true_type {};
+
+// Detects if OBJECT can look up values by std::string_view name
+template<class OBJECT, class = void>
+struct IsViewIndexed : std::false_type {};
+
+template<class OBJECT>
+struct IsViewIndexed<OBJECT,
+    std::void_t<decltype(std::declval<const OBJECT&>().GetValue(std::declval<std::string_view>()))>> : std::true_type {};
+
+#endif // __RECORD_H__
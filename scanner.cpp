@@ -0,0 +1,344 @@
+//
+// scanner.cpp
+//
+#include <algorithm>        // std::min
+#include <sstream>          // std::stringstream
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "scanner.h"
+#include "output.h"
+#include "aggregate.h"
+
+std::string& TrimString(std::string& str)
+{
+    const char* whiteSpace = " \t\v\r\n";
+    size_t start = str.find_first_not_of(whiteSpace);
+    size_t end = str.find_last_not_of(whiteSpace);
+    if(start == std::string::npos)
+        str.clear();
+    else
+        str = str.substr(start, end - start + 1);
+    return str;
+}
+
+void ParseLine(std::string_view line, Schema& schema, Record& obj)
+{
+    std::stringstream ss{std::string(line)};
+    std::string token;
+    obj.Clear();
+
+    while(getline(ss, token, ','))
+    {
+        // Trim leading/trailing while spaces
+        TrimString(token);
+
+        // Spit token into name and value
+        size_t pos = token.find('=');
+        if(pos != std::string::npos)
+        {
+            std::string name = token.substr(0, pos);
+            std::string value = token.substr(pos + 1);
+            FieldId id = schema.Bind(TrimString(name));
+            if(Dictionary* dict = schema.GetDictionary(id))
+                obj.SetValue(id, std::string_view(TrimString(value)), dict);
+            else
+                obj.SetValue(id, TrimString(value));
+        }
+    }
+}
+
+//
+// Scanner
+//
+Scanner::Scanner(const ScanOptions& optsIn, const Schema& schemaIn)
+    : opts(optsIn), schema(schemaIn), parser(schema), obj(schema),
+      block(opts.batchMode ? BLOCK_SIZE : 0, Record(schema)), builder(schema)
+{
+}
+
+bool Scanner::Init(const char* constraintsStr)
+{
+    constraints.SetOptimize(opts.optimize);
+    if(!constraints.Parse(constraintsStr, &schema))
+        return false;
+    constraints.SetEvalMode(opts.evalMode);
+    constraints.SetProfile(opts.profile);
+    if(opts.adaptiveInterval > 0)
+        constraints.SetAdaptive(true, opts.adaptiveInterval);
+    return true;
+}
+
+//
+// Parallel scan
+//
+namespace
+{
+
+using Chunk = std::pair<const char*, const char*>;
+
+// Splits the file into chunks ending on a line boundary
+std::vector<Chunk> SplitChunks(const MappedFile& file)
+{
+    const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    const char* begin = file.GetData();
+    const char* end = begin + file.GetSize();
+    std::vector<Chunk> chunks;
+
+    for(const char* ptr = begin; ptr < end; )
+    {
+        const char* chunkEnd = ptr + std::min(CHUNK_SIZE, (size_t)(end - ptr));
+        if(chunkEnd < end)
+        {
+            const char* eol = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+            chunkEnd = (eol ? eol + 1 : end);
+        }
+        chunks.emplace_back(ptr, chunkEnd);
+        ptr = chunkEnd;
+    }
+    return chunks;
+}
+
+// Shares the constraints of the main scanner with a worker. In the
+// adaptive mode, every worker reorders its own constraints by its own
+// statistics, unless they are profiled (with a fixed order then).
+bool InitWorker(Scanner& scanner, const Scanner& main, const char* constraintsStr)
+{
+    const ScanOptions& opts = main.GetOptions();
+    if(opts.adaptiveInterval == 0 || opts.profile)
+    {
+        scanner.Init(main.GetConstraints());
+        return true;
+    }
+    return scanner.Init(constraintsStr);
+}
+
+// Result of a chunk evaluation, kept until it is written out in order
+struct ChunkResult
+{
+    struct Entry
+    {
+        size_t end;     // End offset of the entry text in the output
+        bool isError;   // Error message rather than a match
+    };
+
+    std::string output;
+    std::vector<Entry> entries;
+    bool stopped{false};    // Rows left or matches dropped at the limit
+    bool done{false};
+};
+
+// Formats chunk results (called on a worker thread)
+struct ChunkSink
+{
+    ChunkSink(const ScanOptions& optsIn, const std::atomic<bool>& stopIn) : opts(optsIn), stop(stopIn) {}
+
+    const ScanOptions& opts;
+    const std::atomic<bool>& stop;  // Enough matches have been written
+    std::string output;
+    std::vector<ChunkResult::Entry> entries;
+    size_t matchCount{0};
+    bool skipped{false};    // A match came after IsDone()
+
+    void OnMatch(const Record& rec)
+    {
+        if(IsDone())
+        {
+            skipped = true;
+            return;
+        }
+        if(!opts.countOnly)
+            rec.Format(output, &opts.fields);
+        entries.push_back({output.size(), false});
+        matchCount++;
+    }
+
+    void OnError(const std::string& err)
+    {
+        output += err;
+        entries.push_back({output.size(), true});
+    }
+
+    // Matches after the limit of a single chunk are never written
+    bool IsDone() const { return (opts.limit > 0 && matchCount >= opts.limit) || stop.load(std::memory_order_relaxed); }
+};
+
+} // namespace
+
+bool ScanParallel(const MappedFile& file, const Scanner& main, const char* constraintsStr,
+                  std::ostream& os, int& matchCount, bool& stopped)
+{
+    const ScanOptions& opts = main.GetOptions();
+    stopped = false;
+    std::vector<Chunk> chunks = SplitChunks(file);
+
+    // Limit the number of chunks evaluated ahead of the output
+    // to bound the memory used by not yet written results
+    const size_t maxAhead = 4 * (size_t)opts.threads;
+
+    std::vector<ChunkResult> results(chunks.size());
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t nextChunk = 0;   // Next chunk to evaluate
+    size_t written = 0;     // Number of chunks written out
+    bool failed = false;
+    std::atomic<bool> stop{false};
+
+    // Workers always tokenize the mapped chunks in place
+    ScanOptions workerOpts = opts;
+    workerOpts.mmapMode = true;
+
+    auto worker = [&]()
+    {
+        // Own evaluation state per thread
+        Scanner scanner(workerOpts, main.GetSchema());
+        if(!InitWorker(scanner, main, constraintsStr))
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            failed = true;
+            nextChunk = chunks.size();
+            cv.notify_all();
+            return;
+        }
+
+        for(;;)
+        {
+            size_t index = 0;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return nextChunk >= chunks.size() || nextChunk < written + maxAhead; });
+                if(nextChunk >= chunks.size())
+                    break;
+                index = nextChunk++;
+            }
+
+            ChunkSink sink(opts, stop);
+            bool scanned = MappedFile::ForEachLine(chunks[index].first, chunks[index].second,
+                [&](std::string_view line) { scanner.ProcessLine(line, sink); return !sink.IsDone(); });
+            scanner.Flush(sink);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            results[index].output = std::move(sink.output);
+            results[index].entries = std::move(sink.entries);
+            results[index].stopped = !scanned || sink.skipped;
+            results[index].done = true;
+            cv.notify_all();
+        }
+        scanner.MergeProfile();
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < opts.threads; i++)
+        threads.emplace_back(worker);
+
+    // Write out chunk results in the original order
+    OutputBuffer out(os);
+    for(size_t i = 0; i < chunks.size() && !stop; i++)
+    {
+        ChunkResult result;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]() { return results[i].done || failed; });
+            if(failed)
+                break;
+            result = std::move(results[i]);
+        }
+
+        size_t start = 0;
+        for(const ChunkResult::Entry& entry : result.entries)
+        {
+            std::string_view text(result.output.data() + start, entry.end - start);
+            start = entry.end;
+
+            if(entry.isError)
+            {
+                out.Write("[ERROR] ");
+                out.Write(text);
+                out.Write("\n");
+                continue;
+            }
+
+            if(opts.limit > 0 && (size_t)matchCount >= opts.limit)
+            {
+                stop = true;
+                stopped = true;
+                break;
+            }
+
+            ++matchCount;
+            if(!opts.countOnly)
+            {
+                out.WriteInt(matchCount);
+                out.Write(": ");
+                out.Write(text);
+            }
+        }
+
+        if(opts.limit > 0 && (size_t)matchCount >= opts.limit)
+        {
+            stop = true;
+            if(result.stopped || i + 1 < chunks.size())
+                stopped = true;
+        }
+
+        // Stop handing out chunks once the limit is reached
+        std::lock_guard<std::mutex> lock(mtx);
+        written++;
+        if(stop)
+            nextChunk = chunks.size();
+        cv.notify_all();
+    }
+    out.Flush();
+
+    for(std::thread& thread : threads)
+        thread.join();
+
+    return !failed;
+}
+
+bool AggregateParallel(const MappedFile& file, const Scanner& main, const char* constraintsStr, Aggregator& result)
+{
+    const ScanOptions& opts = main.GetOptions();
+    std::vector<Chunk> chunks = SplitChunks(file);
+
+    ScanOptions workerOpts = opts;
+    workerOpts.mmapMode = true;
+
+    // Chunks are aggregated in any order, so workers just take the next one
+    std::atomic<size_t> nextChunk{0};
+    std::mutex mtx;
+    bool failed = false;
+
+    auto worker = [&]()
+    {
+        Scanner scanner(workerOpts, main.GetSchema());
+        if(!InitWorker(scanner, main, constraintsStr))
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            failed = true;
+            return;
+        }
+
+        // Partial aggregates of the thread
+        Aggregator partial(result.GetSpec());
+        for(size_t index = nextChunk++; index < chunks.size(); index = nextChunk++)
+        {
+            MappedFile::ForEachLine(chunks[index].first, chunks[index].second,
+                [&](std::string_view line) { scanner.ProcessLine(line, partial); });
+        }
+        scanner.Flush(partial);
+        scanner.MergeProfile();
+
+        std::lock_guard<std::mutex> lock(mtx);
+        result.Merge(partial);
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < opts.threads; i++)
+        threads.emplace_back(worker);
+    for(std::thread& thread : threads)
+        thread.join();
+
+    return !failed;
+}
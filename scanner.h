@@ -0,0 +1,250 @@
+//
+// scanner.h
+//
+#ifndef __SCANNER_H__
+#define __SCANNER_H__
+
+#include <iostream>         // std::cout
+#include <string>
+#include <string_view>
+#include <vector>
+#include <string.h>         // memset
+#include "constraints.h"
+#include "batch.h"
+#include "ingest.h"
+#include "colfile.h"
+
+class Aggregator;
+
+//
+// Scan options (set from the app command line)
+//
+struct ScanOptions
+{
+    Constraints::EvalMode evalMode{Constraints::EVAL_PROGRAM};
+    bool batchMode{false};  // Evaluate blocks of rows in columnar form
+    bool mmapMode{false};   // Tokenize memory mapped input in place
+    int threads{1};         // Number of scanning threads (implies mmapMode)
+    size_t adaptiveInterval{0}; // Rows between predicate reorders (0 to disable)
+    bool optimize{true};    // Simplify the parsed constraints
+    bool profile{false};    // Record per node statistics (see Constraints::SetProfile)
+
+    // Output of the matches
+    bool countOnly{false};  // Count the matches without formatting them
+    size_t limit{0};        // Stop scanning after limit matches (0 for no limit)
+    std::vector<FieldId> fields; // Print only these fields (all if empty)
+};
+
+// Constructs object from a "name=value, name=value, ..." line
+// Note: See LineParser for the allocation-free version used with mmapMode
+void ParseLine(std::string_view line, Schema& schema, Record& obj);
+
+//
+// Class Scanner.
+// Evaluation state of a single scanning thread: parses input lines into
+// Records and evaluates them (one by one or in blocks) for the constraints.
+// Results are passed to a SINK that must provide the following methods:
+//   void OnMatch(const Record& rec);
+//   void OnError(const std::string& err);
+//   bool IsDone() const;   // No more matches are needed (see ScanOptions::limit)
+// Note: Scanner stops scanning a columnar file once the sink IsDone(), but
+// the lines are passed by the caller, that should stop passing them then.
+// A sink may still get the remaining matches of the current block.
+//
+class Scanner
+{
+public:
+    Scanner(const ScanOptions& optsIn, const Schema& schemaIn);
+    ~Scanner() = default;
+
+    // Parses constraints and binds them to the scanner schema
+    bool Init(const char* constraintsStr);
+    const std::string& GetError() { return constraints.GetError(); }
+
+    // Evaluates constraints parsed by another scanner (shared by all
+    // scanning threads), that must have been created with the schema
+    // of this one or its copy
+    // Note: Shared constraints are evaluated with their statistics, but
+    // not reordered (see Constraints::Context).
+    void Init(const Constraints& sharedIn) { shared = &sharedIn; }
+
+    // Adds the profile recorded while evaluating the shared constraints
+    // to them (see Constraints::MergeProfile). Called once scanned.
+    void MergeProfile() { if(shared) shared->MergeProfile(context); }
+
+    Constraints& GetConstraints() { return constraints; }
+    const Constraints& GetConstraints() const { return constraints; }
+    const Schema& GetSchema() const { return schema; }
+    const ScanOptions& GetOptions() const { return opts; }
+
+    template<class SINK>
+    void ProcessLine(std::string_view line, SINK& sink);
+
+    // Evaluates the remaining rows of a partial block (batchMode)
+    template<class SINK>
+    void Flush(SINK& sink);
+
+    // Evaluates all row groups of a columnar file opened with the schema
+    // the scanner was created with (no text parsing). Returns false if
+    // the sink was done before the last row.
+    template<class SINK>
+    bool ProcessColumnFile(const ColumnFile& file, SINK& sink);
+
+private:
+    template<class SINK>
+    void EvaluateBlock(SINK& sink);
+
+    // Evaluates with the shared constraints (and own context), if any
+    template<class OBJECT>
+    bool Evaluate(const OBJECT& object, bool& result)
+        { return (shared ? shared->Evaluate(object, result, context) : constraints.Evaluate(object, result)); }
+    bool EvaluateBatch()
+        { return (shared ? shared->EvaluateBatch(batch, selection, context) : constraints.EvaluateBatch(batch, selection)); }
+    const std::string& GetEvalError() const
+        { return (shared ? context.GetError() : constraints.GetError()); }
+
+    const ScanOptions opts;
+    Schema schema;          // Own copy, since new fields are bound while scanning
+    Constraints constraints;
+    const Constraints* shared{nullptr};
+    Constraints::Context context;   // Shared constraints evaluation state
+    LineParser parser;
+    Record obj;
+
+    // Batch mode: block of rows and its columnar form
+    static constexpr size_t BLOCK_SIZE = 4096;
+    std::vector<Record> block;
+    size_t blockSize{0};
+    ColumnBatchBuilder builder;
+    ColumnBatch batch;
+    Selection selection;
+
+    // Omit implementation of the copy constructor and assignment operator
+    Scanner(const Scanner&) = delete;
+    Scanner& operator=(const Scanner&) = delete;
+};
+
+template<class SINK>
+void Scanner::ProcessLine(std::string_view line, SINK& sink)
+{
+    // Construct object from a line
+    Record& rec = (opts.batchMode ? block[blockSize++] : obj);
+    if(opts.mmapMode)
+        parser.Parse(line, rec);
+    else
+        ParseLine(line, schema, rec);
+
+    if(opts.batchMode)
+    {
+        if(blockSize == BLOCK_SIZE)
+            EvaluateBlock(sink);
+        return;
+    }
+
+    // Evaluate object for constraints matching
+    bool result = false;
+    if(!Evaluate(rec, result))
+        sink.OnError(GetEvalError());
+    else if(result)
+        sink.OnMatch(rec);
+}
+
+template<class SINK>
+void Scanner::Flush(SINK& sink)
+{
+    if(blockSize > 0 && !sink.IsDone())
+        EvaluateBlock(sink);
+    blockSize = 0;
+}
+
+// Evaluates a block of objects in columnar form. Falls back to evaluating
+// object by object if the block can't be evaluated as a batch (for example,
+// when some objects miss a field used by the constraints).
+template<class SINK>
+void Scanner::EvaluateBlock(SINK& sink)
+{
+    builder.Clear();
+    for(size_t i = 0; i < blockSize; i++)
+        builder.Append(block[i]);
+    builder.Build(batch);
+
+    if(!EvaluateBatch())
+    {
+        selection.Resize(blockSize);
+        memset(selection.GetMask(), 0, selection.GetWords() * sizeof(uint64_t));
+
+        for(size_t i = 0; i < blockSize; i++)
+        {
+            bool result = false;
+            if(!Evaluate(block[i], result))
+                sink.OnError(GetEvalError());
+            else if(result)
+                selection.GetMask()[i / 64] |= (uint64_t(1) << (i % 64));
+        }
+    }
+
+    selection.ForEach([&](size_t row) { sink.OnMatch(block[row]); });
+    blockSize = 0;
+}
+
+template<class SINK>
+bool Scanner::ProcessColumnFile(const ColumnFile& file, SINK& sink)
+{
+    size_t group = 0;
+    for(; group < file.GetRowGroupCount() && !sink.IsDone(); group++)
+    {
+        // Columns are evaluated in place, in the mapped file
+        file.GetBatch(group, batch);
+        if(EvaluateBatch())
+        {
+            selection.ForEach([&](size_t row)
+            {
+                file.GetRecord(group, row, obj);
+                sink.OnMatch(obj);
+            });
+            continue;
+        }
+
+        // Some column is missing or has mixed types: evaluate row by row,
+        // in the columns (the matching rows are materialized only)
+        ColumnFile::Row view(file);
+        for(size_t row = 0; row < file.GetRowGroupSize(group); row++)
+        {
+            if(sink.IsDone())
+                return false;
+            view.Set(group, row);
+
+            bool result = false;
+            if(!Evaluate(view, result))
+            {
+                sink.OnError(GetEvalError());
+            }
+            else if(result)
+            {
+                file.GetRecord(group, row, obj);
+                sink.OnMatch(obj);
+            }
+        }
+    }
+    return group == file.GetRowGroupCount();
+}
+
+// Scans the memory mapped file with the options.threads threads of the main
+// scanner, that has been initialized with constraintsStr. The file is split
+// into newline aligned chunks that are evaluated in parallel, each thread
+// with its own Scanner, but with the constraints of the main one (so their
+// profile is collected there). Matches are written to os (numbered from
+// matchCount) in the original line order, with the output options of the
+// main scanner. Once options.limit matches are written, the remaining
+// chunks are not scanned (stopped is set if any rows are left then).
+// Returns false if constraints fail to parse.
+bool ScanParallel(const MappedFile& file, const Scanner& main, const char* constraintsStr,
+                  std::ostream& os, int& matchCount, bool& stopped);
+
+// Aggregates the matching rows of the memory mapped file with the
+// options.threads threads of the main scanner (as above). Every thread
+// aggregates into its own partial Aggregator, and the partials are merged
+// into result. Returns false if constraints fail to parse.
+bool AggregateParallel(const MappedFile& file, const Scanner& main, const char* constraintsStr, Aggregator& result);
+
+#endif // __SCANNER_H__
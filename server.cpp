@@ -0,0 +1,476 @@
+//
+// server.cpp
+//
+#include <algorithm>        // std::min
+#include <charconv>         // std::from_chars
+#include <thread>
+#include <sys/socket.h>     // socket(), accept4()
+#include <sys/un.h>         // sockaddr_un
+#include <sys/stat.h>       // stat()
+#include <sys/signalfd.h>   // signalfd()
+#include <fcntl.h>          // O_CLOEXEC
+#include <poll.h>           // poll()
+#include <signal.h>         // pthread_sigmask()
+#include <unistd.h>         // close(), pipe2()
+#include <string.h>         // strerror()
+#include <errno.h>
+#include "server.h"
+#include "output.h"
+
+namespace
+{
+
+// Writes the numbered matches of a query to the client
+struct QuerySink
+{
+    QuerySink(OutputBuffer& outIn, const ScanOptions& optsIn) : out(outIn), opts(optsIn) {}
+
+    OutputBuffer& out;
+    const ScanOptions& opts;
+    uint64_t matchCount{0};
+    uint64_t errorCount{0};
+    std::string err;        // First error
+
+    void OnMatch(const Record& rec)
+    {
+        if(IsDone())
+            return;
+
+        matchCount++;
+        if(opts.countOnly)
+            return;
+
+        out.WriteInt(matchCount);
+        out.Write(": ");
+        out.Write(rec, &opts.fields);
+    }
+
+    void OnError(const std::string& errIn)
+    {
+        if(errorCount++ == 0)
+            err = errIn;
+    }
+
+    // Stops once the client is gone, too
+    bool IsDone() const { return out.IsFailed() || (opts.limit > 0 && matchCount >= opts.limit); }
+};
+
+// Writes the last line of a failed response (on a single line)
+void WriteError(OutputBuffer& out, std::string err)
+{
+    std::replace(err.begin(), err.end(), '\n', ' ');
+    out.Write("ERROR ");
+    out.Write(err);
+    out.Write("\n");
+}
+
+// Sets the address of the socket path
+bool SetAddress(const std::string& socketPath, sockaddr_un& addr)
+{
+    if(socketPath.size() >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+} // namespace
+
+//
+// Server
+//
+bool Server::Listen(const char* socketPathIn)
+{
+    Close();
+    socketPath = socketPathIn;
+
+    // A socket file is left behind by a server that was killed
+    struct stat st;
+    if(stat(socketPathIn, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketPathIn);
+
+    sockaddr_un addr{};
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd < 0 || !SetAddress(socketPath, addr) ||
+       bind(listenFd, (const sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0)
+    {
+        err = "Cannot listen on socket '" + socketPath + "': " + strerror(errno);
+        if(listenFd >= 0)
+            close(listenFd);
+        listenFd = -1;
+        socketPath.clear();
+        return false;
+    }
+    return true;
+}
+
+void Server::Close()
+{
+    for(auto& [fd, conn] : connections)
+        close(fd);
+    connections.clear();
+
+    if(listenFd >= 0)
+    {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+    listenFd = -1;
+}
+
+bool Server::Run(size_t threadCount)
+{
+    if(listenFd < 0)
+    {
+        err = "Server is not listening";
+        return false;
+    }
+
+    // SIGINT and SIGTERM are read from signalFd (and blocked in the workers,
+    // that inherit the mask), and a write to a gone client fails rather
+    // than raising SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t signals, oldSignals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &oldSignals);
+
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if(signalFd < 0 || pipe2(wakeFds, O_CLOEXEC | O_NONBLOCK) < 0 || pipe2(stopFds, O_CLOEXEC) < 0)
+    {
+        err = std::string("Cannot start the server: ") + strerror(errno);
+        if(signalFd >= 0)
+            close(signalFd);
+        for(int* fd : {&wakeFds[0], &wakeFds[1]})
+        {
+            if(*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+        return false;
+    }
+
+    stopping = false;
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < std::max<size_t>(threadCount, 1); i++)
+        workers.emplace_back(&Server::Work, this);
+
+    auto dispatch = [&](Connection& conn)
+    {
+        conn.busy = true;
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back(&conn);
+        cv.notify_one();
+    };
+    auto drop = [&](Connection& conn)
+    {
+        int fd = conn.fd;
+        close(fd);
+        connections.erase(fd);
+    };
+
+    bool ok = true;
+    std::vector<pollfd> fds;
+    std::vector<Connection*> ready;
+    for(;;)
+    {
+        // Busy connections are polled again once served
+        fds.clear();
+        fds.push_back({signalFd, POLLIN, 0});
+        fds.push_back({wakeFds[0], POLLIN, 0});
+        fds.push_back({listenFd, POLLIN, 0});
+        for(auto& [fd, conn] : connections)
+        {
+            if(!conn.busy)
+                fds.push_back({fd, POLLIN, 0});
+        }
+
+        if(poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            err = std::string("Cannot poll the connections: ") + strerror(errno);
+            ok = false;
+            break;
+        }
+
+        // SIGINT or SIGTERM (read, so it's not raised once unblocked)
+        if(fds[0].revents)
+        {
+            signalfd_siginfo info;
+            ssize_t ret = read(signalFd, &info, sizeof(info));
+            (void)ret;
+            break;
+        }
+
+        // Served connections: next pipelined requests, if they are received
+        if(fds[1].revents)
+        {
+            char buf[256];
+            while(read(wakeFds[0], buf, sizeof(buf)) > 0)
+                ;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                ready.swap(served);
+            }
+            for(Connection* conn : ready)
+            {
+                conn->busy = false;
+                if(conn->closed)
+                    drop(*conn);
+                else if(HasRequest(*conn))
+                    dispatch(*conn);
+            }
+            ready.clear();
+        }
+
+        if(fds[2].revents & POLLIN)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if(fd >= 0)
+                connections[fd].fd = fd;
+        }
+
+        for(size_t i = 3; i < fds.size(); i++)
+        {
+            if(!fds[i].revents)
+                continue;
+
+            Connection& conn = connections[fds[i].fd];
+            if(!Receive(conn))
+                drop(conn);
+            else if(HasRequest(conn))
+                dispatch(conn);
+        }
+    }
+
+    // The workers finish the connections they serve, but don't wait
+    // for their clients to read (stopFds stays readable)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+        queue.clear();
+        served.clear();
+    }
+    cv.notify_all();
+    char stop = 0;
+    ssize_t ret = write(stopFds[1], &stop, 1);
+    (void)ret;
+    for(std::thread& worker : workers)
+        worker.join();
+
+    Close();
+    close(signalFd);
+    for(int* fd : {&wakeFds[0], &wakeFds[1], &stopFds[0], &stopFds[1]})
+    {
+        close(*fd);
+        *fd = -1;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+    return ok;
+}
+
+void Server::Work()
+{
+    for(;;)
+    {
+        Connection* conn = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return stopping || !queue.empty(); });
+            if(stopping)
+                return;
+            conn = queue.front();
+            queue.pop_front();
+        }
+
+        Serve(*conn);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            served.push_back(conn);
+        }
+        char wake = 0;
+        ssize_t ret = write(wakeFds[1], &wake, 1);
+        (void)ret;      // The pipe is full: Run() is woken up anyway
+    }
+}
+
+bool Server::Receive(Connection& conn)
+{
+    char buf[64 * 1024];
+    ssize_t count = read(conn.fd, buf, sizeof(buf));
+    if(count < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+    if(count <= 0)
+        return false;
+
+    conn.input.append(buf, count);
+    return true;
+}
+
+// Answers the complete requests received, in their order
+void Server::Serve(Connection& conn)
+{
+    OutputBuffer out(conn.fd, stopFds[0], SEND_TIMEOUT);
+    size_t pos = 0;
+    for(size_t eol; !out.IsFailed() && (eol = conn.input.find('\n', pos)) != std::string::npos; pos = eol + 1)
+    {
+        std::string_view request = LineParser::Trim(std::string_view(conn.input).substr(pos, eol - pos));
+        if(request == "QUIT")
+        {
+            conn.closed = true;
+            break;
+        }
+        if(!request.empty())
+            Query(request, out);
+    }
+
+    out.Flush();
+    conn.input.erase(0, pos);
+    if(out.IsFailed())
+        conn.closed = true;
+}
+
+void Server::Query(std::string_view request, OutputBuffer& out)
+{
+    queryCount++;
+
+    // COUNT and LIMIT N prefixes
+    ScanOptions queryOpts = opts;
+    for(;;)
+    {
+        size_t end = std::min(request.find(' '), request.size());
+        std::string_view word = request.substr(0, end);
+        if(word == "COUNT")
+        {
+            queryOpts.countOnly = true;
+        }
+        else if(word == "LIMIT")
+        {
+            request = LineParser::Trim(request.substr(end));
+            end = std::min(request.find(' '), request.size());
+
+            size_t limit = 0;
+            auto [ptr, ec] = std::from_chars(request.data(), request.data() + end, limit);
+            if(ec != std::errc() || ptr != request.data() + end || limit == 0)
+            {
+                WriteError(out, "Invalid LIMIT '" + std::string(request.substr(0, end)) + "'");
+                return;
+            }
+            queryOpts.limit = limit;
+        }
+        else
+        {
+            break;
+        }
+        request = LineParser::Trim(request.substr(end));
+    }
+
+    // Own scanner (and constraints), shared data
+    Scanner scanner(queryOpts, schema);
+    if(!scanner.Init(std::string(request).c_str()))
+    {
+        WriteError(out, scanner.GetError());
+        return;
+    }
+
+    QuerySink sink(out, queryOpts);
+    if(!scanner.GetConstraints().IsAlwaysFalse())
+        scanner.ProcessColumnFile(data, sink);
+
+    out.Write("OK ");
+    out.WriteInt(sink.matchCount);
+    if(sink.errorCount > 0)
+    {
+        std::replace(sink.err.begin(), sink.err.end(), '\n', ' ');
+        out.Write(", ");
+        out.WriteInt(sink.errorCount);
+        out.Write(" rows failed to evaluate, the first: ");
+        out.Write(sink.err);
+    }
+    out.Write("\n");
+}
+
+//
+// QueryClient
+//
+bool QueryClient::Connect(const char* socketPath)
+{
+    Close();
+
+    sockaddr_un addr{};
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || !SetAddress(socketPath, addr) || connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        err = std::string("Cannot connect to socket '") + socketPath + "': " + strerror(errno);
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void QueryClient::Close()
+{
+    if(fd >= 0)
+        close(fd);
+    fd = -1;
+    input.clear();
+}
+
+bool QueryClient::Send(std::string_view request)
+{
+    std::string line(request);
+    line += '\n';
+
+    for(size_t pos = 0; pos < line.size(); )
+    {
+        ssize_t count = send(fd, line.data() + pos, line.size() - pos, MSG_NOSIGNAL);
+        if(count < 0 && errno != EINTR)
+        {
+            err = std::string("Cannot send the request: ") + strerror(errno);
+            return false;
+        }
+        pos += std::max<ssize_t>(count, 0);
+    }
+    return true;
+}
+
+bool QueryClient::Receive(std::ostream& os)
+{
+    size_t pos = 0;
+    for(;;)
+    {
+        // Complete lines, up to the last one of the response
+        for(size_t eol; (eol = input.find('\n', pos)) != std::string::npos; pos = eol + 1)
+        {
+            std::string_view line = std::string_view(input).substr(pos, eol - pos);
+            os.write(line.data(), line.size() + 1);
+            if(line.substr(0, 3) == "OK " || line.substr(0, 6) == "ERROR ")
+            {
+                input.erase(0, eol + 1);
+                return true;
+            }
+        }
+        input.erase(0, pos);
+        pos = 0;
+
+        char buf[64 * 1024];
+        ssize_t count = read(fd, buf, sizeof(buf));
+        if(count < 0 && errno == EINTR)
+            continue;
+        if(count <= 0)
+        {
+            err = (count == 0 ? std::string("Connection closed by the server") :
+                                std::string("Cannot read the response: ") + strerror(errno));
+            return false;
+        }
+        input.append(buf, count);
+    }
+}
@@ -0,0 +1,146 @@
+//
+// server.h
+//
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <iostream>         // std::ostream
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>         // uint64_t
+#include "scanner.h"
+#include "colfile.h"
+
+class OutputBuffer;
+
+//
+// Query protocol (over a Unix domain stream socket).
+// A request is a line of constraints, optionally prefixed with COUNT (to
+// count the matches only) and LIMIT N (to stop after N matches):
+//   COUNT LIMIT 10 Language == French AND BookNumber > 100
+// The response is the numbered matches, as the app prints them, and then
+// a last line "OK <match count>" or "ERROR <message>". Requests may be
+// pipelined (sent without waiting for the responses), and are answered in
+// their order. "QUIT" closes the connection.
+//
+
+//
+// Class Server.
+// Query daemon: the data is loaded once (as a columnar file image, with
+// typed int columns and dictionary coded strings) and stays resident, so
+// a query scans the memory only. Connections are polled by the Run()
+// thread, which hands a connection with complete requests to a pool of
+// worker threads. Queries of different connections run in parallel, each
+// with its own Scanner, against the shared read-only data.
+//
+class Server
+{
+public:
+    // Data must have been opened with the schema (which is copied by the
+    // scanners and not modified)
+    Server(const ScanOptions& optsIn, const Schema& schemaIn, const ColumnFile& dataIn)
+        : opts(optsIn), schema(schemaIn), data(dataIn) {}
+    ~Server() { Close(); }
+
+    // Creates the socket (replacing a stale socket file)
+    bool Listen(const char* socketPathIn);
+
+    // Serves the clients with threadCount workers, until SIGINT or SIGTERM
+    bool Run(size_t threadCount);
+    void Close();
+
+    uint64_t GetQueryCount() const { return queryCount; }
+    const std::string& GetError() const { return err; }
+
+private:
+    struct Connection
+    {
+        int fd{-1};
+        std::string input;      // Received requests (the last one may be partial)
+        bool busy{false};       // Queued or served by a worker
+        bool closed{false};     // QUIT or a failed write
+    };
+
+    void Work();
+    void Serve(Connection& conn);
+    void Query(std::string_view request, OutputBuffer& out);
+
+    // Reads the available input. Returns false if the client is gone.
+    static bool Receive(Connection& conn);
+    static bool HasRequest(const Connection& conn) { return conn.input.find('\n') != std::string::npos; }
+
+    const ScanOptions opts;
+    const Schema& schema;
+    const ColumnFile& data;
+    std::string socketPath;
+    int listenFd{-1};
+    std::atomic<uint64_t> queryCount{0};
+    std::string err;
+
+    // Milliseconds a client may not read a response for, before the
+    // connection is dropped (so the worker serves other clients)
+    static constexpr int SEND_TIMEOUT = 10000;
+
+    // Connections by fd (touched by the Run() thread only, except for
+    // the ones a worker is busy with). They are non-blocking, so a client
+    // that doesn't read doesn't block a worker past SEND_TIMEOUT or the
+    // shutdown (stopFds becomes readable then).
+    std::unordered_map<int, Connection> connections;
+
+    // Worker pool: queued connections, and the served ones to poll again
+    // (the Run() thread is woken up with wakeFds)
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Connection*> queue;
+    std::vector<Connection*> served;
+    bool stopping{false};
+    int wakeFds[2]{-1, -1};
+    int stopFds[2]{-1, -1};
+
+    // Omit implementation of the copy constructor and assignment operator
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+};
+
+//
+// Class QueryClient.
+// Connects to the Server socket, and sends requests and reads responses
+// separately, so requests can be pipelined.
+// Note: The requests should fit into the socket buffers, since the server
+// doesn't read the requests of a connection while it writes a response.
+//
+class QueryClient
+{
+public:
+    QueryClient() = default;
+    ~QueryClient() { Close(); }
+
+    bool Connect(const char* socketPath);
+    void Close();
+
+    // Sends the request line (see the protocol above)
+    bool Send(std::string_view request);
+
+    // Copies the next response to os, up to its last (OK or ERROR) line.
+    // Returns false if the connection fails first.
+    bool Receive(std::ostream& os);
+
+    const std::string& GetError() const { return err; }
+
+private:
+    int fd{-1};
+    std::string input;      // Received, not yet copied data
+    std::string err;
+
+    // Omit implementation of the copy constructor and assignment operator
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+};
+
+#endif // __SERVER_H__
@@ -0,0 +1,215 @@
+//
+// simd.cpp
+//
+#include <string.h>         // memset
+#include "simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+namespace simd
+{
+
+//
+// Scalar kernel (also used for the tail of vector kernels)
+//
+template<CompareOp OP>
+static inline bool Compare(int32_t a, int32_t b)
+{
+    if constexpr(OP == CMP_EQ) return a == b;
+    if constexpr(OP == CMP_NE) return a != b;
+    if constexpr(OP == CMP_LT) return a <  b;
+    if constexpr(OP == CMP_LE) return a <= b;
+    if constexpr(OP == CMP_GT) return a >  b;
+    if constexpr(OP == CMP_GE) return a >= b;
+}
+
+template<CompareOp OP>
+static void CompareScalar(const int32_t* data, size_t begin, size_t rowCount, int32_t operand, uint64_t* mask)
+{
+    for(size_t i = begin; i < rowCount; i++)
+    {
+        if(Compare<OP>(data[i], operand))
+            mask[i / 64] |= (uint64_t(1) << (i % 64));
+    }
+}
+
+#ifdef SIMD_X86
+//
+// SSE2 kernel: 4 rows per compare, 16 compares per mask word
+//
+template<CompareOp OP>
+static inline int CompareSse2(__m128i a, __m128i b)
+{
+    __m128i r;
+    if constexpr(OP == CMP_EQ || OP == CMP_NE) r = _mm_cmpeq_epi32(a, b);
+    if constexpr(OP == CMP_LT || OP == CMP_GE) r = _mm_cmplt_epi32(a, b);
+    if constexpr(OP == CMP_GT || OP == CMP_LE) r = _mm_cmpgt_epi32(a, b);
+
+    int bits = _mm_movemask_ps(_mm_castsi128_ps(r));
+
+    // NE, GE and LE are negations of EQ, LT and GT
+    if constexpr(OP == CMP_NE || OP == CMP_GE || OP == CMP_LE)
+        bits ^= 0xF;
+    return bits;
+}
+
+template<CompareOp OP>
+static void CompareSse2(const int32_t* data, size_t rowCount, int32_t operand, uint64_t* mask)
+{
+    const __m128i b = _mm_set1_epi32(operand);
+    size_t fullWords = rowCount / 64;
+
+    for(size_t w = 0; w < fullWords; w++)
+    {
+        const int32_t* ptr = data + w * 64;
+        uint64_t word = 0;
+        for(int j = 0; j < 16; j++)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(ptr + j * 4));
+            word |= (uint64_t)CompareSse2<OP>(a, b) << (j * 4);
+        }
+        mask[w] = word;
+    }
+
+    CompareScalar<OP>(data, fullWords * 64, rowCount, operand, mask);
+}
+
+//
+// AVX2 kernel: 8 rows per compare, 8 compares per mask word
+//
+template<CompareOp OP>
+__attribute__((target("avx2")))
+static inline int CompareAvx2(__m256i a, __m256i b)
+{
+    __m256i r;
+    if constexpr(OP == CMP_EQ || OP == CMP_NE) r = _mm256_cmpeq_epi32(a, b);
+    if constexpr(OP == CMP_LT || OP == CMP_GE) r = _mm256_cmpgt_epi32(b, a);
+    if constexpr(OP == CMP_GT || OP == CMP_LE) r = _mm256_cmpgt_epi32(a, b);
+
+    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(r));
+
+    // NE, GE and LE are negations of EQ, LT and GT
+    if constexpr(OP == CMP_NE || OP == CMP_GE || OP == CMP_LE)
+        bits ^= 0xFF;
+    return bits;
+}
+
+template<CompareOp OP>
+__attribute__((target("avx2")))
+static void CompareAvx2(const int32_t* data, size_t rowCount, int32_t operand, uint64_t* mask)
+{
+    const __m256i b = _mm256_set1_epi32(operand);
+    size_t fullWords = rowCount / 64;
+
+    for(size_t w = 0; w < fullWords; w++)
+    {
+        const int32_t* ptr = data + w * 64;
+        uint64_t word = 0;
+        for(int j = 0; j < 8; j++)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(ptr + j * 8));
+            word |= (uint64_t)CompareAvx2<OP>(a, b) << (j * 8);
+        }
+        mask[w] = word;
+    }
+
+    CompareScalar<OP>(data, fullWords * 64, rowCount, operand, mask);
+}
+
+static bool HasAvx2()
+{
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+}
+#endif // SIMD_X86
+
+template<CompareOp OP>
+static void CompareInt32(const int32_t* data, size_t rowCount, int32_t operand, uint64_t* mask)
+{
+#ifdef SIMD_X86
+    if(HasAvx2())
+        CompareAvx2<OP>(data, rowCount, operand, mask);
+    else
+        CompareSse2<OP>(data, rowCount, operand, mask);
+#else
+    CompareScalar<OP>(data, 0, rowCount, operand, mask);
+#endif
+}
+
+void CompareInt32(CompareOp op, const int32_t* data, size_t rowCount, int32_t operand, uint64_t* mask)
+{
+    // Vector kernels overwrite full words; only the tail word is or-ed
+    memset(mask, 0, MaskWords(rowCount) * sizeof(uint64_t));
+
+    switch(op)
+    {
+        case CMP_EQ: CompareInt32<CMP_EQ>(data, rowCount, operand, mask); break;
+        case CMP_NE: CompareInt32<CMP_NE>(data, rowCount, operand, mask); break;
+        case CMP_LT: CompareInt32<CMP_LT>(data, rowCount, operand, mask); break;
+        case CMP_LE: CompareInt32<CMP_LE>(data, rowCount, operand, mask); break;
+        case CMP_GT: CompareInt32<CMP_GT>(data, rowCount, operand, mask); break;
+        case CMP_GE: CompareInt32<CMP_GE>(data, rowCount, operand, mask); break;
+    }
+}
+
+void Gather(const int32_t* data, size_t rowCount, const uint8_t* lookup, uint64_t* mask)
+{
+    memset(mask, 0, MaskWords(rowCount) * sizeof(uint64_t));
+
+    for(size_t i = 0; i < rowCount; i++)
+        mask[i / 64] |= (uint64_t)(lookup[data[i]] != 0) << (i % 64);
+}
+
+// Note: The combines below are simple enough for the compiler
+// to vectorize them with -O3
+void And(uint64_t* dst, const uint64_t* src, size_t words)
+{
+    for(size_t i = 0; i < words; i++)
+        dst[i] &= src[i];
+}
+
+void Or(uint64_t* dst, const uint64_t* src, size_t words)
+{
+    for(size_t i = 0; i < words; i++)
+        dst[i] |= src[i];
+}
+
+void Fill(uint64_t* mask, size_t rowCount, bool value)
+{
+    size_t words = MaskWords(rowCount);
+    memset(mask, (value ? 0xFF : 0), words * sizeof(uint64_t));
+
+    // Clear bits past the row count
+    if(value && rowCount % 64)
+        mask[words - 1] = (uint64_t(1) << (rowCount % 64)) - 1;
+}
+
+bool IsEmpty(const uint64_t* mask, size_t words)
+{
+    uint64_t any = 0;
+    for(size_t i = 0; i < words; i++)
+        any |= mask[i];
+    return any == 0;
+}
+
+size_t Count(const uint64_t* mask, size_t words)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < words; i++)
+        count += __builtin_popcountll(mask[i]);
+    return count;
+}
+
+const char* GetKernelName()
+{
+#ifdef SIMD_X86
+    return (HasAvx2() ? "avx2" : "sse2");
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace simd
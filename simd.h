@@ -0,0 +1,47 @@
+//
+// simd.h
+//
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // int32_t, uint64_t
+
+//
+// Comparison kernels for columnar (batch) evaluation.
+// Every kernel compares a contiguous column of values with a constant
+// and writes a selection bitmask: bit (i % 64) of word (i / 64) is set
+// if row i passes. Bits past the row count in the last word are cleared.
+// Kernels are dispatched at run time to AVX2 or SSE2 (x86-64), with a
+// portable scalar fallback.
+//
+namespace simd
+{
+
+enum CompareOp : char
+{
+    CMP_EQ=0, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE
+};
+
+// Number of 64-bit mask words needed for rowCount rows
+inline size_t MaskWords(size_t rowCount) { return (rowCount + 63) / 64; }
+
+// mask[i] = (data[i] <op> operand)
+void CompareInt32(CompareOp op, const int32_t* data, size_t rowCount, int32_t operand, uint64_t* mask);
+
+// mask[i] = lookup[data[i]] (data holds indexes into lookup table)
+void Gather(const int32_t* data, size_t rowCount, const uint8_t* lookup, uint64_t* mask);
+
+// Mask combines (word by word)
+void And(uint64_t* dst, const uint64_t* src, size_t words);
+void Or(uint64_t* dst, const uint64_t* src, size_t words);
+void Fill(uint64_t* mask, size_t rowCount, bool value);
+bool IsEmpty(const uint64_t* mask, size_t words);
+size_t Count(const uint64_t* mask, size_t words);
+
+// Name of the instruction set selected for the kernels ("avx2", "sse2", "scalar")
+const char* GetKernelName();
+
+} // namespace simd
+
+#endif // __SIMD_H__
@@ -0,0 +1,794 @@
+//
+// staticconstraints.h
+//
+#ifndef __STATICCONSTRAINTS_H__
+#define __STATICCONSTRAINTS_H__
+
+#include <string>
+#include <string_view>
+#include <type_traits>      // std::void_t
+#include <utility>          // std::index_sequence
+#include <stdint.h>         // int64_t, uint64_t
+#include "value.h"
+#include "record.h"
+
+//
+// Compile-time constraints.
+// Constraints that are fixed in the code can be parsed by the compiler
+// rather than at run time:
+//
+//     auto constraints = STATIC_CONSTRAINTS("Language == French AND BookNumber > 200");
+//     constraints.Bind(schema);
+//     constraints.Evaluate(record, result, err);
+//
+// The string literal is parsed by a constexpr parser (the grammar of
+// Constraints::Parse) into an expression template type: comparisons are
+// specialized on their operator and value type, and AND/OR are folds over
+// their children, so the compiler inlines the whole predicate with no
+// parsing and no tree walk at run time. A syntax error in the literal fails
+// the build (the error points at the parser line that rejects it).
+//
+// Note: There is no optimizer pass (the compiler does that), no adaptive
+// mode and no profiling.
+//
+#define STATIC_CONSTRAINTS(constraintsStr)                                                  \
+    ([]()                                                                                   \
+    {                                                                                       \
+        struct Source { static constexpr std::string_view Get() { return constraintsStr; } }; \
+        return StaticConstraints<Source>();                                                 \
+    }())
+
+//
+// Class StaticParser.
+// Constexpr parser of the constraints into a flat array of nodes (see
+// Constraints::Parse for the grammar). NOT is pushed down the way
+// Constraints does: a negated group swaps AND/OR, a negated comparison
+// takes the complementary operator and a negated IN becomes NOT IN.
+//
+class StaticParser
+{
+public:
+    enum Kind : char
+    {
+        VALUE=0,    // Value of an IN list
+        COMPARE,    // name OPER value
+        IN,         // name [NOT] IN (values)
+        AND, OR
+    };
+
+    enum Operator : char
+    {
+        NOOP=0, EQ, NE, LT, LE, GT, GE
+    };
+
+    // The tree is a fixed size array to be computed at compile time
+    static constexpr int MAX_NODES = 256;   // Predicates, groups and IN values
+    static constexpr int MAX_FIELDS = 32;
+    static constexpr int MAX_DEPTH = 64;
+
+    struct Node
+    {
+        Kind kind{VALUE};
+        Operator oper{NOOP};        // COMPARE
+        bool negate{false};         // IN (NOT IN)
+        int field{-1};              // COMPARE, IN: index in Tree::fields
+        int first{-1};              // IN values, AND/OR children
+        int next{-1};               // Next sibling
+        bool isInt{false};          // COMPARE, VALUE
+        bool isDouble{false};       // COMPARE, VALUE
+        int64_t intValue{0};
+        std::string_view strValue;  // In the parsed literal
+    };
+
+    struct Tree
+    {
+        Node nodes[MAX_NODES];
+        std::string_view fields[MAX_FIELDS];
+        int nodeCount{0};
+        int fieldCount{0};
+        int root{-1};
+    };
+
+    // Note: Errors are thrown, which makes the parse a non constant
+    // expression, so the build fails at the throw
+    static constexpr Tree Parse(std::string_view source)
+    {
+        StaticParser parser(source);
+        if(parser.token.type == Token::END)
+            throw "Empty constraints";
+
+        parser.tree.root = parser.ParseExpression(1);
+        if(parser.token.type != Token::END)
+            throw "Expected AND or OR";
+        return parser.tree;
+    }
+
+private:
+    struct Token
+    {
+        enum Type : char
+        {
+            END=0, WORD, STRING, LPAREN, RPAREN, COMMA, COMPARE, AND, OR, NOT, IN
+        };
+
+        Type type{END};
+        Operator oper{NOOP};    // COMPARE only
+        std::string_view text;  // WORD, STRING (without the quotes) and keywords
+
+        // A keyword is a plain word in the value position
+        constexpr bool IsValue() const { return type == WORD || type == STRING || (type >= AND && type <= IN); }
+    };
+
+    constexpr StaticParser(std::string_view sourceIn) : source(sourceIn) { Advance(); }
+
+    constexpr Token Next()
+    {
+        Token next = token;
+        Advance();
+        return next;
+    }
+
+    constexpr void Advance()
+    {
+        while(pos < source.size() && IsSpace(source[pos]))
+            pos++;
+
+        token = Token();
+        if(pos == source.size())
+            return;
+
+        char c = source[pos];
+        char next = (pos + 1 < source.size() ? source[pos + 1] : '\0');
+        size_t size = 1;
+
+        switch(c)
+        {
+            case '(': token.type = Token::LPAREN; break;
+            case ')': token.type = Token::RPAREN; break;
+            case ',': token.type = Token::COMMA;  break;
+
+            case '=':
+            case '!':
+                if(next != '=')
+                    throw "Expected a comparison operator (a single '=' or '!')";
+                token.type = Token::COMPARE;
+                token.oper = (c == '=' ? EQ : NE);
+                size = 2;
+                break;
+
+            case '<':
+            case '>':
+                token.type = Token::COMPARE;
+                token.oper = (c == '<' ? (next == '=' ? LE : LT) : (next == '=' ? GE : GT));
+                size = (next == '=' ? 2 : 1);
+                break;
+
+            case '"':
+            {
+                size_t quote = source.find('"', pos + 1);
+                if(quote == std::string_view::npos)
+                    throw "Missing closing quote";
+                token.type = Token::STRING;
+                token.text = source.substr(pos + 1, quote - pos - 1);
+                size = quote + 1 - pos;
+                break;
+            }
+
+            default:
+            {
+                size_t end = pos;
+                while(end < source.size() && !IsSpace(source[end]) && std::string_view("()\",=!<>").find(source[end]) == std::string_view::npos)
+                    end++;
+
+                token.type = Token::WORD;
+                token.text = source.substr(pos, end - pos);
+                size = end - pos;
+
+                if(IsKeyword(token.text, "AND"))
+                    token.type = Token::AND;
+                else if(IsKeyword(token.text, "OR"))
+                    token.type = Token::OR;
+                else if(IsKeyword(token.text, "NOT"))
+                    token.type = Token::NOT;
+                else if(IsKeyword(token.text, "IN"))
+                    token.type = Token::IN;
+                break;
+            }
+        }
+
+        pos += size;
+    }
+
+    constexpr int ParseExpression(int minPrecedence)
+    {
+        int lhs = ParseUnary();
+        int group = -1;
+
+        for(;;)
+        {
+            Token::Type type = token.type;
+            int precedence = (type == Token::OR ? 1 : type == Token::AND ? 2 : 0);
+            if(precedence == 0 || precedence < minPrecedence)
+                break;
+            Advance();
+
+            int rhs = ParseExpression(precedence + 1);
+
+            // Runs of the same operator are children of one group
+            Kind kind = (type == Token::AND ? AND : OR);
+            if(group >= 0 && tree.nodes[group].kind == kind)
+            {
+                AddChild(group, rhs);
+            }
+            else
+            {
+                group = NewNode(kind);
+                AddChild(group, lhs);
+                AddChild(group, rhs);
+                lhs = group;
+            }
+        }
+
+        return lhs;
+    }
+
+    constexpr int ParseUnary()
+    {
+        if(++depth > MAX_DEPTH)
+            throw "Constraints are nested too deeply";
+
+        int node = -1;
+        if(token.type == Token::NOT)
+        {
+            Advance();
+            node = Negate(ParseUnary());
+        }
+        else if(token.type == Token::LPAREN)
+        {
+            Advance();
+            if(token.type == Token::RPAREN)
+                throw "Empty sub-constraints";
+
+            node = ParseExpression(1);
+            if(token.type != Token::RPAREN)
+                throw "Missing closing ')'";
+            Advance();
+        }
+        else
+        {
+            node = ParsePredicate();
+        }
+
+        depth--;
+        return node;
+    }
+
+    constexpr int ParsePredicate()
+    {
+        Token name = token;
+        if(name.type != Token::WORD && name.type != Token::STRING)
+            throw "Expected a field name";
+        if(name.text.empty())
+            throw "Empty field name";
+        Advance();
+
+        bool negate = false;
+        if(token.type == Token::NOT)
+        {
+            // name NOT IN (...)
+            negate = true;
+            Advance();
+            if(token.type != Token::IN)
+                throw "Expected IN after NOT";
+        }
+
+        Token oper = Next();
+        int node = -1;
+
+        if(oper.type == Token::IN)
+        {
+            if(token.type != Token::LPAREN)
+                throw "Expected '(' after IN";
+            Advance();
+
+            node = NewNode(IN);
+            tree.nodes[node].field = AddField(name.text);
+            tree.nodes[node].negate = negate;
+            for(;;)
+            {
+                if(token.type == Token::RPAREN && tree.nodes[node].first < 0)
+                    throw "Empty IN list";
+                if(!token.IsValue())
+                    throw "Expected a value of the IN list";
+
+                int value = NewNode(VALUE);
+                SetValue(tree.nodes[value], Next().text);
+                AddChild(node, value);
+
+                Token separator = Next();
+                if(separator.type == Token::RPAREN)
+                    break;
+                if(separator.type != Token::COMMA)
+                    throw "Expected ',' or ')' in the IN list";
+            }
+        }
+        else if(oper.type == Token::COMPARE)
+        {
+            if(!token.IsValue() || (token.type == Token::WORD && token.text.empty()))
+                throw "Expected a value";
+
+            node = NewNode(COMPARE);
+            tree.nodes[node].oper = oper.oper;
+            tree.nodes[node].field = AddField(name.text);
+            SetValue(tree.nodes[node], Next().text);
+        }
+        else
+        {
+            throw "Expected a comparison operator or IN";
+        }
+
+        return node;
+    }
+
+    constexpr int Negate(int index)
+    {
+        Node& node = tree.nodes[index];
+
+        if(node.kind == COMPARE)
+        {
+            node.oper = (node.oper == EQ ? NE : node.oper == NE ? EQ :
+                         node.oper == LT ? GE : node.oper == GE ? LT :
+                         node.oper == GT ? LE : GT);
+        }
+        else if(node.kind == IN)
+        {
+            node.negate = !node.negate;
+        }
+        else
+        {
+            node.kind = (node.kind == AND ? OR : AND);
+            for(int child = node.first; child >= 0; child = tree.nodes[child].next)
+                Negate(child);
+        }
+
+        return index;
+    }
+
+    constexpr int NewNode(Kind kind)
+    {
+        if(tree.nodeCount == MAX_NODES)
+            throw "Too many predicates and values (see StaticParser::MAX_NODES)";
+        tree.nodes[tree.nodeCount].kind = kind;
+        return tree.nodeCount++;
+    }
+
+    constexpr void AddChild(int parent, int child)
+    {
+        int* last = &tree.nodes[parent].first;
+        while(*last >= 0)
+            last = &tree.nodes[*last].next;
+        *last = child;
+    }
+
+    constexpr int AddField(std::string_view name)
+    {
+        for(int i = 0; i < tree.fieldCount; i++)
+        {
+            if(tree.fields[i] == name)
+                return i;
+        }
+
+        if(tree.fieldCount == MAX_FIELDS)
+            throw "Too many fields (see StaticParser::MAX_FIELDS)";
+        tree.fields[tree.fieldCount] = name;
+        return tree.fieldCount++;
+    }
+
+    // Same as Value::ParseNumber: an integer that fits into int64, or a
+    // double if the digits go on with a fraction or an exponent (or don't
+    // fit). Doubles are parsed at run time (see StaticDouble).
+    static constexpr void SetValue(Node& node, std::string_view text)
+    {
+        constexpr uint64_t MAX_MAGNITUDE = uint64_t(1) << 63;  // -INT64_MIN
+        node.strValue = text;
+
+        bool negative = (!text.empty() && text[0] == '-');
+        size_t pos = (negative ? 1 : 0);
+        size_t digitsBegin = pos;
+        uint64_t num = 0;
+        bool overflow = false;
+        for(; pos < text.size() && IsDigit(text[pos]); pos++)
+        {
+            overflow = overflow || num > (MAX_MAGNITUDE - (text[pos] - '0')) / 10;
+            if(!overflow)
+                num = num * 10 + (text[pos] - '0');
+        }
+        overflow = overflow || num > MAX_MAGNITUDE - (negative ? 0 : 1);
+
+        if(pos == digitsBegin)
+            return; // No digits
+        if(pos == text.size() && !overflow)
+        {
+            node.isInt = true;
+            node.intValue = (!negative ? (int64_t)num : num == 0 ? 0 : -(int64_t)(num - 1) - 1);
+            return;
+        }
+        if(!overflow && text[pos] != '.' && text[pos] != 'e' && text[pos] != 'E')
+            return; // Integer with a suffix
+
+        // Fraction and exponent
+        if(pos < text.size() && text[pos] == '.')
+        {
+            for(pos++; pos < text.size() && IsDigit(text[pos]); pos++)
+                ;
+        }
+        if(pos < text.size() && (text[pos] == 'e' || text[pos] == 'E'))
+        {
+            pos++;
+            if(pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+                pos++;
+            size_t exponentBegin = pos;
+            for(; pos < text.size() && IsDigit(text[pos]); pos++)
+                ;
+            if(pos == exponentBegin)
+                return;
+        }
+        node.isDouble = (pos == text.size());
+    }
+
+    static constexpr bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    static constexpr bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Keywords are case insensitive
+    static constexpr bool IsKeyword(std::string_view word, std::string_view keyword)
+    {
+        if(word.size() != keyword.size())
+            return false;
+        for(size_t i = 0; i < word.size(); i++)
+        {
+            char c = word[i];
+            if((c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c) != keyword[i])
+                return false;
+        }
+        return true;
+    }
+
+    std::string_view source;
+    size_t pos{0};
+    Token token;
+    Tree tree;
+    int depth{0};
+};
+
+// Parsed tree of the SOURCE literal (a compile-time constant)
+template<class SOURCE>
+struct StaticTree
+{
+    static constexpr StaticParser::Tree value = StaticParser::Parse(SOURCE::Get());
+};
+
+//
+// Expression templates of the parsed tree. Every node type evaluates
+// with a static function:
+//     template<class OBJECT>
+//     static bool Evaluate(const OBJECT& object, const FieldId* ids, bool& result, std::string& err);
+// where ids are the schema ids of the fields (see StaticConstraints::Bind).
+//
+
+// Applies comparison OPER to values of the same type
+template<StaticParser::Operator OPER, class T>
+inline bool StaticCompareValues(const T& a, const T& b)
+{
+    if constexpr(OPER == StaticParser::EQ)
+        return a == b;
+    else if constexpr(OPER == StaticParser::NE)
+        return a != b;
+    else if constexpr(OPER == StaticParser::LT)
+        return a < b;
+    else if constexpr(OPER == StaticParser::LE)
+        return a <= b;
+    else if constexpr(OPER == StaticParser::GT)
+        return a > b;
+    else
+        return a >= b;
+}
+
+// Integer constant
+template<int64_t VALUE>
+struct StaticInt
+{
+    // Note: Any string is less than any number (see Value)
+    template<StaticParser::Operator OPER>
+    static bool Compare(const Value& value)
+    {
+        if(value.IsInt())
+            return StaticCompareValues<OPER>(value.GetInt(), VALUE);
+        if(value.IsDouble())
+            return StaticCompareValues<OPER>(-Value::CompareNumbers(VALUE, value.GetDouble()), 0);
+        return OPER == StaticParser::NE || OPER == StaticParser::LT || OPER == StaticParser::LE;
+    }
+
+    static bool Equals(int64_t value) { return value == VALUE; }
+    static bool Equals(double value) { return Value::CompareNumbers(VALUE, value) == 0; }
+    static bool Equals(std::string_view) { return false; }
+};
+
+// Double constant (value of node I of the SOURCE tree). There are no
+// constexpr doubles from text, so it is parsed as the runtime constraints
+// do (Value::Assign) once, at startup.
+template<class SOURCE, int I>
+struct StaticDouble
+{
+    static inline const Value VALUE = Value().Assign(StaticTree<SOURCE>::value.nodes[I].strValue);
+
+    template<StaticParser::Operator OPER>
+    static bool Compare(const Value& value) { return StaticCompareValues<OPER>(value, VALUE); }
+
+    static bool Equals(int64_t value) { return Value(value) == VALUE; }
+    static bool Equals(double value) { return Value(value) == VALUE; }
+    static bool Equals(std::string_view) { return false; }
+};
+
+// String constant (value of node I of the SOURCE tree)
+template<class SOURCE, int I>
+struct StaticString
+{
+    static constexpr std::string_view VALUE = StaticTree<SOURCE>::value.nodes[I].strValue;
+
+    template<StaticParser::Operator OPER>
+    static bool Compare(const Value& value)
+    {
+        if(value.IsNumber())
+            return OPER == StaticParser::NE || OPER == StaticParser::GT || OPER == StaticParser::GE;
+        return StaticCompareValues<OPER>(std::string_view(value.GetString()), VALUE);
+    }
+
+    static bool Equals(int64_t) { return false; }
+    static bool Equals(double) { return false; }
+    static bool Equals(std::string_view value) { return value == VALUE; }
+};
+
+// Detects if OBJECT maps field names to FieldIds at compile time with
+//     static constexpr FieldId GetFieldId(std::string_view name);
+// (in addition to GetValue(FieldId))
+template<class OBJECT, class = void>
+struct HasStaticFieldId : std::false_type {};
+
+template<class OBJECT>
+struct HasStaticFieldId<OBJECT, std::void_t<decltype(OBJECT::GetFieldId(std::declval<std::string_view>()))>> : std::true_type {};
+
+// Field F of the SOURCE tree, bound to OBJECT at compile time
+template<class SOURCE, int F>
+struct StaticField
+{
+    static constexpr std::string_view NAME = StaticTree<SOURCE>::value.fields[F];
+
+    template<class OBJECT>
+    static const Value* GetValue(const OBJECT& object, const FieldId* ids)
+    {
+        if constexpr(HasStaticFieldId<OBJECT>::value)
+        {
+            constexpr FieldId id = OBJECT::GetFieldId(NAME);
+            static_assert(id != INVALID_FIELD_ID, "Unknown field name in the static constraints");
+            return object.GetValue(id);
+        }
+        else if constexpr(IsSlotIndexed<OBJECT>::value)
+            return object.GetValue(ids[F]);
+        else if constexpr(IsViewIndexed<OBJECT>::value)
+            return object.GetValue(NAME);
+        else
+            return object.GetValue(std::string(NAME));
+    }
+
+    static bool SetMissing(std::string& err)
+    {
+        err = "Evaluated object doesn't have a value for a name '" + std::string(NAME) + "'";
+        return false;
+    }
+};
+
+template<class FIELD, StaticParser::Operator OPER, class VALUE>
+struct StaticCompare
+{
+    template<class OBJECT>
+    static bool Evaluate(const OBJECT& object, const FieldId* ids, bool& result, std::string& err)
+    {
+        const Value* value = FIELD::GetValue(object, ids);
+        if(!value)
+            return FIELD::SetMissing(err);
+
+        result = VALUE::template Compare<OPER>(*value);
+        return true;
+    }
+};
+
+// Note: IN tests the values one by one, the compiler turns it into
+// a few compares of the same type as the tested value
+template<class FIELD, bool NEGATE, class... VALUES>
+struct StaticIn
+{
+    template<class OBJECT>
+    static bool Evaluate(const OBJECT& object, const FieldId* ids, bool& result, std::string& err)
+    {
+        const Value* value = FIELD::GetValue(object, ids);
+        if(!value)
+            return FIELD::SetMissing(err);
+
+        bool found = false;
+        if(value->IsInt())
+        {
+            int64_t num = value->GetInt();
+            found = (VALUES::Equals(num) || ...);
+        }
+        else if(value->IsDouble())
+        {
+            double num = value->GetDouble();
+            found = (VALUES::Equals(num) || ...);
+        }
+        else
+        {
+            std::string_view str = value->GetString();
+            found = (VALUES::Equals(str) || ...);
+        }
+
+        result = (found != NEGATE);
+        return true;
+    }
+};
+
+// Short circuits on the first FALSE child (or an error)
+template<class... CHILDREN>
+struct StaticAnd
+{
+    template<class OBJECT>
+    static bool Evaluate(const OBJECT& object, const FieldId* ids, bool& result, std::string& err)
+    {
+        bool ok = true;
+        (((ok = CHILDREN::Evaluate(object, ids, result, err)) && result) && ...);
+        return ok;
+    }
+};
+
+// Short circuits on the first TRUE child (or an error)
+template<class... CHILDREN>
+struct StaticOr
+{
+    template<class OBJECT>
+    static bool Evaluate(const OBJECT& object, const FieldId* ids, bool& result, std::string& err)
+    {
+        bool ok = true;
+        (((ok = CHILDREN::Evaluate(object, ids, result, err)) && !result) && ...);
+        return ok;
+    }
+};
+
+//
+// Maps node I of the SOURCE tree to its expression template type
+//
+template<class... TYPES>
+struct StaticList {};
+
+template<class SOURCE, int I, StaticParser::Kind KIND = StaticTree<SOURCE>::value.nodes[I].kind>
+struct StaticNode;
+
+// Types of node I and its next siblings
+template<class SOURCE, int I, class... TYPES>
+struct StaticSiblings
+{
+    using type = typename StaticSiblings<SOURCE, StaticTree<SOURCE>::value.nodes[I].next,
+                                         TYPES..., typename StaticNode<SOURCE, I>::type>::type;
+};
+
+template<class SOURCE, class... TYPES>
+struct StaticSiblings<SOURCE, -1, TYPES...>
+{
+    using type = StaticList<TYPES...>;
+};
+
+// Instantiates TEMPLATE<PREFIX..., CHILDREN...> with the children of node I
+template<class SOURCE, int I, template<class...> class TEMPLATE, class LIST = typename StaticSiblings<SOURCE,
+         StaticTree<SOURCE>::value.nodes[I].first>::type>
+struct StaticChildren;
+
+template<class SOURCE, int I, template<class...> class TEMPLATE, class... CHILDREN>
+struct StaticChildren<SOURCE, I, TEMPLATE, StaticList<CHILDREN...>>
+{
+    using type = TEMPLATE<CHILDREN...>;
+};
+
+template<class SOURCE, int I>
+struct StaticNode<SOURCE, I, StaticParser::VALUE>
+{
+    static constexpr const StaticParser::Node& node = StaticTree<SOURCE>::value.nodes[I];
+    using type = std::conditional_t<node.isInt, StaticInt<node.intValue>,
+                 std::conditional_t<node.isDouble, StaticDouble<SOURCE, I>, StaticString<SOURCE, I>>>;
+};
+
+template<class SOURCE, int I>
+struct StaticNode<SOURCE, I, StaticParser::COMPARE>
+{
+    static constexpr const StaticParser::Node& node = StaticTree<SOURCE>::value.nodes[I];
+    using type = StaticCompare<StaticField<SOURCE, node.field>, node.oper,
+                               typename StaticNode<SOURCE, I, StaticParser::VALUE>::type>;
+};
+
+template<class SOURCE, int I>
+struct StaticNode<SOURCE, I, StaticParser::IN>
+{
+    static constexpr const StaticParser::Node& node = StaticTree<SOURCE>::value.nodes[I];
+
+    template<class... VALUES>
+    using In = StaticIn<StaticField<SOURCE, node.field>, node.negate, VALUES...>;
+    using type = typename StaticChildren<SOURCE, I, In>::type;
+};
+
+template<class SOURCE, int I>
+struct StaticNode<SOURCE, I, StaticParser::AND>
+{
+    using type = typename StaticChildren<SOURCE, I, StaticAnd>::type;
+};
+
+template<class SOURCE, int I>
+struct StaticNode<SOURCE, I, StaticParser::OR>
+{
+    using type = typename StaticChildren<SOURCE, I, StaticOr>::type;
+};
+
+//
+// Class StaticConstraints.
+// Constraints of the SOURCE literal (see STATIC_CONSTRAINTS). Evaluation
+// is const, so the constraints can be shared by threads.
+//
+template<class SOURCE>
+class StaticConstraints
+{
+public:
+    using Root = typename StaticNode<SOURCE, StaticTree<SOURCE>::value.root>::type;
+    static constexpr int FIELD_COUNT = StaticTree<SOURCE>::value.fieldCount;
+
+    StaticConstraints() = default;
+    ~StaticConstraints() = default;
+
+    // Binds field names to the schema (registering new ones), to evaluate
+    // objects that look up values by FieldId, such as Record. Objects that
+    // look up values by name, or map names to ids at compile time (see
+    // HasStaticFieldId), don't need it.
+    void Bind(Schema& schema)
+    {
+        BindFields(schema, std::make_integer_sequence<int, FIELD_COUNT>());
+        bound = true;
+    }
+
+    // Returns false (with the error) if the object can't be evaluated
+    template<class OBJECT>
+    bool Evaluate(const OBJECT& object, bool& result, std::string& err) const
+    {
+        if constexpr(IsSlotIndexed<OBJECT>::value && !HasStaticFieldId<OBJECT>::value)
+        {
+            if(!bound)
+            {
+                err = "Constraints are not bound to a schema";
+                return false;
+            }
+        }
+        return Root::Evaluate(object, ids, result, err);
+    }
+
+    static constexpr std::string_view GetConstraintsStr() { return SOURCE::Get(); }
+
+private:
+    template<int... F>
+    void BindFields(Schema& schema, std::integer_sequence<int, F...>)
+    {
+        ((ids[F] = schema.Bind(StaticField<SOURCE, F>::NAME)), ...);
+    }
+
+    FieldId ids[FIELD_COUNT]{};
+    bool bound{false};
+};
+
+#endif // __STATICCONSTRAINTS_H__
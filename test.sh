@@ -15,6 +15,66 @@ echo ------------------------------------------------------------------
 app ./books.txt "Genre == \"Detective\" AND (Nationality == \" French \" OR Nationality == \"American\")"
 echo ------------------------------------------------------------------
 app ./books.txt "Genre == Detective AND Nationality IN (French, American)"
+echo ------------------------------------------------------------------
+app --tree ./books.txt "Genre == Detective AND (Language == Belgian OR Language == French) AND BookNumber >= 5"
+echo ------------------------------------------------------------------
+app --batch ./books.txt "(Language == French OR Language == Spanish) AND BookNumber > 200"
+echo ------------------------------------------------------------------
+app --threads 2 ./books.txt "BookNumber > 300"
+echo ------------------------------------------------------------------
+app --threads 4 --batch ./books.txt "(Language == French OR Language == Spanish) AND BookNumber > 200"
+echo ------------------------------------------------------------------
+app --dict Language,Nationality --batch ./books.txt "Language IN (French, Spanish) AND Nationality >= Russian"
+echo ------------------------------------------------------------------
+app --subscribe ./subscriptions.txt ./books.txt
+echo ------------------------------------------------------------------
+app --adaptive 8 ./books.txt "BookNumber > 0 AND (Language == Russian OR Genre == Novel)"
+echo ------------------------------------------------------------------
+app --index ./books.txt "(Language == French OR Nationality == Russian) AND Genre != Novel"
+echo ------------------------------------------------------------------
+app --index ./books.txt "BookNumber >= 5 AND BookNumber < 120"
+echo ------------------------------------------------------------------
+columns=$(mktemp)
+app --convert $columns ./books.txt
+app $columns "(Language == French OR Language == Spanish) AND BookNumber > 200"; rm -f $columns
+echo ------------------------------------------------------------------
+app --index ./books.txt "Language == French AND BookNumber > 200" "BookNumber>200 AND Language == \"French\""
+echo ------------------------------------------------------------------
+app ./books.txt "BookNumber > 100 AND (BookNumber > 200 AND BookNumber < 600) AND Language == French"
+echo ------------------------------------------------------------------
+app --explain ./books.txt "(Language == French OR Language == Spanish) AND BookNumber > 200"
+echo ------------------------------------------------------------------
+app ./books.txt "Language == French OR Language == Spanish AND BookNumber > 200"
+echo ------------------------------------------------------------------
+app ./books.txt "NOT (Language == English OR (Genre == Novel AND BookNumber < 500)) AND Nationality NOT IN (French, Russian)"
+echo ------------------------------------------------------------------
+app --count ./books.txt "Language == French OR Language == Spanish"
+echo ------------------------------------------------------------------
+app --limit 3 --fields Autor,BookNumber ./books.txt "BookNumber > 100"
+echo ------------------------------------------------------------------
+app --threads 2 --limit 2 --fields Autor ./books.txt "Language == French"
+echo ------------------------------------------------------------------
+app --group-by Language --agg "count, sum(BookNumber), max(BookNumber)" --order-by "count DESC" ./books.txt "BookNumber > 20"
+echo ------------------------------------------------------------------
+app --order-by "BookNumber DESC" --limit 3 --fields Autor,BookNumber ./books.txt "Language == English"
+echo ------------------------------------------------------------------
+app --threads 2 --group-by Nationality,Genre --agg "avg(BookNumber)" --order-by Nationality --limit 4 ./books.txt "BookNumber > 50"
+echo ------------------------------------------------------------------
+app ./books.txt "BookNumber > 99.5 AND BookNumber <= 1.2e2 OR BookNumber == -1"
+echo ------------------------------------------------------------------
+follow=$(mktemp); cp ./books.txt $follow
+(sleep 0.5; grep French ./books.txt >> $follow; sleep 0.5; rm $follow) &
+app --follow $follow "Language == French"; wait
+echo ------------------------------------------------------------------
+socket=$(mktemp -u); app --serve $socket ./books.txt & server=$!
+for i in $(seq 50); do [ -S $socket ] && break; sleep 0.1; done
+app --connect $socket "Language == French" "COUNT BookNumber > 100" "LIMIT 2 Genre == Manga" "Genre =="; kill $server; wait $server
+echo ------------------------------------------------------------------
+socket=$(mktemp -u); app --serve $socket ./books.txt & server=$!
+for i in $(seq 50); do [ -S $socket ] && break; sleep 0.1; done
+queries=(); for i in $(seq 200); do queries+=("BookNumber > 0"); done
+app --connect $socket "${queries[@]}" | sleep 10 & client=$!
+sleep 0.5; kill $server; wait $server; kill $client; wait
 echo 
 
 
@@ -0,0 +1,477 @@
+//
+// value.h
+//
+#ifndef __VALUE_H__
+#define __VALUE_H__
+
+#include <iostream>         // std::cout
+#include <string>
+#include <string_view>
+#include <variant>
+#include <unordered_set>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <algorithm>        // std::sort, std::lower_bound
+#include <charconv>         // std::from_chars, std::to_chars
+#include <stdint.h>         // int64_t, uint32_t
+
+//
+// Dictionary encoded (interned) string, see class Dictionary.
+// Interned strings of the same Dictionary are equal if their codes are
+// equal, so equality is an integer compare. Ordering compares the strings
+// (codes are only order-preserving in a sorted Dictionary).
+//
+struct InternedString
+{
+    uint32_t code;
+    const std::string* str; // Owned by the Dictionary
+
+    bool operator==(const InternedString& in) const { return code == in.code; }
+    bool operator!=(const InternedString& in) const { return code != in.code; }
+    bool operator<(const InternedString& in) const { return *str < *in.str; }
+    bool operator<=(const InternedString& in) const { return *str <= *in.str; }
+    bool operator>(const InternedString& in) const { return *str > *in.str; }
+    bool operator>=(const InternedString& in) const { return *str >= *in.str; }
+};
+
+//
+// Class Dictionary.
+// String interning dictionary: maps strings to dense integer codes.
+// Codes are assigned in the order strings are added; Sort() re-assigns
+// them in the string order (order-preserving codes) for static data.
+//
+class Dictionary
+{
+public:
+    using Code = uint32_t;
+    static constexpr Code INVALID_CODE = (Code)-1;
+
+    Dictionary() = default;
+    Dictionary(const Dictionary& dict) { *this = dict; }
+    ~Dictionary() = default;
+
+    // Note: Strings of the copy are owned by the copy
+    Dictionary& operator=(const Dictionary& dict)
+    {
+        if(this == &dict)
+            return *this;
+
+        Clear();
+        for(const std::string* str : dict.strings)
+            Intern(*str);
+        sorted = dict.sorted;
+        return *this;
+    }
+
+    // Returns code of the existing string or adds a new one
+    Code Intern(std::string_view str)
+    {
+        auto it = codes.find(str);
+        if(it != codes.end())
+            return it->second;
+
+        Code code = (Code)strings.size();
+        const std::string& stored = storage.emplace_back(str);
+        strings.push_back(&stored);
+        codes.emplace(stored, code);
+
+        // Adding a string after the last one keeps the order
+        if(sorted && code > 0 && *strings[code - 1] >= stored)
+            sorted = false;
+        return code;
+    }
+
+    InternedString InternString(std::string_view str)
+    {
+        Code code = Intern(str);
+        return InternedString{code, strings[code]};
+    }
+
+    // Returns code of the existing string or INVALID_CODE
+    Code Find(std::string_view str) const
+    {
+        auto it = codes.find(str);
+        return (it == codes.end() ? INVALID_CODE : it->second);
+    }
+
+    const std::string& GetString(Code code) const { return *strings[code]; }
+    size_t GetSize() const { return strings.size(); }
+
+    // Re-assigns codes in the string order. If remap is given, it receives
+    // the new code for every old code, so the encoded data can be updated.
+    // Note: Codes held by the encoded data become invalid after Sort().
+    void Sort(std::vector<Code>* remap = nullptr);
+
+    // Order-preserving codes: code order is the same as string order
+    bool IsSorted() const { return sorted; }
+
+    // First code with string >= str (or > str for UpperBound).
+    // Only meaningful if the dictionary IsSorted().
+    Code LowerBound(std::string_view str) const;
+    Code UpperBound(std::string_view str) const;
+
+    void Clear()
+    {
+        codes.clear();
+        strings.clear();
+        storage.clear();
+        sorted = true;
+    }
+
+private:
+    std::deque<std::string> storage;                // Stable addresses
+    std::vector<const std::string*> strings;        // By code
+    std::unordered_map<std::string_view, Code> codes;
+    bool sorted{true};
+};
+
+inline void Dictionary::Sort(std::vector<Code>* remap /*=nullptr*/)
+{
+    std::vector<Code> order(strings.size());
+    for(Code i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](Code a, Code b) { return *strings[a] < *strings[b]; });
+
+    if(remap)
+        remap->resize(strings.size());
+
+    std::vector<const std::string*> sortedStrings(strings.size());
+    for(Code newCode = 0; newCode < order.size(); newCode++)
+    {
+        Code oldCode = order[newCode];
+        sortedStrings[newCode] = strings[oldCode];
+        codes[*strings[oldCode]] = newCode;
+        if(remap)
+            (*remap)[oldCode] = newCode;
+    }
+
+    strings.swap(sortedStrings);
+    sorted = true;
+}
+
+inline Dictionary::Code Dictionary::LowerBound(std::string_view str) const
+{
+    auto it = std::lower_bound(strings.begin(), strings.end(), str,
+            [](const std::string* a, std::string_view b) { return *a < b; });
+    return (Code)(it - strings.begin());
+}
+
+inline Dictionary::Code Dictionary::UpperBound(std::string_view str) const
+{
+    auto it = std::upper_bound(strings.begin(), strings.end(), str,
+            [](std::string_view a, const std::string* b) { return a < *b; });
+    return (Code)(it - strings.begin());
+}
+
+//
+// Class Value
+// A string, a 64-bit integer or a double. Numbers are detected when a
+// value is assigned from text (see Assign), and compare numerically
+// across the integer and double types.
+//
+class Value
+{
+public:
+    Value(const std::string& valueStr) { Assign(valueStr); }
+    Value(int valueIn) : value((int64_t)valueIn) {}
+    Value(int64_t valueIn) : value(valueIn) {}
+    Value(double valueIn) : value(valueIn) {}
+    Value(const InternedString& valueIn) : value(valueIn) {}
+    Value() = default;
+    ~Value() = default;
+
+    Value& operator=(const std::string& valueStr) { return Assign(valueStr); }
+
+    // Sets the number of the text (see ParseNumber), or the string. Doesn't
+    // allocate if the value already holds a string with enough capacity
+    // (used to recycle values across rows on ingest). If dict is given,
+    // then a string is interned rather than copied.
+    Value& Assign(std::string_view valueStr, Dictionary* dict = nullptr)
+    {
+        if(ParseNumber(valueStr))
+            return *this;
+
+        if(dict)
+            value = dict->InternString(valueStr);
+        else if(std::string* str = std::get_if<std::string>(&value))
+            str->assign(valueStr.data(), valueStr.size());
+        else
+            value.emplace<std::string>(valueStr);
+
+        return *this;
+    }
+
+    // Sets the number if the whole text is one: an integer ("-42") or,
+    // if the digits go on with a fraction or an exponent ("4.2", "42e-1"),
+    // or don't fit into int64, a double. The integer is parsed while it is
+    // detected, in a single pass, and without exceptions or locale lookups
+    // (std::from_chars). Returns false (and leaves the value) otherwise.
+    bool ParseNumber(std::string_view valueStr)
+    {
+        const char* begin = valueStr.data();
+        const char* end = begin + valueStr.size();
+
+        int64_t num = 0;
+        auto [ptr, ec] = std::from_chars(begin, end, num);
+        if(ptr == end && ec == std::errc())
+        {
+            value = num;
+            return true;
+        }
+
+        // No digits ("", "-", "English"), or an integer with a suffix ("7th")
+        if(ptr == begin || (ec == std::errc() && *ptr != '.' && *ptr != 'e' && *ptr != 'E'))
+            return false;
+
+        double dbl = 0;
+        auto [dblPtr, dblEc] = std::from_chars(begin, end, dbl);
+        if(dblPtr != end || dblEc != std::errc())
+            return false;
+
+        value = dbl;
+        return true;
+    }
+
+    // Note: Values of the same type compare directly (interned strings by
+    // their codes for equality). Integers and doubles compare as numbers,
+    // interned and not interned strings compare as strings, and any string
+    // is less than any number.
+    bool operator==(const Value& valueIn) const { return IsSameType(valueIn) ? value == valueIn.value : Compare(valueIn) == 0; }
+    bool operator!=(const Value& valueIn) const { return IsSameType(valueIn) ? value != valueIn.value : Compare(valueIn) != 0; }
+    bool operator<(const Value& valueIn) const { return IsSameType(valueIn) ? value < valueIn.value : Compare(valueIn) < 0; }
+    bool operator<=(const Value& valueIn) const { return IsSameType(valueIn) ? value <= valueIn.value : Compare(valueIn) <= 0; }
+    bool operator>(const Value& valueIn) const { return IsSameType(valueIn) ? value > valueIn.value : Compare(valueIn) > 0; }
+    bool operator>=(const Value& valueIn) const { return IsSameType(valueIn) ? value >= valueIn.value : Compare(valueIn) >= 0; }
+
+    // Note: IsString() is true for both interned and not interned strings
+    bool IsString() const { return !IsNumber(); }
+    bool IsNumber() const { return IsInt() || IsDouble(); }
+    bool IsInt() const { return std::holds_alternative<int64_t>(value); }
+    bool IsDouble() const { return std::holds_alternative<double>(value); }
+    bool IsInterned() const { return std::holds_alternative<InternedString>(value); }
+    const std::string& GetString() const
+    {
+        const InternedString* interned = std::get_if<InternedString>(&value);
+        return (interned ? *interned->str : std::get<std::string>(value));
+    }
+    int64_t GetInt() const { return std::get<int64_t>(value); }
+    double GetDouble() const { return std::get<double>(value); }
+    double GetNumber() const { return (IsInt() ? (double)GetInt() : GetDouble()); }
+    const InternedString& GetInterned() const { return std::get<InternedString>(value); }
+
+    // Gets the integer, or the double if it has an integral value in the
+    // int64 range (so it is equal to that integer)
+    bool GetIntegral(int64_t& num) const
+    {
+        if(IsInt())
+        {
+            num = GetInt();
+            return true;
+        }
+
+        if(!IsDouble())
+            return false;
+
+        double dbl = GetDouble();
+        if(!(dbl >= -0x1p63 && dbl < 0x1p63) || dbl != (double)(int64_t)dbl)
+            return false;
+        num = (int64_t)dbl;
+        return true;
+    }
+
+    // Compares an integer and a double exactly (-1, 0 or 1), even where
+    // the integer has no exact double (beyond 2^53)
+    static int CompareNumbers(int64_t a, double b)
+    {
+        if(b != b)
+            return -1; // NaN (not parsed from text) is ordered last
+        if(b >= 0x1p63)
+            return -1;
+        if(b < -0x1p63)
+            return 1;
+
+        // b is in the int64 range: compare the integral parts, then the fraction
+        int64_t integral = (int64_t)b;
+        if(a != integral)
+            return (a < integral ? -1 : 1);
+        double fraction = b - (double)integral;
+        return (fraction > 0 ? -1 : fraction < 0 ? 1 : 0);
+    }
+
+    std::ostream& Dump(std::ostream& os) const
+    {
+        if(IsString())
+            return os << "'" << GetString() << "'";
+
+        char buf[32];
+        return os.write(buf, FormatNumber(buf, buf + sizeof(buf)) - buf);
+    }
+
+    // Appends the value the way Dump() prints it (without a stream)
+    void Format(std::string& out) const
+    {
+        if(IsString())
+        {
+            out += '\'';
+            out += GetString();
+            out += '\'';
+            return;
+        }
+
+        char buf[32];
+        out.append(buf, FormatNumber(buf, buf + sizeof(buf)) - buf);
+    }
+
+private:
+    bool IsSameType(const Value& valueIn) const { return value.index() == valueIn.value.index(); }
+
+    // Compares values of different types
+    int Compare(const Value& valueIn) const
+    {
+        if(IsNumber() != valueIn.IsNumber())
+            return (IsNumber() ? 1 : -1);
+        if(IsInt() && valueIn.IsDouble())
+            return CompareNumbers(GetInt(), valueIn.GetDouble());
+        if(IsDouble() && valueIn.IsInt())
+            return -CompareNumbers(valueIn.GetInt(), GetDouble());
+        return GetString().compare(valueIn.GetString());
+    }
+
+    // Writes the number (the shortest text that parses back to the same
+    // double), returns the end of the text
+    char* FormatNumber(char* buf, char* bufEnd) const
+    {
+        auto [ptr, ec] = (IsInt() ? std::to_chars(buf, bufEnd, GetInt()) : std::to_chars(buf, bufEnd, GetDouble()));
+        return ptr;
+    }
+
+    std::variant<std::string, int64_t, double, InternedString> value;
+
+    friend std::ostream& operator<<(std::ostream& os, const Value& val);
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Value& val) { return val.Dump(os); }
+
+// Hash consistent with the Value equality: interned strings hash as
+// strings, since they are equal to the same not interned ones, and
+// integral doubles as the equal integers
+struct ValueHash
+{
+    size_t operator()(const Value& val) const
+    {
+        int64_t num = 0;
+        if(val.GetIntegral(num))
+            return std::hash<int64_t>()(num);
+        if(val.IsDouble())
+            return std::hash<double>()(val.GetDouble());
+        return std::hash<std::string_view>()(val.GetString());
+    }
+};
+
+//
+// Class ValueSet.
+// Set of values for membership test (operator IN). Integer, double and
+// string values are kept in separate hash sets, so a test is a single hash
+// lookup of the same type as the tested value (doubles with an integral
+// value are kept as integers, since they are equal). Once encoded with a
+// Dictionary, interned strings are tested by their codes.
+//
+class ValueSet
+{
+public:
+    ValueSet() = default;
+    ~ValueSet() = default;
+
+    void Insert(const Value& val)
+    {
+        int64_t num = 0;
+        if(val.GetIntegral(num))
+            intValues.insert(num);
+        else if(val.IsDouble())
+            doubleValues.insert(val.GetDouble());
+        else
+            strValues.insert(val.GetString());
+    }
+
+    bool Contains(const Value& val) const
+    {
+        if(val.IsInt())
+            return intValues.find(val.GetInt()) != intValues.end();
+        else if(val.IsDouble())
+            return ContainsDouble(val.GetDouble());
+        else if(val.IsInterned() && encoded)
+            return codeValues.find(val.GetInterned().code) != codeValues.end();
+        else
+            return strValues.find(val.GetString()) != strValues.end();
+    }
+
+    bool ContainsInt(int64_t val) const { return intValues.find(val) != intValues.end(); }
+    bool ContainsDouble(double val) const
+    {
+        int64_t num = 0;
+        if(Value(val).GetIntegral(num))
+            return intValues.find(num) != intValues.end();
+        return doubleValues.find(val) != doubleValues.end();
+    }
+    bool ContainsString(const std::string& val) const { return strValues.find(val) != strValues.end(); }
+
+    // Adds codes of the string values, so interned strings of the
+    // same dictionary are tested with integer hashing
+    void Encode(Dictionary& dict)
+    {
+        for(const std::string& str : strValues)
+            codeValues.insert(dict.Intern(str));
+        encoded = true;
+    }
+
+    size_t GetSize() const { return intValues.size() + doubleValues.size() + strValues.size(); }
+
+    // Calls func(const Value&) for every value of the set
+    template<class FUNC>
+    void ForEach(FUNC func) const
+    {
+        for(int64_t val : intValues)
+            func(Value(val));
+        for(double val : doubleValues)
+            func(Value(val));
+        for(const std::string& val : strValues)
+            func(Value(val));
+    }
+
+private:
+    std::unordered_set<int64_t> intValues;
+    std::unordered_set<double> doubleValues;
+    std::unordered_set<std::string> strValues;
+    std::unordered_set<Dictionary::Code> codeValues;
+    bool encoded{false};
+};
+
+//
+// Struct ValueRange.
+// Interval of values (operand of a merged range predicate). Either bound
+// is inclusive or exclusive, and bounds compare as the Value operators do.
+//
+struct ValueRange
+{
+    Value lo;
+    Value hi;
+    bool loInclusive{true};
+    bool hiInclusive{true};
+
+    bool Contains(const Value& val) const
+    {
+        return (loInclusive ? val >= lo : val > lo) && (hiInclusive ? val <= hi : val < hi);
+    }
+
+    // Interns string bounds (see ValueSet::Encode)
+    void Encode(Dictionary& dict)
+    {
+        if(lo.IsString())
+            lo = Value(dict.InternString(lo.GetString()));
+        if(hi.IsString())
+            hi = Value(dict.InternString(hi.GetString()));
+    }
+};
+
+#endif // __VALUE_H__